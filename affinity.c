@@ -0,0 +1,201 @@
+/**
+ * affinity.c - CPU affinity, niceness and scheduling policy of commands
+ *
+ * The cpus, nice and sched prefixes set the CPUs, the niceness and the
+ * scheduling policy of the command they precede, e.g.
+ *
+ *     cpus 0-3,8 nice 5 sched batch make -j4 &
+ *
+ * They are applied in the child, next to the redirections, so the shell
+ * itself is never changed. With SMALLSH_AUTO_AFFINITY=cores, background
+ * processes without a cpus prefix are spread round-robin over the CPUs
+ * the shell may run on; with SMALLSH_AUTO_AFFINITY=nodes, over the NUMA
+ * nodes.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include "affinity.h"
+
+#define NODE_CPULIST "/sys/devices/system/node/node%d/cpulist"
+
+/* Scheduling policies by name */
+static const struct {
+    const char *name;
+    int policy;
+} policies[] = {
+    {"other", SCHED_OTHER},
+    {"batch", SCHED_BATCH},
+    {"idle", SCHED_IDLE},
+    {"fifo", SCHED_FIFO},
+    {"rr", SCHED_RR},
+};
+
+/* CPU sets background processes are spread over, NULL until needed */
+static cpu_set_t *auto_slots = NULL;
+static int auto_slot_count = -1;
+static int auto_next = 0;
+
+/**
+ * Parses a CPU list such as "0-3,8,10-11".
+ *
+ * @param list: The list
+ * @param set: Receives the CPUs
+ * @return: 0 on success, -1 if the list is not valid
+ */
+int affinity_parse_cpus(const char *list, cpu_set_t *set) {
+    CPU_ZERO(set);
+
+    do {
+        char *end;
+        long first = strtol(list, &end, 10);
+        long last = first;
+        if (end == list || first < 0) {
+            return -1;
+        }
+        if (*end == '-') {
+            list = end + 1;
+            last = strtol(list, &end, 10);
+            if (end == list || last < first) {
+                return -1;
+            }
+        }
+        if (last >= CPU_SETSIZE) {
+            return -1;
+        }
+        for (long cpu = first; cpu <= last; cpu++) {
+            CPU_SET(cpu, set);
+        }
+        list = end;
+    } while (*list++ == ',');
+
+    return list[-1] == '\0' ? 0 : -1;
+}
+
+/**
+ * Parses the name of a scheduling policy.
+ *
+ * @param name: other, batch, idle, fifo or rr
+ * @return: The policy, or -1 if the name is not known
+ */
+int affinity_parse_policy(const char *name) {
+    for (size_t i = 0; i < sizeof(policies) / sizeof(policies[0]); i++) {
+        if (strcmp(name, policies[i].name) == 0) {
+            return policies[i].policy;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Applies the cpus, nice and sched prefixes of a command to the calling
+ * process. Only async-signal-safe calls are used, so this is safe in a
+ * vfork child.
+ *
+ * @param command: The command
+ * @return: 0 on success, -1 on failure with errno set
+ */
+int affinity_apply(const struct command_line *command) {
+    if (command->cpus != NULL &&
+        sched_setaffinity(0, sizeof(cpu_set_t), command->cpus) == -1) {
+        return -1;
+    }
+    if (command->has_sched) {
+        struct sched_param param = {0};
+        if (command->sched_policy == SCHED_FIFO || command->sched_policy == SCHED_RR) {
+            param.sched_priority = sched_get_priority_min(command->sched_policy);
+        }
+        if (sched_setscheduler(0, command->sched_policy, &param) == -1) {
+            return -1;
+        }
+    }
+    if (command->has_nice) {
+        errno = 0;
+        int current = getpriority(PRIO_PROCESS, 0);
+        if (errno != 0 ||
+            setpriority(PRIO_PROCESS, 0, current + command->nice) == -1) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Builds the CPU sets of the automatic mode from SMALLSH_AUTO_AFFINITY.
+ */
+static void load_auto_slots(void) {
+    const char *mode = getenv("SMALLSH_AUTO_AFFINITY");
+    cpu_set_t allowed;
+
+    auto_slot_count = 0;
+    if (mode == NULL || sched_getaffinity(0, sizeof(allowed), &allowed) == -1) {
+        return;
+    }
+    if (strcmp(mode, "cores") != 0 && strcmp(mode, "nodes") != 0) {
+        fprintf(stderr, "SMALLSH_AUTO_AFFINITY: expected cores or nodes\n");
+        fflush(stderr);
+        return;
+    }
+    auto_slots = malloc(CPU_COUNT(&allowed) * sizeof(cpu_set_t));
+    if (auto_slots == NULL) {
+        perror("Memory allocation for CPU sets failed");
+        return;
+    }
+
+    // One set per NUMA node, keeping only the CPUs the shell may use
+    if (strcmp(mode, "nodes") == 0) {
+        char path[64];
+        char list[4096];
+        for (int node = 0; auto_slot_count < CPU_COUNT(&allowed); node++) {
+            snprintf(path, sizeof(path), NODE_CPULIST, node);
+            FILE *file = fopen(path, "r");
+            if (file == NULL) {
+                break;
+            }
+            bool have_list = fgets(list, sizeof(list), file) != NULL;
+            fclose(file);
+            list[strcspn(list, "\n")] = '\0';
+            cpu_set_t *slot = &auto_slots[auto_slot_count];
+            if (have_list && affinity_parse_cpus(list, slot) == 0) {
+                CPU_AND(slot, slot, &allowed);
+                auto_slot_count += CPU_COUNT(slot) > 0;
+            }
+        }
+        if (auto_slot_count > 1) {
+            return;
+        }
+        auto_slot_count = 0; // A single node, spread over the cores instead
+    }
+
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, &allowed)) {
+            CPU_ZERO(&auto_slots[auto_slot_count]);
+            CPU_SET(cpu, &auto_slots[auto_slot_count]);
+            auto_slot_count++;
+        }
+    }
+}
+
+/**
+ * Gives a background process without a cpus prefix the next CPU or NUMA
+ * node of the automatic mode, if it is on.
+ *
+ * @param command: The command about to be started
+ */
+void affinity_auto(struct command_line *command) {
+    if (command->cpus != NULL) {
+        return;
+    }
+    if (auto_slot_count == -1) {
+        load_auto_slots();
+    }
+    if (auto_slot_count == 0) {
+        return;
+    }
+    command->cpus = &auto_slots[auto_next];
+    auto_next = (auto_next + 1) % auto_slot_count;
+}
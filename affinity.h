@@ -0,0 +1,17 @@
+/**
+ * affinity.h - CPU affinity, niceness and scheduling policy of commands
+ */
+
+#ifndef AFFINITY_H
+#define AFFINITY_H
+
+#include <sched.h>
+#include "parser.h"
+
+/* Function declarations */
+int affinity_parse_cpus(const char *list, cpu_set_t *set);
+int affinity_parse_policy(const char *name);
+int affinity_apply(const struct command_line *command);
+void affinity_auto(struct command_line *command);
+
+#endif /* AFFINITY_H */
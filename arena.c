@@ -0,0 +1,197 @@
+/**
+ * arena.c - Per-line bump allocator
+ *
+ * Everything parsed from one line of input is allocated from an arena
+ * and released at once with arena_reset(). Allocation is a pointer bump
+ * and nothing is freed piece by piece. The largest block is kept across
+ * resets, so after the first few lines parsing does not call malloc().
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "arena.h"
+
+#define ARENA_ALIGNMENT 16
+
+/**
+ * Initializes an empty arena.
+ *
+ * @param arena: A pointer to the arena
+ */
+void arena_init(struct arena *arena) {
+    arena->head = NULL;
+    arena->last = NULL;
+}
+
+/**
+ * Returns the aligned address of the free space in a block.
+ *
+ * @param block: The block
+ * @return: The address the next allocation would start at
+ */
+static char *next_free(struct arena_block *block) {
+    uintptr_t address = (uintptr_t)(block->data + block->used);
+    address = (address + ARENA_ALIGNMENT - 1) & ~(uintptr_t)(ARENA_ALIGNMENT - 1);
+    return (char *)address;
+}
+
+/**
+ * Starts a new block that can hold at least the given number of bytes.
+ *
+ * @param arena: A pointer to the arena
+ * @param size: The number of bytes the block must hold
+ * @return: The new block, or NULL on failure
+ */
+static struct arena_block *new_block(struct arena *arena, size_t size) {
+    size_t block_size = ARENA_BLOCK_SIZE;
+
+    // Oversized requests get a block of their own size
+    if (size + ARENA_ALIGNMENT > block_size) {
+        block_size = size + ARENA_ALIGNMENT;
+    }
+    struct arena_block *block = malloc(sizeof(struct arena_block) + block_size);
+    if (block == NULL) {
+        perror("Memory allocation for arena failed");
+        return NULL;
+    }
+    block->size = block_size;
+    block->used = 0;
+    block->next = arena->head;
+    arena->head = block;
+    return block;
+}
+
+/**
+ * Checks whether the current block has room for an allocation.
+ *
+ * @param block: The current block, or NULL
+ * @param size: The size of the allocation
+ * @return: true if the allocation fits
+ */
+static bool fits(struct arena_block *block, size_t size) {
+    return block != NULL && next_free(block) + size <= block->data + block->size;
+}
+
+/**
+ * Allocates memory that lives until the next arena_reset().
+ *
+ * @param arena: A pointer to the arena
+ * @param size: The number of bytes to allocate
+ * @return: A pointer to the memory, or NULL on failure
+ */
+void *arena_alloc(struct arena *arena, size_t size) {
+    struct arena_block *block = arena->head;
+    char *start;
+
+    if (!fits(block, size)) {
+        block = new_block(arena, size);
+        if (block == NULL) {
+            return NULL;
+        }
+    }
+
+    start = next_free(block);
+    block->used = (start - block->data) + size;
+    arena->last = start;
+    return start;
+}
+
+/**
+ * Resizes an allocation. The most recent allocation grows in place when
+ * its block has room, anything else is copied.
+ *
+ * @param arena: A pointer to the arena
+ * @param ptr: The allocation to grow, or NULL
+ * @param old_size: The current size of the allocation
+ * @param new_size: The requested size
+ * @return: A pointer to the resized memory, or NULL on failure
+ */
+void *arena_grow(struct arena *arena, void *ptr, size_t old_size, size_t new_size) {
+    struct arena_block *block = arena->head;
+
+    if (ptr != NULL && ptr == arena->last &&
+        (char *)ptr + new_size <= block->data + block->size) {
+        block->used = ((char *)ptr - block->data) + new_size;
+        return ptr;
+    }
+
+    // Leave room to keep growing in place, so that data appended piece
+    // by piece is only copied a logarithmic number of times
+    if (!fits(block, new_size) && new_block(arena, new_size * 2) == NULL) {
+        return NULL;
+    }
+    void *new_ptr = arena_alloc(arena, new_size);
+    if (new_ptr != NULL && ptr != NULL) {
+        memcpy(new_ptr, ptr, old_size < new_size ? old_size : new_size);
+    }
+    return new_ptr;
+}
+
+/**
+ * Copies a string into the arena.
+ *
+ * @param arena: A pointer to the arena
+ * @param text: The characters to copy
+ * @param length: The number of characters to copy
+ * @return: The NUL-terminated copy, or NULL on failure
+ */
+char *arena_strndup(struct arena *arena, const char *text, size_t length) {
+    char *copy = arena_alloc(arena, length + 1);
+    if (copy != NULL) {
+        memcpy(copy, text, length);
+        copy[length] = '\0';
+    }
+    return copy;
+}
+
+/**
+ * Releases every allocation at once. The largest block is kept for
+ * reuse and the others are freed.
+ *
+ * @param arena: A pointer to the arena
+ */
+void arena_reset(struct arena *arena) {
+    struct arena_block *largest = arena->head;
+
+    for (struct arena_block *block = arena->head; block != NULL;
+         block = block->next) {
+        if (block->size > largest->size) {
+            largest = block;
+        }
+    }
+
+    struct arena_block *block = arena->head;
+    while (block != NULL) {
+        struct arena_block *next = block->next;
+        if (block != largest) {
+            free(block);
+        }
+        block = next;
+    }
+
+    if (largest != NULL) {
+        largest->used = 0;
+        largest->next = NULL;
+    }
+    arena->head = largest;
+    arena->last = NULL;
+}
+
+/**
+ * Frees all memory held by the arena.
+ *
+ * @param arena: A pointer to the arena
+ */
+void arena_free(struct arena *arena) {
+    struct arena_block *block = arena->head;
+
+    while (block != NULL) {
+        struct arena_block *next = block->next;
+        free(block);
+        block = next;
+    }
+    arena_init(arena);
+}
@@ -0,0 +1,38 @@
+/**
+ * arena.h - Per-line bump allocator
+ */
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+#define ARENA_BLOCK_SIZE 16384
+
+/**
+ * One block of arena memory
+ */
+struct arena_block {
+    struct arena_block *next;
+    size_t size;
+    size_t used;
+    char data[];
+};
+
+/**
+ * Structure for a bump allocator that is reset as a whole
+ */
+struct arena {
+    struct arena_block *head;   // Block allocations are taken from
+    void *last;                 // Most recent allocation, for arena_grow()
+};
+
+/* Function declarations */
+void arena_init(struct arena *arena);
+void *arena_alloc(struct arena *arena, size_t size);
+void *arena_grow(struct arena *arena, void *ptr, size_t old_size, size_t new_size);
+char *arena_strndup(struct arena *arena, const char *text, size_t length);
+void arena_reset(struct arena *arena);
+void arena_free(struct arena *arena);
+
+#endif /* ARENA_H */
@@ -0,0 +1,596 @@
+/**
+ * bench.c - Benchmark harness for smallsh
+ *
+ * Drives the shell through generated scripts and pipes and measures:
+ * - commands per second, for the vfork() fast path, the fork() path and
+ *   the in-process true builtin
+ * - prompt-to-exec latency: from writing a command line to the shell's
+ *   input until the command is running
+ * - background reap latency: from the exit of a background job until the
+ *   shell reports it
+ * - parse throughput: lines and bytes per second for lines that are
+ *   parsed but not executed
+ *
+ * Every measurement is repeated and summarized with percentiles. The
+ * results are written as JSON.
+ *
+ * Usage: bench [-n count] [-r runs] [-o file] [shell]
+ *
+ * The harness also serves as the command being timed: started as
+ * "bench --stamp" it prints the CLOCK_MONOTONIC time in nanoseconds.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#define DEFAULT_COUNT 2000
+#define DEFAULT_RUNS 5
+#define LATENCY_SAMPLES 500
+#define PARSE_LINES 100000
+#define PARSE_WORDS 24
+#define LINE_LENGTH 256
+
+/**
+ * Percentile summary of a set of samples
+ */
+struct summary {
+    int samples;
+    double min;
+    double p50;
+    double p90;
+    double p99;
+    double max;
+    double mean;
+};
+
+/**
+ * Pipes connected to a running shell
+ */
+struct shell_process {
+    pid_t pid;
+    int in_fd;              // Writes to the shell's standard input
+    int out_fd;             // Reads the shell's standard output
+    char buffer[4096];
+    size_t length;
+};
+
+static const char *shell_path = "./smallsh";
+static char stamp_path[PATH_MAX];
+
+/**
+ * Returns the CLOCK_MONOTONIC time.
+ *
+ * @return: The time in nanoseconds
+ */
+static long long now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+/**
+ * Orders doubles for qsort().
+ */
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * Summarizes samples with nearest-rank percentiles.
+ *
+ * @param values: The samples, sorted in place
+ * @param count: The number of samples
+ * @return: The summary
+ */
+static struct summary summarize(double *values, int count) {
+    struct summary result = {0};
+    double total = 0;
+
+    if (count == 0) {
+        return result;
+    }
+    qsort(values, count, sizeof(double), compare_doubles);
+    for (int i = 0; i < count; i++) {
+        total += values[i];
+    }
+    result.samples = count;
+    result.min = values[0];
+    result.p50 = values[(count - 1) * 50 / 100];
+    result.p90 = values[(count - 1) * 90 / 100];
+    result.p99 = values[(count - 1) * 99 / 100];
+    result.max = values[count - 1];
+    result.mean = total / count;
+    return result;
+}
+
+/**
+ * Writes a summary as a JSON object.
+ *
+ * @param out: The output stream
+ * @param name: The key of the object
+ * @param summary: The summary
+ * @param last: A flag indicating if no member follows
+ */
+static void print_summary(
+    FILE *out,
+    const char *name,
+    const struct summary *summary,
+    int last
+) {
+    fprintf(out,
+            "    \"%s\": {\"samples\": %d, \"min\": %.3f, \"p50\": %.3f, "
+            "\"p90\": %.3f, \"p99\": %.3f, \"max\": %.3f, \"mean\": %.3f}%s\n",
+            name, summary->samples, summary->min, summary->p50,
+            summary->p90, summary->p99, summary->max, summary->mean,
+            last ? "" : ",");
+}
+
+/**
+ * Creates a temporary script file.
+ *
+ * @param path: Receives the path, at least PATH_MAX bytes
+ * @return: The stream to write the script to, or NULL on failure
+ */
+static FILE *create_script(char *path) {
+    snprintf(path, PATH_MAX, "/tmp/smallsh-bench-XXXXXX");
+    int fd = mkstemp(path);
+    if (fd == -1) {
+        perror("mkstemp() failed");
+        return NULL;
+    }
+    return fdopen(fd, "w");
+}
+
+/**
+ * Runs the shell on a script with output discarded.
+ *
+ * @param script: The path of the script
+ * @param fork_only: A flag to force the fork() path
+ * @return: The wall time in nanoseconds, or -1 on failure
+ */
+static long long run_script(const char *script, int fork_only) {
+    long long start = now_ns();
+    pid_t pid = fork();
+
+    if (pid == -1) {
+        perror("fork() failed");
+        return -1;
+    }
+    if (pid == 0) {
+        int null_fd = open("/dev/null", O_WRONLY);
+        dup2(null_fd, STDOUT_FILENO);
+        if (fork_only) {
+            setenv("SMALLSH_FORK_ONLY", "1", 1);
+        } else {
+            unsetenv("SMALLSH_FORK_ONLY");
+        }
+        execl(shell_path, shell_path, script, (char *)NULL);
+        perror("cannot run the shell");
+        _exit(127);
+    }
+
+    int status;
+    if (waitpid(pid, &status, 0) == -1 || !WIFEXITED(status) ||
+        WEXITSTATUS(status) == 127) {
+        fprintf(stderr, "bench: the shell failed on %s\n", script);
+        return -1;
+    }
+    return now_ns() - start;
+}
+
+/**
+ * Measures how many trivial commands the shell runs per second.
+ *
+ * @param line: The command line to repeat, including the newline
+ * @param count: The number of commands per run
+ * @param runs: The number of runs
+ * @param fork_only: A flag to force the fork() path
+ * @param result: Receives the commands per second of each run
+ * @return: 0 on success, -1 on failure
+ */
+static int bench_command_rate(
+    const char *line,
+    int count,
+    int runs,
+    int fork_only,
+    struct summary *result
+) {
+    char script[PATH_MAX];
+    double rates[runs];
+    FILE *out = create_script(script);
+
+    if (out == NULL) {
+        return -1;
+    }
+    for (int i = 0; i < count; i++) {
+        fputs(line, out);
+    }
+    fclose(out);
+
+    for (int run = 0; run < runs; run++) {
+        long long elapsed = run_script(script, fork_only);
+        if (elapsed <= 0) {
+            unlink(script);
+            return -1;
+        }
+        rates[run] = count / (elapsed / 1e9);
+    }
+    unlink(script);
+    *result = summarize(rates, runs);
+    return 0;
+}
+
+/**
+ * Measures how fast lines are parsed. The lines are comments, so the
+ * shell tokenizes them in full but runs nothing.
+ *
+ * @param runs: The number of runs
+ * @param lines: Receives the lines per second of each run
+ * @param megabytes: Receives the megabytes per second of each run
+ * @return: 0 on success, -1 on failure
+ */
+static int bench_parse(int runs, struct summary *lines, struct summary *megabytes) {
+    char script[PATH_MAX];
+    double line_rates[runs];
+    double byte_rates[runs];
+    long long bytes = 0;
+    FILE *out = create_script(script);
+
+    if (out == NULL) {
+        return -1;
+    }
+    for (int i = 0; i < PARSE_LINES; i++) {
+        int length = fprintf(out, "#parse");
+        for (int word = 0; word < PARSE_WORDS; word++) {
+            length += fprintf(out, " word%d", (i + word) % 1000);
+        }
+        length += fprintf(out, " < input%d > output%d &\n", i % 10, i % 10);
+        bytes += length;
+    }
+    fclose(out);
+
+    for (int run = 0; run < runs; run++) {
+        long long elapsed = run_script(script, 0);
+        if (elapsed <= 0) {
+            unlink(script);
+            return -1;
+        }
+        line_rates[run] = PARSE_LINES / (elapsed / 1e9);
+        byte_rates[run] = bytes / (elapsed / 1e9) / 1e6;
+    }
+    unlink(script);
+    *lines = summarize(line_rates, runs);
+    *megabytes = summarize(byte_rates, runs);
+    return 0;
+}
+
+/**
+ * Starts the shell with its input and output connected to pipes.
+ *
+ * @param shell: Receives the process and its pipes
+ * @return: 0 on success, -1 on failure
+ */
+static int start_shell(struct shell_process *shell) {
+    int to_shell[2];
+    int from_shell[2];
+
+    if (pipe(to_shell) == -1 || pipe(from_shell) == -1) {
+        perror("pipe() failed");
+        return -1;
+    }
+    shell->pid = fork();
+    if (shell->pid == -1) {
+        perror("fork() failed");
+        return -1;
+    }
+    if (shell->pid == 0) {
+        dup2(to_shell[0], STDIN_FILENO);
+        dup2(from_shell[1], STDOUT_FILENO);
+        close(to_shell[0]);
+        close(to_shell[1]);
+        close(from_shell[0]);
+        close(from_shell[1]);
+        unsetenv("SMALLSH_FORK_ONLY");
+        execl(shell_path, shell_path, (char *)NULL);
+        perror("cannot run the shell");
+        _exit(127);
+    }
+    close(to_shell[0]);
+    close(from_shell[1]);
+    shell->in_fd = to_shell[1];
+    shell->out_fd = from_shell[0];
+    shell->length = 0;
+    return 0;
+}
+
+/**
+ * Sends a line to the shell.
+ *
+ * @param shell: The running shell
+ * @param line: The line, including the newline
+ * @return: 0 on success, -1 on failure
+ */
+static int send_line(struct shell_process *shell, const char *line) {
+    size_t length = strlen(line);
+    if (write(shell->in_fd, line, length) != (ssize_t)length) {
+        perror("write() to the shell failed");
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Reads one line of the shell's output.
+ *
+ * @param shell: The running shell
+ * @param line: Receives the line without its newline
+ * @param size: The size of line
+ * @return: 0 on success, -1 at end of output or on failure
+ */
+static int read_line(struct shell_process *shell, char *line, size_t size) {
+    for (;;) {
+        char *newline = memchr(shell->buffer, '\n', shell->length);
+        if (newline != NULL) {
+            size_t length = newline - shell->buffer;
+            if (length >= size) {
+                length = size - 1;
+            }
+            memcpy(line, shell->buffer, length);
+            line[length] = '\0';
+            shell->length -= newline + 1 - shell->buffer;
+            memmove(shell->buffer, newline + 1, shell->length);
+            return 0;
+        }
+        if (shell->length == sizeof(shell->buffer)) {
+            shell->length = 0; // Drop an overlong line
+        }
+        ssize_t count = read(shell->out_fd, shell->buffer + shell->length,
+                             sizeof(shell->buffer) - shell->length);
+        if (count == -1 && errno == EINTR) {
+            continue;
+        }
+        if (count <= 0) {
+            return -1;
+        }
+        shell->length += count;
+    }
+}
+
+/**
+ * Reads lines of the shell's output until one contains a string.
+ *
+ * @param shell: The running shell
+ * @param text: The string to look for
+ * @param line: Receives the matching line
+ * @param size: The size of line
+ * @return: 0 on success, -1 at end of output or on failure
+ */
+static int expect_line(
+    struct shell_process *shell,
+    const char *text,
+    char *line,
+    size_t size
+) {
+    do {
+        if (read_line(shell, line, size) == -1) {
+            fprintf(stderr, "bench: the shell stopped before \"%s\"\n", text);
+            return -1;
+        }
+    } while (strstr(line, text) == NULL);
+    return 0;
+}
+
+/**
+ * Ends the shell and waits for it.
+ *
+ * @param shell: The running shell
+ */
+static void stop_shell(struct shell_process *shell) {
+    send_line(shell, "exit\n");
+    close(shell->in_fd);
+    close(shell->out_fd);
+    waitpid(shell->pid, NULL, 0);
+}
+
+/**
+ * Measures the time from writing a command line to the shell until the
+ * command runs. After each sample, status makes sure the shell is back
+ * to waiting for input before the next line is written.
+ *
+ * @param result: Receives the latencies in microseconds
+ * @return: 0 on success, -1 on failure
+ */
+static int bench_prompt_to_exec(struct summary *result) {
+    struct shell_process shell;
+    double latencies[LATENCY_SAMPLES];
+    char command[PATH_MAX + 16];
+    char line[LINE_LENGTH];
+
+    if (start_shell(&shell) == -1) {
+        return -1;
+    }
+    snprintf(command, sizeof(command), "%s --stamp\n", stamp_path);
+
+    for (int i = 0; i < LATENCY_SAMPLES; i++) {
+        long long sent = now_ns();
+        if (send_line(&shell, command) == -1 ||
+            read_line(&shell, line, sizeof(line)) == -1) {
+            stop_shell(&shell);
+            return -1;
+        }
+        latencies[i] = (atoll(line) - sent) / 1e3;
+
+        if (send_line(&shell, "status\n") == -1 ||
+            expect_line(&shell, "exit value", line, sizeof(line)) == -1) {
+            stop_shell(&shell);
+            return -1;
+        }
+    }
+    stop_shell(&shell);
+    *result = summarize(latencies, LATENCY_SAMPLES);
+    return 0;
+}
+
+/**
+ * Measures the time from the exit of a background job until the shell
+ * prints its completion message. The job writes its exit time to a file
+ * because background output goes to /dev/null.
+ *
+ * @param result: Receives the latencies in microseconds
+ * @return: 0 on success, -1 on failure
+ */
+static int bench_reap(struct summary *result) {
+    struct shell_process shell;
+    double latencies[LATENCY_SAMPLES];
+    char stamp_file[PATH_MAX];
+    char command[2 * PATH_MAX + 16];
+    char line[LINE_LENGTH];
+
+    FILE *out = create_script(stamp_file);
+    if (out == NULL) {
+        return -1;
+    }
+    fclose(out);
+    if (start_shell(&shell) == -1) {
+        unlink(stamp_file);
+        return -1;
+    }
+    snprintf(command, sizeof(command), "%s --stamp > %s &\n",
+             stamp_path, stamp_file);
+
+    int failed = 0;
+    for (int i = 0; i < LATENCY_SAMPLES && !failed; i++) {
+        if (send_line(&shell, command) == -1 ||
+            expect_line(&shell, "is done", line, sizeof(line)) == -1) {
+            failed = 1;
+            break;
+        }
+        long long reported = now_ns();
+
+        FILE *stamp = fopen(stamp_file, "r");
+        long long exited = 0;
+        if (stamp == NULL || fscanf(stamp, "%lld", &exited) != 1) {
+            fprintf(stderr, "bench: cannot read %s\n", stamp_file);
+            failed = 1;
+        }
+        if (stamp != NULL) {
+            fclose(stamp);
+        }
+        latencies[i] = (reported - exited) / 1e3;
+    }
+    stop_shell(&shell);
+    unlink(stamp_file);
+    if (failed) {
+        return -1;
+    }
+    *result = summarize(latencies, LATENCY_SAMPLES);
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    int count = DEFAULT_COUNT;
+    int runs = DEFAULT_RUNS;
+    const char *output_path = NULL;
+    int option;
+
+    // Stamp mode: print the current time and exit
+    if (argc == 2 && strcmp(argv[1], "--stamp") == 0) {
+        printf("%lld\n", now_ns());
+        return 0;
+    }
+
+    while ((option = getopt(argc, argv, "n:r:o:")) != -1) {
+        switch (option) {
+            case 'n':
+                count = atoi(optarg);
+                break;
+            case 'r':
+                runs = atoi(optarg);
+                break;
+            case 'o':
+                output_path = optarg;
+                break;
+            default:
+                fprintf(stderr,
+                        "usage: bench [-n count] [-r runs] [-o file] [shell]\n");
+                return 2;
+        }
+    }
+    if (optind < argc) {
+        shell_path = argv[optind];
+    }
+    if (count < 1 || runs < 1) {
+        fprintf(stderr, "bench: count and runs must be positive\n");
+        return 2;
+    }
+    ssize_t length = readlink("/proc/self/exe", stamp_path,
+                              sizeof(stamp_path) - 1);
+    if (length == -1) {
+        perror("readlink() failed");
+        return 1;
+    }
+    stamp_path[length] = '\0';
+
+    struct summary vfork_rate;
+    struct summary fork_rate;
+    struct summary builtin_rate;
+    char external[PATH_MAX + 16];
+    struct summary prompt_latency;
+    struct summary reap_latency;
+    struct summary parse_lines;
+    struct summary parse_megabytes;
+
+    fprintf(stderr, "bench: command rate\n");
+    snprintf(external, sizeof(external), "%s --stamp\n", stamp_path);
+    if (bench_command_rate(external, count, runs, 0, &vfork_rate) == -1 ||
+        bench_command_rate(external, count, runs, 1, &fork_rate) == -1 ||
+        bench_command_rate("true\n", count, runs, 0, &builtin_rate) == -1) {
+        return 1;
+    }
+    fprintf(stderr, "bench: prompt-to-exec latency\n");
+    if (bench_prompt_to_exec(&prompt_latency) == -1) {
+        return 1;
+    }
+    fprintf(stderr, "bench: reap latency\n");
+    if (bench_reap(&reap_latency) == -1) {
+        return 1;
+    }
+    fprintf(stderr, "bench: parse throughput\n");
+    if (bench_parse(runs, &parse_lines, &parse_megabytes) == -1) {
+        return 1;
+    }
+
+    FILE *out = stdout;
+    if (output_path != NULL && (out = fopen(output_path, "w")) == NULL) {
+        perror(output_path);
+        return 1;
+    }
+    fprintf(out, "{\n  \"shell\": \"%s\",\n  \"commands\": %d,\n"
+            "  \"runs\": %d,\n  \"latency_samples\": %d,\n",
+            shell_path, count, runs, LATENCY_SAMPLES);
+    fprintf(out, "  \"commands_per_second\": {\n");
+    print_summary(out, "vfork", &vfork_rate, 0);
+    print_summary(out, "fork", &fork_rate, 0);
+    print_summary(out, "builtin", &builtin_rate, 1);
+    fprintf(out, "  },\n  \"latency_us\": {\n");
+    print_summary(out, "prompt_to_exec", &prompt_latency, 0);
+    print_summary(out, "reap", &reap_latency, 1);
+    fprintf(out, "  },\n  \"parse\": {\n");
+    print_summary(out, "lines_per_second", &parse_lines, 0);
+    print_summary(out, "megabytes_per_second", &parse_megabytes, 1);
+    fprintf(out, "  }\n}\n");
+    if (out != stdout) {
+        fclose(out);
+        fprintf(stderr, "bench: results written to %s\n", output_path);
+    }
+    return 0;
+}
@@ -0,0 +1,329 @@
+/**
+ * parse.c - Parser microbenchmark for smallsh
+ *
+ * Links the parser itself and measures, in process:
+ * - tokenizer throughput: megabytes per second of the vector tokenizer
+ *   and of the byte-at-a-time one, on lines of 10 to 10000 words
+ * - parse throughput: lines per second of parse_input() on the same
+ *   lines, from an in-memory reader
+ *
+ * Before timing anything, both tokenizers split a corpus of random lines
+ * built from blanks, words, '$', '(' and ')', and must return the same
+ * words at the same places and agree on unterminated substitutions. The
+ * parser only sees those words, so the command lines it builds cannot
+ * differ either. A mismatch prints the line and fails.
+ *
+ * Usage: parse [-r runs] [-o file]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "arena.h"
+#include "parser.h"
+#include "reader.h"
+#include "tokenizer.h"
+
+#define DEFAULT_RUNS 5
+#define CHECK_LINES 200000
+#define CHECK_LENGTH 300
+#define BENCH_BYTES (64 * 1024 * 1024)
+
+static const int word_counts[] = {10, 100, 1000, 10000};
+
+/**
+ * Returns the CLOCK_MONOTONIC time.
+ *
+ * @return: The time in nanoseconds
+ */
+static long long now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+/**
+ * Orders doubles for qsort().
+ */
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * Returns the median of samples, sorting them in place.
+ */
+static double median(double *values, int count) {
+    qsort(values, count, sizeof(double), compare_doubles);
+    return values[(count - 1) / 2];
+}
+
+/**
+ * Splits a line with both tokenizers and compares the results.
+ *
+ * @param line: The line
+ * @param length: The length of the line
+ * @return: 0 if they agree, -1 otherwise
+ */
+static int check_line(const char *line, size_t length) {
+    // Exact-size copies, so that reading past the NUL shows up in valgrind
+    char *scalar_line = malloc(length + 1);
+    char *vector_line = malloc(length + 1);
+    struct tokenizer scalar;
+    struct tokenizer vector;
+    int result = 0;
+
+    if (scalar_line == NULL || vector_line == NULL) {
+        perror("malloc() failed");
+        exit(1);
+    }
+    memcpy(scalar_line, line, length + 1);
+    memcpy(vector_line, line, length + 1);
+    tokenizer_init(&scalar, scalar_line, length);
+    tokenizer_init(&vector, vector_line, length);
+
+    for (;;) {
+        char *expected = tokenizer_next_scalar(&scalar);
+        char *actual = tokenizer_next(&vector);
+        if ((expected == NULL) != (actual == NULL) ||
+            (expected != NULL &&
+             (expected - scalar_line != actual - vector_line ||
+              strcmp(expected, actual) != 0)) ||
+            scalar.cursor - scalar_line != vector.cursor - vector_line ||
+            scalar.unterminated != vector.unterminated) {
+            result = -1;
+            break;
+        }
+        if (expected == NULL) {
+            break;
+        }
+    }
+    free(scalar_line);
+    free(vector_line);
+    return result;
+}
+
+/**
+ * Compares the tokenizers on random lines and on a few edge cases.
+ *
+ * @return: The number of lines checked, or -1 on a mismatch
+ */
+static int check_tokenizers(void) {
+    static const char alphabet[] = "   \n\nab$$(()|<>&;#";
+    static const char *cases[] = {
+        "", " ", "\n", "$", "$(", "$()", "a$(b c", "$(a $(b) c) d",
+        "echo $(ls $(pwd) | wc -l) files", "a\nb\n", "$$ $? ${HOME}",
+    };
+    char line[CHECK_LENGTH + 1];
+
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        if (check_line(cases[i], strlen(cases[i])) == -1) {
+            fprintf(stderr, "parse: tokenizers differ on \"%s\"\n", cases[i]);
+            return -1;
+        }
+    }
+    srand(1);
+    for (int i = 0; i < CHECK_LINES; i++) {
+        size_t length = rand() % (CHECK_LENGTH + 1);
+        for (size_t j = 0; j < length; j++) {
+            // Mostly letters, so that words of every length occur
+            int pick = rand() % 4 == 0 ? (int)(rand() % (sizeof(alphabet) - 1)) : -1;
+            line[j] = pick == -1 ? 'a' + rand() % 26 : alphabet[pick];
+        }
+        line[length] = '\0';
+        if (check_line(line, length) == -1) {
+            fprintf(stderr, "parse: tokenizers differ on \"%s\"\n", line);
+            return -1;
+        }
+    }
+    return CHECK_LINES + sizeof(cases) / sizeof(cases[0]);
+}
+
+/**
+ * Builds a command line of many words, as generated scripts produce.
+ *
+ * @param words: The number of words
+ * @param length: Receives the length of the line
+ * @return: The line, with a trailing newline
+ */
+static char *build_line(int words, size_t *length) {
+    size_t capacity = words * 24 + 64;
+    char *line = malloc(capacity);
+    size_t used = 0;
+
+    if (line == NULL) {
+        perror("malloc() failed");
+        exit(1);
+    }
+    used += snprintf(line, capacity, "process");
+    for (int i = 1; i < words; i++) {
+        switch (i % 4) {
+            case 0:
+                used += snprintf(line + used, capacity - used, " --option%d=value", i);
+                break;
+            case 1:
+                used += snprintf(line + used, capacity - used, " data/file%05d.txt", i);
+                break;
+            case 2:
+                used += snprintf(line + used, capacity - used, " $HOME/x%d", i);
+                break;
+            default:
+                used += snprintf(line + used, capacity - used, " %d", i);
+                break;
+        }
+    }
+    used += snprintf(line + used, capacity - used, "\n");
+    *length = used;
+    return line;
+}
+
+/**
+ * Measures the tokenizers on one line.
+ *
+ * @param line: The line
+ * @param length: The length of the line
+ * @param runs: The number of runs
+ * @param vector: A flag to time tokenizer_next() rather than the scalar one
+ * @return: The median megabytes per second
+ */
+static double bench_tokenizer(const char *line, size_t length, int runs, int vector) {
+    char *copy = malloc(length + 1);
+    int repeat = BENCH_BYTES / length + 1;
+    double rates[runs];
+    volatile size_t words = 0;
+
+    if (copy == NULL) {
+        perror("malloc() failed");
+        exit(1);
+    }
+    for (int run = 0; run < runs; run++) {
+        long long start = now_ns();
+        for (int i = 0; i < repeat; i++) {
+            struct tokenizer tokens;
+            memcpy(copy, line, length + 1);
+            tokenizer_init(&tokens, copy, length);
+            while ((vector ? tokenizer_next(&tokens) :
+                    tokenizer_next_scalar(&tokens)) != NULL) {
+                words++;
+            }
+        }
+        rates[run] = (double)length * repeat / ((now_ns() - start) / 1e9) / 1e6;
+    }
+    free(copy);
+    return median(rates, runs);
+}
+
+/**
+ * Measures parse_input() on one line repeated as a script.
+ *
+ * @param line: The line, with its newline
+ * @param length: The length of the line
+ * @param runs: The number of runs
+ * @return: The median lines per second, or -1 if a line did not parse
+ */
+static double bench_parser(const char *line, size_t length, int runs) {
+    int repeat = BENCH_BYTES / 4 / length + 1;
+    char *script = malloc(length * repeat + 1);
+    double rates[runs];
+    struct arena arena;
+
+    if (script == NULL) {
+        perror("malloc() failed");
+        exit(1);
+    }
+    for (int i = 0; i < repeat; i++) {
+        memcpy(script + i * length, line, length);
+    }
+    script[length * repeat] = '\0';
+    arena_init(&arena);
+
+    for (int run = 0; run < runs; run++) {
+        struct reader in;
+        reader_open_string(&in, script);
+        long long start = now_ns();
+        for (int i = 0; i < repeat; i++) {
+            if (parse_input(&in, &arena) == NULL) {
+                free(script);
+                arena_free(&arena);
+                return -1;
+            }
+            arena_reset(&arena);
+        }
+        rates[run] = repeat / ((now_ns() - start) / 1e9);
+        reader_close(&in);
+    }
+    free(script);
+    arena_free(&arena);
+    return median(rates, runs);
+}
+
+int main(int argc, char *argv[]) {
+    int runs = DEFAULT_RUNS;
+    const char *output_path = NULL;
+    int option;
+
+    while ((option = getopt(argc, argv, "r:o:")) != -1) {
+        switch (option) {
+            case 'r':
+                runs = atoi(optarg);
+                break;
+            case 'o':
+                output_path = optarg;
+                break;
+            default:
+                fprintf(stderr, "usage: parse [-r runs] [-o file]\n");
+                return 2;
+        }
+    }
+    if (runs < 1) {
+        fprintf(stderr, "parse: runs must be positive\n");
+        return 2;
+    }
+
+    fprintf(stderr, "parse: comparing the tokenizers\n");
+    int checked = check_tokenizers();
+    if (checked == -1) {
+        return 1;
+    }
+
+    FILE *out = stdout;
+    if (output_path != NULL && (out = fopen(output_path, "w")) == NULL) {
+        perror(output_path);
+        return 1;
+    }
+    fprintf(out, "{\n  \"runs\": %d,\n  \"lines_checked\": %d,\n", runs, checked);
+    fprintf(out, "  \"tokenizer_megabytes_per_second\": {\n");
+    int shapes = sizeof(word_counts) / sizeof(word_counts[0]);
+    for (int i = 0; i < shapes; i++) {
+        size_t length;
+        char *line = build_line(word_counts[i], &length);
+        fprintf(stderr, "parse: tokenizing %d words\n", word_counts[i]);
+        fprintf(out, "    \"words_%d\": {\"scalar\": %.1f, \"vector\": %.1f}%s\n",
+                word_counts[i], bench_tokenizer(line, length, runs, 0),
+                bench_tokenizer(line, length, runs, 1), i + 1 < shapes ? "," : "");
+        free(line);
+    }
+    fprintf(out, "  },\n  \"parse_lines_per_second\": {\n");
+    for (int i = 0; i < shapes; i++) {
+        size_t length;
+        char *line = build_line(word_counts[i], &length);
+        fprintf(stderr, "parse: parsing %d words\n", word_counts[i]);
+        double rate = bench_parser(line, length, runs);
+        free(line);
+        if (rate < 0) {
+            fprintf(stderr, "parse: a line did not parse\n");
+            return 1;
+        }
+        fprintf(out, "    \"words_%d\": %.1f%s\n", word_counts[i], rate,
+                i + 1 < shapes ? "," : "");
+    }
+    fprintf(out, "  }\n}\n");
+    if (out != stdout) {
+        fclose(out);
+        fprintf(stderr, "parse: results written to %s\n", output_path);
+    }
+    return 0;
+}
@@ -0,0 +1,271 @@
+/**
+ * builtins.c - Builtin command registry
+ *
+ * Builtins are found by a binary search over a table sorted by name, so
+ * deciding whether a command is a builtin costs a handful of string
+ * comparisons whatever the number of builtins. Every builtin takes the
+ * parsed command and the shell context and returns its exit status.
+ *
+ * Builtins that run in the shell process honor < and > by redirecting
+ * the shell's own standard descriptors and restoring them afterwards.
+ * In a pipeline or in the background, start_process() runs them in a
+ * forked child instead.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "builtins.h"
+#include "commands.h"
+#include "common.h"
+#include "history.h"
+#include "io.h"
+#include "parallel.h"
+#include "path_cache.h"
+#include "pipeline.h"
+#include "telemetry.h"
+#include "usage.h"
+
+/**
+ * Implements the exit builtin.
+ *
+ * @param command: The parsed command
+ * @param context: The shell context
+ * @return: 0
+ */
+static int exit_builtin(struct command_line *command, struct shell_context *context) {
+    (void)command;
+    context->exit_requested = true;
+    return 0;
+}
+
+/**
+ * Implements the cd builtin.
+ *
+ * @param command: The parsed command
+ * @param context: The shell context
+ * @return: 0 on success, 1 on failure
+ */
+static int cd_builtin(struct command_line *command, struct shell_context *context) {
+    (void)context;
+    return change_directory(command->argc, command->argv) == 0 ? 0 : 1;
+}
+
+/**
+ * Implements the status builtin; -r adds the resource usage of the last
+ * foreground command.
+ *
+ * @param command: The parsed command
+ * @param context: The shell context
+ * @return: 0 on success, 1 if no usage was recorded
+ */
+static int status_builtin(struct command_line *command, struct shell_context *context) {
+    print_status(*context->exit_status, *context->was_terminated,
+                 *context->signal_number);
+    if (command->argc > 1 && strcmp(command->argv[1], "-r") == 0) {
+        if (!usage_last()->finished) {
+            fprintf(stderr, "status: no resource usage recorded\n");
+            fflush(stderr);
+            return 1;
+        }
+        usage_print(usage_last());
+    }
+    return 0;
+}
+
+/**
+ * Implements the hash builtin.
+ *
+ * @param command: The parsed command
+ * @param context: The shell context
+ * @return: 0 on success, 1 on failure
+ */
+static int hash_builtin(struct command_line *command, struct shell_context *context) {
+    (void)context;
+    return hash_command(command->argc, command->argv);
+}
+
+/**
+ * Implements the history builtin.
+ *
+ * @param command: The parsed command
+ * @param context: The shell context
+ * @return: 0 on success, 1 on failure
+ */
+static int history_builtin(struct command_line *command, struct shell_context *context) {
+    (void)context;
+    return history_command(command->argc, command->argv);
+}
+
+/**
+ * Implements the stats builtin.
+ *
+ * @param command: The parsed command
+ * @param context: The shell context
+ * @return: 0 on success, 1 on failure
+ */
+static int stats_builtin(struct command_line *command, struct shell_context *context) {
+    (void)context;
+    return telemetry_command(command->argc, command->argv);
+}
+
+/**
+ * Implements the jobs builtin.
+ *
+ * @param command: The parsed command
+ * @param context: The shell context
+ * @return: 0
+ */
+static int jobs_builtin(struct command_line *command, struct shell_context *context) {
+    return jobs_command(context->jobs, command->argc, command->argv);
+}
+
+/**
+ * Implements the fg builtin.
+ *
+ * @param command: The parsed command
+ * @param context: The shell context
+ * @return: 0 on success, 1 on failure
+ */
+static int fg_builtin(struct command_line *command, struct shell_context *context) {
+    return fg_command(context->jobs, command->argc, command->argv,
+                      context->exit_status, context->was_terminated,
+                      context->signal_number);
+}
+
+/**
+ * Implements the bg builtin.
+ *
+ * @param command: The parsed command
+ * @param context: The shell context
+ * @return: 0 on success, 1 on failure
+ */
+static int bg_builtin(struct command_line *command, struct shell_context *context) {
+    return bg_command(context->jobs, command->argc, command->argv);
+}
+
+/**
+ * Implements the wait builtin.
+ *
+ * @param command: The parsed command
+ * @param context: The shell context
+ * @return: 0 on success, 1 on failure
+ */
+static int wait_builtin(struct command_line *command, struct shell_context *context) {
+    return wait_command(context->jobs, command->argc, command->argv,
+                        context->exit_status, context->was_terminated,
+                        context->signal_number);
+}
+
+/**
+ * Implements the parallel builtin.
+ *
+ * @param command: The parsed command
+ * @param context: The shell context
+ * @return: 0 on success, 1 on failure
+ */
+static int parallel_builtin(struct command_line *command, struct shell_context *context) {
+    return parallel_command(command, context->jobs, context->exit_status,
+                            context->was_terminated, context->signal_number);
+}
+
+/**
+ * Implements the relay builtin, which copies standard input to standard
+ * output inside a pipeline.
+ *
+ * @param command: The parsed command
+ * @param context: The shell context
+ * @return: 0 on success, 1 on failure
+ */
+static int relay_builtin(struct command_line *command, struct shell_context *context) {
+    (void)command;
+    (void)context;
+    closefrom(STDERR_FILENO + 1);
+    return relay_data(STDIN_FILENO, STDOUT_FILENO) == 0 ?
+        EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/* The registry, kept in strcmp() order for bsearch() */
+static const struct builtin builtins[] = {
+    {BRACKET_CMD, test_builtin, BUILTIN_UTILITY},
+    {BG_CMD, bg_builtin, BUILTIN_SHELL},
+    {CD_CMD, cd_builtin, BUILTIN_SHELL},
+    {ECHO_CMD, echo_builtin, BUILTIN_UTILITY},
+    {EXIT_CMD, exit_builtin, BUILTIN_SHELL},
+    {FALSE_CMD, false_builtin, BUILTIN_UTILITY},
+    {FG_CMD, fg_builtin, BUILTIN_SHELL},
+    {HASH_CMD, hash_builtin, BUILTIN_SHELL},
+    {HISTORY_CMD, history_builtin, BUILTIN_UTILITY},
+    {JOBS_CMD, jobs_builtin, BUILTIN_SHELL},
+    {PARALLEL_CMD, parallel_builtin, BUILTIN_SHELL},
+    {PRINTF_CMD, printf_builtin, BUILTIN_UTILITY},
+    {PWD_CMD, pwd_builtin, BUILTIN_UTILITY},
+    {RELAY_CMD, relay_builtin, BUILTIN_CHILD},
+    {STATS_CMD, stats_builtin, BUILTIN_SHELL},
+    {STATUS_CMD, status_builtin, BUILTIN_SHELL},
+    {TEST_CMD, test_builtin, BUILTIN_UTILITY},
+    {TRUE_CMD, true_builtin, BUILTIN_UTILITY},
+    {WAIT_CMD, wait_builtin, BUILTIN_SHELL},
+};
+
+/**
+ * Compares a name with a registry entry for bsearch().
+ */
+static int compare_builtin(const void *name, const void *entry) {
+    return strcmp(name, ((const struct builtin *)entry)->name);
+}
+
+/**
+ * Finds a builtin by name.
+ *
+ * @param name: The command name
+ * @return: The registry entry, or NULL if the command is not a builtin
+ */
+const struct builtin *builtin_lookup(const char *name) {
+    return bsearch(name, builtins, sizeof(builtins) / sizeof(builtins[0]),
+                   sizeof(builtins[0]), compare_builtin);
+}
+
+/**
+ * Returns the name of a builtin by its position in the registry, e.g.
+ * for completion.
+ *
+ * @param index: The position, from 0
+ * @return: The name, or NULL past the last builtin
+ */
+const char *builtin_name(size_t index) {
+    return index < sizeof(builtins) / sizeof(builtins[0]) ?
+        builtins[index].name : NULL;
+}
+
+/**
+ * Runs a builtin in the shell process with its redirections applied.
+ * Utilities also become the status of the last foreground command.
+ *
+ * @param builtin: The registry entry
+ * @param command: The parsed command
+ * @param context: The shell context
+ * @return: The exit status of the builtin
+ */
+int run_builtin(
+    const struct builtin *builtin,
+    struct command_line *command,
+    struct shell_context *context
+) {
+    int saved[2];
+    int result;
+
+    if (redirect_saved(command, context->exit_status, saved) == -1) {
+        result = EXIT_FAILURE;
+    } else {
+        result = builtin->run(command, context);
+        restore_redirect(saved);
+    }
+
+    if (builtin->flags & BUILTIN_UTILITY) {
+        *context->exit_status = result;
+        *context->was_terminated = false;
+    }
+    return result;
+}
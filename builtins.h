@@ -0,0 +1,54 @@
+/**
+ * builtins.h - Builtin command registry
+ */
+
+#ifndef BUILTINS_H
+#define BUILTINS_H
+
+#include <stdbool.h>
+#include "parser.h"
+#include "jobs.h"
+
+/* Builtin flags */
+#define BUILTIN_SHELL 0x1       // Changes shell state: runs in the shell, ignores &
+#define BUILTIN_UTILITY 0x2     // Sets the status; forked in the background
+#define BUILTIN_CHILD 0x4       // Only runs in a forked child
+
+/**
+ * Shell state handed to every builtin
+ */
+struct shell_context {
+    int *exit_status;           // Status of the last foreground command
+    bool *was_terminated;
+    int *signal_number;
+    struct job_table *jobs;
+    bool exit_requested;        // Set by the exit builtin
+};
+
+/**
+ * Entry of the builtin registry
+ */
+struct builtin {
+    const char *name;
+    int (*run)(struct command_line *command, struct shell_context *context);
+    int flags;
+};
+
+/* Function declarations */
+const struct builtin *builtin_lookup(const char *name);
+const char *builtin_name(size_t index);
+int run_builtin(
+    const struct builtin *builtin,
+    struct command_line *command,
+    struct shell_context *context
+);
+
+/* Fork-free utilities, see utilities.c */
+int echo_builtin(struct command_line *command, struct shell_context *context);
+int true_builtin(struct command_line *command, struct shell_context *context);
+int false_builtin(struct command_line *command, struct shell_context *context);
+int pwd_builtin(struct command_line *command, struct shell_context *context);
+int test_builtin(struct command_line *command, struct shell_context *context);
+int printf_builtin(struct command_line *command, struct shell_context *context);
+
+#endif /* BUILTINS_H */
@@ -2,6 +2,7 @@
  * commands.c - Implementation of command execution functions
  */
 
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -11,6 +12,17 @@
 #include "common.h"
 #include "io.h"
 #include "signals.h"
+#include "spawn.h"
+#include "path_cache.h"
+#include "pipeline.h"
+#include "usage.h"
+#include "builtins.h"
+#include "expand.h"
+#include "affinity.h"
+#include "zygote.h"
+#include "telemetry.h"
+
+extern char **environ;
 
 /**
  * Changes the current working directory to the specified path.
@@ -92,7 +104,137 @@ void print_status(int exit_status, bool terminated, int signal_number) {
 }
 
 /**
- * Executes a parsed command.
+ * Sets up and execs a forked child process. Never returns.
+ *
+ * @param command: A pointer to the parsed command line structure.
+ * @param exec_path: The resolved path of the executable or NULL.
+ * @param builtin: The builtin to run instead of an executable, or NULL.
+ * @param io: The pipe ends and process group for the child.
+ * @param context: The shell context, copied into the child.
+ */
+static void run_child(
+    struct command_line *command,
+    const char *exec_path,
+    const struct builtin *builtin,
+    const struct spawn_io *io,
+    struct shell_context *context
+) {
+    // Set up signal handler for child process
+    setup_signal_handlers(false, command->is_bg, NULL);
+
+    // Join the job's process group
+    if (io->pgid != -1) {
+        setpgid(0, io->pgid);
+    }
+
+    // Connect pipeline stages
+    if ((io->in_fd != -1 && dup2(io->in_fd, STDIN_FILENO) == -1) ||
+        (io->out_fd != -1 && dup2(io->out_fd, STDOUT_FILENO) == -1)) {
+        perror("pipe dup2()");
+        exit(EXIT_FAILURE);
+    }
+
+    // Redirect input and output if specified
+    if (redirect(
+            command,
+            context->exit_status,
+            command->is_bg && io->in_fd == -1,
+            command->is_bg && io->out_fd == -1
+        ) != 0) {
+        exit(EXIT_FAILURE);
+    }
+
+    // Apply the cpus, nice and sched prefixes
+    if (affinity_apply(command) == -1) {
+        perror("Setting CPU affinity or scheduling failed");
+        exit(EXIT_FAILURE);
+    }
+
+    // Builtins run in this process instead
+    if (builtin != NULL) {
+        exit(builtin->run(command, context));
+    }
+
+    // Execute the command, falling back to a full PATH search
+    if (exec_path != NULL) {
+        execve(exec_path, command->argv, environ);
+    }
+    execvp(command->argv[0], command->argv);
+    // If execvp fails, print error message and exit
+    perror("execvp() failed");
+    exit(EXIT_FAILURE);
+}
+
+/**
+ * Starts a child process for a single command, using the vfork() fast
+ * path when possible and fork() otherwise. Builtins always get a fork()
+ * and run in the child.
+ *
+ * @param command: A pointer to the parsed command line structure.
+ * @param io: The pipe ends and process group for the child.
+ * @param context: The shell context, for redirect() and builtins.
+ *
+ * @return: The pid of the child, or -1 if it could not be created.
+ */
+pid_t start_process(
+    struct command_line *command,
+    const struct spawn_io *io,
+    struct shell_context *context
+) {
+    pid_t child_pid;
+    const char *exec_path = NULL;
+    bool exec_failed;
+    const struct builtin *builtin = builtin_lookup(command->argv[0]);
+    uint64_t spawn_start = telemetry_now();
+
+    // Spread background processes over the CPUs if asked to
+    if (command->is_bg) {
+        affinity_auto(command);
+    }
+
+    if (builtin == NULL) {
+        // Resolve the command through the PATH cache
+        exec_path = path_cache_lookup(command->argv[0]);
+
+        // Try the spawn helper and the vfork() fast path, fall back to fork()
+        child_pid = zygote_spawn(command, exec_path, io, &exec_failed);
+        if (child_pid == -1 && errno == 0) {
+            child_pid = spawn_command(command, exec_path, io, &exec_failed);
+        }
+        if (child_pid != -1) {
+            // Both return once the child has exec'd
+            telemetry_spawned(telemetry_now() - spawn_start, true);
+            return child_pid;
+        }
+        if (exec_failed && errno == ENOENT) {
+            // The cached location is stale, search PATH again
+            path_cache_forget(command->argv[0]);
+            exec_path = path_cache_lookup(command->argv[0]);
+        }
+    }
+
+    child_pid = fork();
+    switch (child_pid) {
+        case -1:
+            perror("fork() failed");
+            break;
+        case 0:
+            // Child process
+            run_child(command, exec_path, builtin, io, context);
+            break;
+        default:
+            // Parent process: also set the group to avoid racing the child
+            if (io->pgid != -1) {
+                setpgid(child_pid, io->pgid == 0 ? child_pid : io->pgid);
+            }
+            telemetry_spawned(telemetry_now() - spawn_start, false);
+            break;
+    }
+    return child_pid;
+}
+
+/**
+ * Executes one pipeline of a parsed command line.
  *
  * @param command: A pointer to the parsed command line structure or NULL.
  * @param exit_status: A pointer to an integer to store the
@@ -101,18 +243,20 @@ void print_status(int exit_status, bool terminated, int signal_number) {
  *     if the last foreground process was terminated by a signal.
  * @param signal_number: A pointer to an integer to store the
  *     signal number that terminated the command.
- * @param bg_processes_list: A pointer to a pointer to the head of the
- *     background process list.
+ * @param jobs: A pointer to the background job table.
+ * @param builtin_status: A pointer to an integer to store the result
+ *     of a builtin run in the shell, left alone for other commands.
  *
  * @return 0 to continue running, 1 to exit normally
  */
-int execute_command(
+static int execute_list_item(
     struct command_line *command,
     int *exit_status,
     bool *was_terminated,
     int *signal_number,
-    struct bg_process_node **bg_processes_list,
-    bool foreground_only
+    struct job_table *jobs,
+    bool foreground_only,
+    int *builtin_status
 ) {
     int child_status;
     pid_t child_pid = -5;
@@ -126,78 +270,171 @@ int execute_command(
         return 0; // Continue running the shell
     }
 
-    // Check for 'exit' command
-    if (strcmp(command->argv[0], EXIT_CMD) == 0) {
-        return 1; // Exit the shell
+    // If foreground-only mode is enabled, ignore background processes
+    if (foreground_only) {
+        command->is_bg = false;
     }
 
-    // Check for 'cd' command
-    if (strcmp(command->argv[0], CD_CMD) == 0) {
-        change_directory(command->argc, command->argv);
+    // Expand the words now that earlier commands have run
+    struct shell_context context = {
+        exit_status, was_terminated, signal_number, jobs, false
+    };
+    if (expand_command(command, &context) == -1) {
+        *exit_status = EXIT_FAILURE;
+        *was_terminated = false;
         return 0; // Continue running the shell
     }
+    for (struct command_line *stage = command; stage != NULL;
+         stage = stage->pipe_next) {
+        if (stage->argc == 0) {
+            if (command->pipe_next != NULL) {
+                fprintf(stderr, "empty command in pipeline after expansion\n");
+                fflush(stderr);
+                *exit_status = EXIT_FAILURE;
+                *was_terminated = false;
+            }
+            return 0; // Continue running the shell
+        }
+    }
+    const struct builtin *builtin = builtin_lookup(command->argv[0]);
+    telemetry_begin(command);
 
-    // Check for 'status' command
-    if (strcmp(command->argv[0], STATUS_CMD) == 0) {
-        print_status(*exit_status, *was_terminated, *signal_number);
+    // Pipelines and child-only builtins have their own executor
+    if (command->pipe_next != NULL ||
+        (builtin != NULL && (builtin->flags & BUILTIN_CHILD))) {
+        execute_pipeline(
+            command,
+            exit_status,
+            was_terminated,
+            signal_number,
+            jobs
+        );
         return 0; // Continue running the shell
     }
 
-    // If foreground-only mode is enabled, ignore background processes
-    if (foreground_only) {
-        command->is_bg = false;
+    // Builtins run in the shell unless a utility goes to the background
+    if (builtin != NULL &&
+        ((builtin->flags & BUILTIN_SHELL) || !command->is_bg)) {
+        struct command_usage usage;
+        usage_start(&usage);
+        uint64_t builtin_start = telemetry_now();
+        *builtin_status = run_builtin(builtin, command, &context);
+        telemetry_waited(telemetry_now() - builtin_start,
+                         *was_terminated ? 128 + *signal_number : *exit_status);
+        if (builtin->flags & BUILTIN_UTILITY) {
+            usage_finish(&usage);
+            usage_record(&usage);
+            if (command->is_timed) {
+                usage_print(&usage);
+            }
+        }
+        return context.exit_requested ? 1 : 0;
     }
 
-    // Other commands
-    child_pid = fork();
-    switch (child_pid) {
-        case -1:
-            perror("fork() failed");
-            break;
-        case 0:
-            // Child process
+    // Other commands: background jobs get their own process group
+    struct spawn_io io = {-1, -1, command->is_bg ? 0 : -1};
+    struct command_usage usage;
+    usage_start(&usage);
+    child_pid = start_process(command, &io, &context);
+    if (child_pid == -1) {
+        telemetry_abort();
+        return 0; // Continue running the shell
+    }
 
-            // Set up signal handler for child process
-            setup_signal_handlers(false, command->is_bg, NULL);
+    // Wait for child process to finish if it's a foreground process
+    if (!command->is_bg) {
+        struct rusage rusage;
+        uint64_t wait_start = telemetry_now();
+        child_pid = wait4(child_pid, &child_status, 0, &rusage);
+        uint64_t wait_ns = telemetry_now() - wait_start;
+        usage_add(&usage, &rusage);
+        usage_finish(&usage);
+        usage_record(&usage);
+        if (command->is_timed) {
+            usage_print(&usage);
+        }
+        update_status(
+            child_status,
+            exit_status,
+            was_terminated,
+            signal_number
+        );
+        telemetry_waited(wait_ns,
+                         *was_terminated ? 128 + *signal_number : *exit_status);
 
-            // Redirect input and output if specified
-            if (redirect(command, exit_status, command->is_bg) != 0) {
-                exit(EXIT_FAILURE);
-            }
-            // Execute the command
-            execvp(command->argv[0], command->argv);
-            // If execvp fails, print error message and exit
-            perror("execvp() failed");
-            exit(EXIT_FAILURE);
-            break;
-        default:
-            // Parent process
-            // Wait for child process to finish if it's a foreground process
-            if (!command->is_bg) {
-                child_pid = waitpid(child_pid, &child_status, 0);
-                update_status(
-                    child_status,
-                    exit_status,
-                    was_terminated,
-                    signal_number
-                );
-
-                // Check if the child process was terminated by a signal
-                if (*was_terminated) {
-                    printf("terminated by signal %d\n", *signal_number);
-                    fflush(stdout);
-                }
-            } else {
-                // Background process
-                printf("background pid is %d\n", child_pid);
-                fflush(stdout);
-                // Add the background process to the list
-                if (add_bg_process(bg_processes_list, child_pid) == -1) {
-                    fprintf(stderr, "Failed to add background process\n");
-                    fflush(stderr);
-                }
-            }
-            break;
+        // Check if the child process was terminated by a signal
+        if (*was_terminated) {
+            printf("terminated by signal %d\n", *signal_number);
+            fflush(stdout);
+        }
+    } else {
+        // Background process
+        printf("background pid is %d\n", child_pid);
+        fflush(stdout);
+        // Add the background process to the job table
+        char command_text[JOB_TEXT_LENGTH];
+        format_command(command, command_text, sizeof(command_text));
+        struct job *job = jobs_add(jobs, child_pid, &child_pid, 1,
+                                   command_text);
+        uint64_t telemetry_seq = telemetry_background();
+        if (job == NULL) {
+            fprintf(stderr, "Failed to add background process\n");
+            fflush(stderr);
+        } else {
+            job->is_timed = command->is_timed;
+            job->telemetry_seq = telemetry_seq;
+        }
+    }
+    return 0; // Continue running the shell
+}
+
+/**
+ * Executes a parsed command line, running its pipelines in order. A
+ * pipeline after && runs only if the last one run succeeded, one after
+ * || only if it did not, so skipped pipelines keep the result for the
+ * operators that follow. Builtins that leave the status alone, such as
+ * cd, still decide by their own result.
+ *
+ * @param command: A pointer to the parsed command line structure or NULL.
+ * @param exit_status: A pointer to an integer to store the
+ *     exit status of the last foreground process.
+ * @param was_terminated: A pointer to a boolean flag to indicate
+ *     if the last foreground process was terminated by a signal.
+ * @param signal_number: A pointer to an integer to store the
+ *     signal number that terminated the command.
+ * @param jobs: A pointer to the background job table.
+ *
+ * @return 0 to continue running, 1 to exit normally
+ */
+int execute_command(
+    struct command_line *command,
+    int *exit_status,
+    bool *was_terminated,
+    int *signal_number,
+    struct job_table *jobs,
+    bool foreground_only
+) {
+    enum list_operator list_op = LIST_SEQUENCE;
+    bool succeeded = *exit_status == EXIT_SUCCESS && !*was_terminated;
+
+    for (; command != NULL; command = command->list_next) {
+        if ((list_op == LIST_AND && !succeeded) ||
+            (list_op == LIST_OR && succeeded)) {
+            list_op = command->list_op;
+            continue;
+        }
+        int builtin_status = -1;
+        if (execute_list_item(command, exit_status, was_terminated,
+                              signal_number, jobs, foreground_only,
+                              &builtin_status) != 0) {
+            return 1; // exit ends the rest of the line too
+        }
+        if (builtin_status != -1) {
+            succeeded = builtin_status == EXIT_SUCCESS;
+        } else {
+            succeeded = *exit_status == EXIT_SUCCESS && !*was_terminated;
+        }
+        list_op = command->list_op;
     }
     return 0; // Continue running the shell
 }
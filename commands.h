@@ -8,7 +8,9 @@
 #include <stdbool.h>
 #include <sys/types.h>
 #include "parser.h"
-#include "bg_process.h"
+#include "jobs.h"
+#include "spawn.h"
+#include "builtins.h"
 
 /* Function declarations */
 int execute_command(
@@ -16,10 +18,16 @@ int execute_command(
     int *exit_status,
     bool *was_terminated,
     int *signal_number,
-    struct bg_process_node **bg_processes_list,
+    struct job_table *jobs,
     bool foreground_only
 );
 
+pid_t start_process(
+    struct command_line *command,
+    const struct spawn_io *io,
+    struct shell_context *context
+);
+
 int change_directory(int argc, char **argv);
 
 void update_status(
@@ -8,11 +8,38 @@
 #include <stdbool.h>
 
 /* Constants */
-#define INPUT_LENGTH 2048
-#define MAX_ARGS 512
 #define COMMENT_FLAG '#'
 #define EXIT_CMD "exit"
 #define CD_CMD "cd"
 #define STATUS_CMD "status"
+#define STATS_CMD "stats"
+#define HASH_CMD "hash"
+#define HISTORY_CMD "history"
+#define RELAY_CMD "relay"
+#define JOBS_CMD "jobs"
+#define FG_CMD "fg"
+#define BG_CMD "bg"
+#define WAIT_CMD "wait"
+#define PARALLEL_CMD "parallel"
+#define PARALLEL_ITEMS ":::"
+#define TIME_CMD "time"
+#define CPUS_CMD "cpus"
+#define NICE_CMD "nice"
+#define NICE_DEFAULT 10
+#define SCHED_CMD "sched"
+#define ECHO_CMD "echo"
+#define TRUE_CMD "true"
+#define FALSE_CMD "false"
+#define PWD_CMD "pwd"
+#define TEST_CMD "test"
+#define BRACKET_CMD "["
+#define PRINTF_CMD "printf"
+#define PIPE_FLAG "|"
+#define SEQUENCE_FLAG ";"
+#define AND_FLAG "&&"
+#define OR_FLAG "||"
+#define BG_FLAG "&"
+#define SUBST_START "$("
+#define SYNTAX_ERROR_STATUS 2
 
 #endif /* COMMON_H */
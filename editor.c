@@ -0,0 +1,492 @@
+/**
+ * editor.c - Line editing and tab completion for terminals
+ *
+ * When the shell reads from a terminal, the line editor puts it in
+ * non-canonical mode for the duration of each line and handles the keys
+ * itself: the arrows, Home and End, Backspace and Delete, and the usual
+ * Ctrl-A, Ctrl-E, Ctrl-B, Ctrl-F, Ctrl-U, Ctrl-K and Ctrl-W. Signals keep
+ * working, so Ctrl-Z still toggles the foreground-only mode.
+ *
+ * Tab completes the word before the cursor. In command position the
+ * candidates are the builtins and the executables of the PATH index,
+ * anywhere else they are file names. A single candidate is inserted, and
+ * so is the prefix common to several; if there is none, they are listed.
+ */
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "editor.h"
+#include "builtins.h"
+#include "path_index.h"
+
+#define EDITOR_LIST_WIDTH 80
+#define KEY_DELETE 0x100        // ESC [ 3 ~, outside the byte range
+
+/**
+ * Line being edited, stored in the line of the reader
+ */
+struct edit_state {
+    struct reader *in;
+    size_t length;
+    size_t cursor;
+};
+
+/**
+ * Candidates for a completion, each a whole word
+ */
+struct candidate_list {
+    const char *prefix;     // The word being completed
+    size_t prefix_length;
+    char **names;
+    size_t count;
+    size_t capacity;
+};
+
+/**
+ * Makes room in the line for more bytes.
+ *
+ * @param state: The line being edited
+ * @param extra: The number of bytes to add
+ * @return: 0 on success, -1 on failure
+ */
+static int reserve(struct edit_state *state, size_t extra) {
+    struct reader *in = state->in;
+
+    if (state->length + extra + 1 <= in->line_capacity) {
+        return 0;
+    }
+    size_t capacity = in->line_capacity == 0 ? 256 : in->line_capacity;
+    while (state->length + extra + 1 > capacity) {
+        capacity *= 2;
+    }
+    char *line = realloc(in->line, capacity);
+    if (line == NULL) {
+        perror("Memory allocation for input line failed");
+        return -1;
+    }
+    in->line = line;
+    in->line_capacity = capacity;
+    return 0;
+}
+
+/**
+ * Inserts bytes at the cursor.
+ *
+ * @param state: The line being edited
+ * @param text: The bytes
+ * @param count: The number of bytes
+ */
+static void insert(struct edit_state *state, const char *text, size_t count) {
+    if (reserve(state, count) == -1) {
+        return;
+    }
+    char *line = state->in->line;
+    memmove(line + state->cursor + count, line + state->cursor,
+            state->length - state->cursor);
+    memcpy(line + state->cursor, text, count);
+    state->length += count;
+    state->cursor += count;
+}
+
+/**
+ * Removes bytes from the line.
+ *
+ * @param state: The line being edited
+ * @param start: The first byte to remove
+ * @param end: The byte after the last one to remove
+ */
+static void erase(struct edit_state *state, size_t start, size_t end) {
+    char *line = state->in->line;
+
+    memmove(line + start, line + end, state->length - end);
+    state->length -= end - start;
+    state->cursor = start;
+}
+
+/**
+ * Rewrites the line on the terminal and places the cursor.
+ *
+ * @param state: The line being edited
+ * @param shown_cursor: Where the cursor is on the terminal, from the
+ *     start of the line
+ */
+static void redraw(struct edit_state *state, size_t shown_cursor) {
+    if (shown_cursor > 0) {
+        printf("\033[%zuD", shown_cursor);
+    }
+    fwrite(state->in->line, 1, state->length, stdout);
+    printf("\033[K");
+    if (state->length > state->cursor) {
+        printf("\033[%zuD", state->length - state->cursor);
+    }
+    fflush(stdout);
+}
+
+/**
+ * Adds a candidate if it starts with the word being completed. Used as
+ * the visitor of path_index_complete().
+ *
+ * @param context: The struct candidate_list
+ * @param name: The candidate
+ */
+static void add_candidate(void *context, const char *name) {
+    struct candidate_list *list = context;
+
+    if (strncmp(name, list->prefix, list->prefix_length) != 0) {
+        return;
+    }
+    if (list->count == list->capacity) {
+        size_t capacity = list->capacity == 0 ? 32 : list->capacity * 2;
+        char **names = realloc(list->names, capacity * sizeof(char *));
+        if (names == NULL) {
+            return;
+        }
+        list->names = names;
+        list->capacity = capacity;
+    }
+    char *copy = strdup(name);
+    if (copy != NULL) {
+        list->names[list->count++] = copy;
+    }
+}
+
+/**
+ * Adds the executables of the PATH directories, for shells without a
+ * PATH index.
+ *
+ * @param list: The candidates
+ */
+static void scan_path(struct candidate_list *list) {
+    const char *path_var = getenv("PATH");
+    char dir[4096];
+
+    for (const char *p = path_var; p != NULL && *p != '\0'; ) {
+        const char *end = strchr(p, ':');
+        size_t length = end == NULL ? strlen(p) : (size_t)(end - p);
+        snprintf(dir, sizeof(dir), "%.*s", length == 0 ? 1 : (int)length,
+                 length == 0 ? "." : p);
+        p = end == NULL ? NULL : end + 1;
+
+        DIR *stream = opendir(dir);
+        struct dirent *entry;
+        struct stat info;
+        if (stream == NULL) {
+            continue;
+        }
+        while ((entry = readdir(stream)) != NULL) {
+            if (strncmp(entry->d_name, list->prefix, list->prefix_length) == 0 &&
+                fstatat(dirfd(stream), entry->d_name, &info, 0) == 0 &&
+                S_ISREG(info.st_mode) && (info.st_mode & 0111) != 0) {
+                add_candidate(list, entry->d_name);
+            }
+        }
+        closedir(stream);
+    }
+}
+
+/**
+ * Adds the files matching the word being completed; directories get a
+ * trailing slash.
+ *
+ * @param list: The candidates
+ */
+static void scan_files(struct candidate_list *list) {
+    const char *slash = memrchr(list->prefix, '/', list->prefix_length);
+    size_t dir_length = slash == NULL ? 0 : (size_t)(slash - list->prefix) + 1;
+    const char *base = list->prefix + dir_length;
+    size_t base_length = list->prefix_length - dir_length;
+    char dir[4096];
+    char name[4096];
+
+    snprintf(dir, sizeof(dir), "%.*s", dir_length == 0 ? 1 : (int)dir_length,
+             dir_length == 0 ? "." : list->prefix);
+    DIR *stream = opendir(dir);
+    struct dirent *entry;
+    if (stream == NULL) {
+        return;
+    }
+    while ((entry = readdir(stream)) != NULL) {
+        struct stat info;
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0 ||
+            (entry->d_name[0] == '.' && base[0] != '.') ||
+            strncmp(entry->d_name, base, base_length) != 0) {
+            continue;
+        }
+        bool is_dir = entry->d_type == DT_DIR ||
+            ((entry->d_type == DT_LNK || entry->d_type == DT_UNKNOWN) &&
+             fstatat(dirfd(stream), entry->d_name, &info, 0) == 0 &&
+             S_ISDIR(info.st_mode));
+        snprintf(name, sizeof(name), "%.*s%s%s", (int)dir_length, list->prefix,
+                 entry->d_name, is_dir ? "/" : "");
+        add_candidate(list, name);
+    }
+    closedir(stream);
+}
+
+/**
+ * Compares two candidates for qsort().
+ */
+static int compare_names(const void *a, const void *b) {
+    return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+/**
+ * Prints the candidates below the line, then the prompt and the line.
+ *
+ * @param state: The line being edited
+ * @param list: The candidates
+ */
+static void list_candidates(struct edit_state *state, struct candidate_list *list) {
+    size_t width = 0;
+    size_t column = 0;
+
+    for (size_t i = 0; i < list->count; i++) {
+        size_t length = strlen(list->names[i]);
+        width = length > width ? length : width;
+    }
+    width += 2;
+    printf("\n");
+    for (size_t i = 0; i < list->count; i++) {
+        if (column > 0 && column + width > EDITOR_LIST_WIDTH) {
+            printf("\n");
+            column = 0;
+        }
+        printf("%-*s", (int)width, list->names[i]);
+        column += width;
+    }
+    printf("\n%s", state->in->prompt != NULL ? state->in->prompt : "");
+    redraw(state, 0);
+}
+
+/**
+ * Completes the word before the cursor.
+ *
+ * @param state: The line being edited
+ */
+static void complete(struct edit_state *state) {
+    char *line = state->in->line;
+    struct candidate_list list = {0};
+    size_t start = state->cursor;
+
+    while (start > 0 && line[start - 1] != ' ') {
+        start--;
+    }
+    list.prefix = line + start;
+    list.prefix_length = state->cursor - start;
+
+    // The first word and the words after |, ; or & name commands
+    size_t before = start;
+    while (before > 0 && line[before - 1] == ' ') {
+        before--;
+    }
+    bool command_position = before == 0 || strchr("|;&", line[before - 1]) != NULL;
+
+    // The candidates are copied, so the line may change below
+    char saved = line[state->cursor];
+    line[state->cursor] = '\0';
+    if (command_position && memchr(list.prefix, '/', list.prefix_length) == NULL) {
+        const char *name;
+        for (size_t i = 0; (name = builtin_name(i)) != NULL; i++) {
+            add_candidate(&list, name);
+        }
+        if (path_index_complete(list.prefix, add_candidate, &list) == -1) {
+            scan_path(&list);
+        }
+    } else {
+        scan_files(&list);
+    }
+    line[state->cursor] = saved;
+
+    if (list.count > 0) {
+        // Builtins may also exist as executables
+        qsort(list.names, list.count, sizeof(char *), compare_names);
+        size_t unique = 1;
+        for (size_t i = 1; i < list.count; i++) {
+            if (strcmp(list.names[i], list.names[unique - 1]) != 0) {
+                list.names[unique++] = list.names[i];
+            } else {
+                free(list.names[i]);
+            }
+        }
+        list.count = unique;
+
+        // The sorted list shares its common prefix with its last name
+        const char *first = list.names[0];
+        const char *last = list.names[list.count - 1];
+        size_t common = 0;
+        while (first[common] != '\0' && first[common] == last[common]) {
+            common++;
+        }
+
+        size_t shown = state->cursor;
+        if (common > list.prefix_length) {
+            insert(state, first + list.prefix_length, common - list.prefix_length);
+            if (list.count == 1 && first[common - 1] != '/') {
+                insert(state, " ", 1);
+            }
+            redraw(state, shown);
+        } else if (list.count > 1) {
+            list_candidates(state, &list);
+        }
+    }
+
+    for (size_t i = 0; i < list.count; i++) {
+        free(list.names[i]);
+    }
+    free(list.names);
+}
+
+/**
+ * Reads a line from a terminal with line editing. Used as the reader's
+ * edit hook.
+ *
+ * @param in: The reader of the terminal
+ * @param line_length: If not NULL, receives the length of the line
+ * @return: The NUL-terminated line, valid until the next call, or NULL
+ *     at EOF
+ */
+char *editor_read_line(struct reader *in, size_t *line_length) {
+    struct edit_state state = {in, 0, 0};
+    struct termios saved;
+    struct termios raw;
+    int escape = 0;         // Bytes of an escape sequence seen so far
+
+    if (reserve(&state, 0) == -1) {
+        return NULL;
+    }
+
+    // Keys arrive one by one without echo; signals still work
+    bool raw_mode = tcgetattr(in->fd, &saved) == 0;
+    if (raw_mode) {
+        raw = saved;
+        raw.c_lflag &= ~(ICANON | ECHO);
+        raw.c_cc[VMIN] = 1;
+        raw.c_cc[VTIME] = 0;
+        tcsetattr(in->fd, TCSADRAIN, &raw);
+    }
+
+    for (;;) {
+        int c = reader_next_byte(in);
+        size_t shown = state.cursor;
+
+        if (c == -1) {
+            break;
+        }
+        if (escape > 0) {
+            // ESC [ or ESC O, then a final byte, with ~ after Delete's 3
+            if (escape == 1) {
+                escape = c == '[' || c == 'O' ? 2 : 0;
+                continue;
+            }
+            if (c == '3' && escape == 2) {
+                escape = 3;
+                continue;
+            }
+            if (escape == 3) {
+                c = c == '~' ? KEY_DELETE : 0;
+            } else {
+                c = c == 'C' ? 6 : c == 'D' ? 2 : c == 'H' ? 1 : c == 'F' ? 5 : 0;
+            }
+            escape = 0;
+            if (c == 0) {
+                continue;
+            }
+        }
+
+        if (c == '\r' || c == '\n') {
+            break;
+        }
+        switch (c) {
+            case 27:
+                escape = 1;
+                continue;
+            case 4: // Ctrl-D ends the input on an empty line
+                if (state.length == 0) {
+                    in->at_eof = true;
+                    break;
+                }
+                // Fall through
+            case KEY_DELETE:
+                if (state.cursor < state.length) {
+                    erase(&state, state.cursor, state.cursor + 1);
+                }
+                break;
+            case 127:
+            case 8:
+                if (state.cursor > 0) {
+                    erase(&state, state.cursor - 1, state.cursor);
+                }
+                break;
+            case 1:
+                state.cursor = 0;
+                break;
+            case 5:
+                state.cursor = state.length;
+                break;
+            case 2:
+                state.cursor -= state.cursor > 0;
+                break;
+            case 6:
+                state.cursor += state.cursor < state.length;
+                break;
+            case 21:
+                erase(&state, 0, state.cursor);
+                break;
+            case 11:
+                state.length = state.cursor;
+                break;
+            case 23: {
+                size_t start = state.cursor;
+                while (start > 0 && in->line[start - 1] == ' ') {
+                    start--;
+                }
+                while (start > 0 && in->line[start - 1] != ' ') {
+                    start--;
+                }
+                erase(&state, start, state.cursor);
+                break;
+            }
+            case '\t':
+                complete(&state);
+                continue;
+            default: {
+                if (c < 32) {
+                    continue;
+                }
+                char byte = c;
+                bool at_end = state.cursor == state.length;
+                insert(&state, &byte, 1);
+                if (at_end) {
+                    // Typing at the end only needs an echo
+                    putchar(byte);
+                    fflush(stdout);
+                    continue;
+                }
+                break;
+            }
+        }
+        if (in->at_eof) {
+            break;
+        }
+        redraw(&state, shown);
+    }
+
+    if (raw_mode) {
+        tcsetattr(in->fd, TCSADRAIN, &saved);
+    }
+    if (state.length == 0 && in->at_eof) {
+        return NULL;
+    }
+    printf("\n");
+    fflush(stdout);
+    in->line[state.length] = '\0';
+    if (line_length != NULL) {
+        *line_length = state.length;
+    }
+    return in->line;
+}
@@ -0,0 +1,14 @@
+/**
+ * editor.h - Line editing and tab completion for terminals
+ */
+
+#ifndef EDITOR_H
+#define EDITOR_H
+
+#include <stddef.h>
+#include "reader.h"
+
+/* Function declarations */
+char *editor_read_line(struct reader *in, size_t *line_length);
+
+#endif /* EDITOR_H */
@@ -0,0 +1,206 @@
+/**
+ * events.c - Event loop for input and child process completions
+ *
+ * SIGCHLD is blocked in the shell and read from a signalfd instead. While
+ * the shell waits for a line of input, epoll watches both the input
+ * descriptor and the signalfd, so background completions are reported
+ * as soon as they happen rather than at the next prompt. Reaping only
+ * runs after a SIGCHLD, so its cost follows the number of exits. Other
+ * modules can add descriptors of their own, such as the inotify
+ * descriptor of the PATH index.
+ */
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include "events.h"
+#include "telemetry.h"
+
+#define EVENTS_MAX_WATCHES 4
+
+static int signal_fd = -1;
+static int epoll_fd = -1;
+static int watched_input_fd = -1;
+
+/* Other descriptors, each with the function that handles its events */
+static struct {
+    int fd;
+    void (*handler)(void);
+} watches[EVENTS_MAX_WATCHES];
+static int watch_count = 0;
+
+/**
+ * Blocks SIGCHLD, creates its signalfd and the epoll instance.
+ *
+ * @param input_fd: The descriptor commands are read from, or -1 if the
+ *     input is already in memory
+ * @return: 0 on success, -1 on failure
+ */
+int events_init(int input_fd) {
+    sigset_t child_signals;
+    struct epoll_event event = {0};
+
+    sigemptyset(&child_signals);
+    sigaddset(&child_signals, SIGCHLD);
+    if (sigprocmask(SIG_BLOCK, &child_signals, NULL) == -1) {
+        perror("sigprocmask() failed");
+        return -1;
+    }
+
+    signal_fd = signalfd(-1, &child_signals, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (signal_fd == -1) {
+        perror("signalfd() failed");
+        return -1;
+    }
+
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd == -1) {
+        perror("epoll_create1() failed");
+        return -1;
+    }
+
+    event.events = EPOLLIN;
+    event.data.fd = signal_fd;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, signal_fd, &event) == -1) {
+        perror("epoll_ctl() failed");
+        return -1;
+    }
+
+    // Regular files cannot be watched, but they never block either
+    if (input_fd != -1) {
+        event.data.fd = input_fd;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, input_fd, &event) == 0) {
+            watched_input_fd = input_fd;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Calls a handler whenever a descriptor becomes readable while the shell
+ * waits for input.
+ *
+ * @param fd: The descriptor
+ * @param handler: The function that reads and handles its events
+ * @return: 0 on success, -1 on failure
+ */
+int events_watch(int fd, void (*handler)(void)) {
+    struct epoll_event event = {0};
+
+    if (epoll_fd == -1 || watch_count == EVENTS_MAX_WATCHES) {
+        return -1;
+    }
+    event.events = EPOLLIN;
+    event.data.fd = fd;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1) {
+        perror("epoll_ctl() failed");
+        return -1;
+    }
+    watches[watch_count].fd = fd;
+    watches[watch_count].handler = handler;
+    watch_count++;
+    return 0;
+}
+
+/**
+ * Empties the signalfd.
+ *
+ * @return: The number of SIGCHLD notifications that were queued
+ */
+static int drain_child_signals(void) {
+    struct signalfd_siginfo info[16];
+    int notifications = 0;
+    ssize_t count;
+
+    while ((count = read(signal_fd, info, sizeof(info))) > 0) {
+        notifications += count / sizeof(info[0]);
+    }
+    return notifications;
+}
+
+/**
+ * Reports background processes that finished since the last call,
+ * without blocking. Costs nothing when no background process exists.
+ *
+ * @param jobs: A pointer to the background job table
+ */
+void events_poll(struct job_table *jobs) {
+    if (jobs->job_count == 0 || signal_fd == -1) {
+        return;
+    }
+    if (drain_child_signals() > 0) {
+        check_bg_processes(jobs);
+    }
+    telemetry_children_checked();
+}
+
+/**
+ * Blocks until the input descriptor is readable, reporting background
+ * completions while waiting. Used as the reader's wait hook.
+ *
+ * @param jobs: A struct job_table * for the background job table
+ * @return: 0 when input is ready, -1 if the caller should just read
+ */
+int events_wait_input(void *jobs) {
+    struct epoll_event events[2 + EVENTS_MAX_WATCHES];
+
+    if (watched_input_fd == -1) {
+        return -1;
+    }
+
+    for (;;) {
+        int count = epoll_wait(epoll_fd, events, 2 + EVENTS_MAX_WATCHES, -1);
+        if (count == -1) {
+            if (errno == EINTR) {
+                continue; // Interrupted by SIGTSTP
+            }
+            perror("epoll_wait() failed");
+            return -1;
+        }
+        // The shell was idle here, so exits are noticed as they happen
+        telemetry_children_checked();
+
+        bool input_ready = false;
+        for (int i = 0; i < count; i++) {
+            if (events[i].data.fd == signal_fd) {
+                drain_child_signals();
+                if (check_bg_processes(jobs) > 0 &&
+                    isatty(watched_input_fd)) {
+                    // The messages went below the prompt, show it again
+                    printf(": ");
+                    fflush(stdout);
+                }
+            } else if (events[i].data.fd == watched_input_fd) {
+                input_ready = true;
+            } else {
+                for (int j = 0; j < watch_count; j++) {
+                    if (watches[j].fd == events[i].data.fd) {
+                        watches[j].handler();
+                    }
+                }
+            }
+        }
+        if (input_ready) {
+            return 0;
+        }
+    }
+}
+
+/**
+ * Closes the event descriptors.
+ */
+void events_close(void) {
+    if (epoll_fd != -1) {
+        close(epoll_fd);
+        epoll_fd = -1;
+    }
+    if (signal_fd != -1) {
+        close(signal_fd);
+        signal_fd = -1;
+    }
+    watched_input_fd = -1;
+    watch_count = 0;
+}
@@ -0,0 +1,17 @@
+/**
+ * events.h - Event loop for input and child process completions
+ */
+
+#ifndef EVENTS_H
+#define EVENTS_H
+
+#include "jobs.h"
+
+/* Function declarations */
+int events_init(int input_fd);
+int events_watch(int fd, void (*handler)(void));
+void events_poll(struct job_table *jobs);
+int events_wait_input(void *jobs);
+void events_close(void);
+
+#endif /* EVENTS_H */
@@ -0,0 +1,742 @@
+/**
+ * expand.c - Word expansion at execution time
+ *
+ * Arguments and redirection targets are expanded just before a command
+ * runs, so that they see the results of the commands before them. Words
+ * without anything to expand are kept as they are, without a copy.
+ *
+ * $$ becomes the process ID of the shell, $? the status of the last
+ * foreground command and $NAME or ${NAME} the value of an environment
+ * variable. These are expanded in two passes over the word, the first
+ * measuring the result and the second writing it, so the expansion is
+ * allocated once at its exact size.
+ *
+ * $(command) runs the command and substitutes its output. The output is
+ * read in large chunks straight into an arena buffer that grows in place
+ * and is split into words where it lies, so it is never copied. A single
+ * fork-free builtin writes into a memfd instead of a child process, a
+ * single external command is started through start_process() with its
+ * output on a pipe, and anything else runs in a forked copy of the shell.
+ *
+ * Arguments holding *, ? or [...] after these expansions are replaced by
+ * the paths they match, see glob.c. Redirection targets are not.
+ */
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include "expand.h"
+#include "commands.h"
+#include "common.h"
+#include "glob.h"
+#include "io.h"
+#include "reader.h"
+#include "signals.h"
+
+#define SUBST_READ_SIZE (64 * 1024)
+
+extern char **environ;
+
+static pid_t shell_pid; // $$, fixed before any subshell is forked
+
+/**
+ * Records the process ID that $$ expands to.
+ */
+void expand_init(void) {
+    shell_pid = getpid();
+}
+
+/**
+ * Growable output buffer in the arena of the line
+ */
+struct expand_buffer {
+    struct arena *arena;
+    char *data;
+    size_t used;
+    size_t capacity;
+};
+
+/**
+ * Makes sure the buffer has room for more bytes.
+ *
+ * @param buffer: The buffer
+ * @param extra: The number of bytes needed after the used ones
+ * @return: 0 on success, -1 on failure
+ */
+static int reserve(struct expand_buffer *buffer, size_t extra) {
+    if (buffer->used + extra <= buffer->capacity) {
+        return 0;
+    }
+    size_t capacity = buffer->capacity == 0 ? 256 : buffer->capacity;
+    while (capacity < buffer->used + extra) {
+        capacity *= 2;
+    }
+    char *data = arena_grow(buffer->arena, buffer->data, buffer->used, capacity);
+    if (data == NULL) {
+        return -1;
+    }
+    buffer->data = data;
+    buffer->capacity = capacity;
+    return 0;
+}
+
+/**
+ * Appends bytes to the buffer.
+ *
+ * @param buffer: The buffer
+ * @param text: The bytes
+ * @param length: The number of bytes
+ * @return: 0 on success, -1 on failure
+ */
+static int append(struct expand_buffer *buffer, const char *text, size_t length) {
+    if (reserve(buffer, length) == -1) {
+        return -1;
+    }
+    memcpy(buffer->data + buffer->used, text, length);
+    buffer->used += length;
+    return 0;
+}
+
+/**
+ * Reads a descriptor to its end straight into the buffer.
+ *
+ * @param buffer: The buffer
+ * @param fd: The descriptor
+ * @return: 0 on success, -1 on failure
+ */
+static int read_all(struct expand_buffer *buffer, int fd) {
+    for (;;) {
+        // reserve() doubles, so large outputs get ever larger reads
+        if (reserve(buffer, SUBST_READ_SIZE) == -1) {
+            return -1;
+        }
+        ssize_t count = read(fd, buffer->data + buffer->used,
+                             buffer->capacity - buffer->used);
+        if (count == 0) {
+            return 0;
+        }
+        if (count == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("command substitution: read() failed");
+            return -1;
+        }
+        buffer->used += count;
+    }
+}
+
+/**
+ * Runs a fork-free builtin with its output in a memfd.
+ *
+ * @param builtin: The builtin
+ * @param command: The parsed command
+ * @param context: The shell context
+ * @param buffer: Receives the output
+ * @return: 0 on success, -1 on failure
+ */
+static int capture_builtin(
+    const struct builtin *builtin,
+    struct command_line *command,
+    struct shell_context *context,
+    struct expand_buffer *buffer
+) {
+    int capture_fd = memfd_create("smallsh-substitution", MFD_CLOEXEC);
+    if (capture_fd == -1) {
+        perror("command substitution: memfd_create() failed");
+        return -1;
+    }
+
+    // The builtin writes to the memfd as its standard output
+    fflush(stdout);
+    int saved_fd = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 10);
+    if (saved_fd == -1 || dup2(capture_fd, STDOUT_FILENO) == -1) {
+        perror("command substitution: cannot redirect output");
+        if (saved_fd != -1) {
+            close(saved_fd);
+        }
+        close(capture_fd);
+        return -1;
+    }
+    int saved[2] = {-1, saved_fd};
+    run_builtin(builtin, command, context);
+    restore_redirect(saved);
+
+    int result = 0;
+    if (lseek(capture_fd, 0, SEEK_SET) == -1 ||
+        read_all(buffer, capture_fd) == -1) {
+        result = -1;
+    }
+    close(capture_fd);
+    return result;
+}
+
+/**
+ * Runs a command with its standard output on a pipe and reads the
+ * output until the command closes it.
+ *
+ * @param command: The parsed command
+ * @param context: The shell context
+ * @param buffer: Receives the output
+ * @return: 0 on success, -1 on failure
+ */
+static int capture_child(
+    struct command_line *command,
+    struct shell_context *context,
+    struct expand_buffer *buffer
+) {
+    int pipe_fds[2];
+    pid_t child_pid;
+    bool simple = command->pipe_next == NULL && command->list_next == NULL &&
+        builtin_lookup(command->argv[0]) == NULL;
+
+    if (pipe2(pipe_fds, O_CLOEXEC) == -1) {
+        perror("command substitution: pipe() failed");
+        return -1;
+    }
+
+    if (simple) {
+        // A single external command goes through the usual spawn path
+        struct spawn_io io = {-1, pipe_fds[1], -1};
+        child_pid = start_process(command, &io, context);
+    } else {
+        // Anything else runs in a copy of the shell
+        fflush(stdout);
+        child_pid = fork();
+        if (child_pid == 0) {
+            setup_signal_handlers(false, false, NULL);
+            if (dup2(pipe_fds[1], STDOUT_FILENO) == -1) {
+                perror("command substitution: dup2() failed");
+                _exit(EXIT_FAILURE);
+            }
+            execute_command(command, context->exit_status,
+                            context->was_terminated, context->signal_number,
+                            context->jobs, true);
+            fflush(stdout);
+            _exit(*context->was_terminated ?
+                  128 + *context->signal_number : *context->exit_status);
+        } else if (child_pid == -1) {
+            perror("fork() failed");
+        }
+    }
+    close(pipe_fds[1]);
+
+    int result = read_all(buffer, pipe_fds[0]);
+    close(pipe_fds[0]);
+    if (child_pid == -1) {
+        return -1;
+    }
+
+    // The substitution's status becomes the last status
+    int child_status;
+    while (waitpid(child_pid, &child_status, 0) == -1) {
+        if (errno != EINTR) {
+            perror("waitpid() failed");
+            return -1;
+        }
+    }
+    update_status(child_status, context->exit_status,
+                  context->was_terminated, context->signal_number);
+    return result;
+}
+
+/**
+ * Runs the command of a $( ... ) and appends its output to the buffer.
+ *
+ * @param text: The command, without $( and )
+ * @param length: The length of the command
+ * @param context: The shell context
+ * @param buffer: Receives the output
+ * @return: 0 on success, -1 on failure
+ */
+static int substitute(
+    const char *text,
+    size_t length,
+    struct shell_context *context,
+    struct expand_buffer *buffer
+) {
+    struct reader input;
+    struct command_line *command;
+
+    // Parse the inner command like a line of its own
+    char *line = arena_strndup(buffer->arena, text, length);
+    if (line == NULL) {
+        return -1;
+    }
+    reader_open_string(&input, line);
+    command = parse_input(&input, buffer->arena);
+    reader_close(&input);
+    if (command == NULL || command->argc == 0) {
+        return 0;
+    }
+
+    // Nested substitutions run first, from the inside out
+    if (expand_command(command, context) == -1) {
+        return -1;
+    }
+    if (command->argc == 0) {
+        return 0;
+    }
+
+    const struct builtin *builtin = builtin_lookup(command->argv[0]);
+    if (builtin != NULL && (builtin->flags & BUILTIN_UTILITY) &&
+        command->pipe_next == NULL && command->list_next == NULL) {
+        return capture_builtin(builtin, command, context, buffer);
+    }
+    return capture_child(command, context, buffer);
+}
+
+/**
+ * Copies bytes to the output of an expansion pass, or only counts them
+ * when measuring.
+ *
+ * @param out: The output, or NULL when measuring
+ * @param length: The length so far, advanced by count
+ * @param text: The bytes
+ * @param count: The number of bytes
+ */
+static void emit(char *out, size_t *length, const char *text, size_t count) {
+    if (out != NULL) {
+        memcpy(out + *length, text, count);
+    }
+    *length += count;
+}
+
+/**
+ * Finds the value of an environment variable without copying its name.
+ *
+ * @param name: The name, not NUL-terminated
+ * @param length: The length of the name
+ * @return: The value, or NULL if the variable is not set
+ */
+static const char *lookup_variable(const char *name, size_t length) {
+    for (char **entry = environ; *entry != NULL; entry++) {
+        if (strncmp(*entry, name, length) == 0 && (*entry)[length] == '=') {
+            return *entry + length + 1;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Expands one parameter after a $.
+ *
+ * @param text: The first character after the $
+ * @param end: The end of the text
+ * @param context: The shell context
+ * @param out: The output, or NULL when measuring
+ * @param length: The length so far, advanced by the expansion
+ * @return: The first character after the parameter
+ */
+static const char *expand_parameter(
+    const char *text,
+    const char *end,
+    struct shell_context *context,
+    char *out,
+    size_t *length
+) {
+    char number[16];
+    const char *name = text;
+    const char *name_end;
+    const char *next;
+
+    if (text < end && (*text == '$' || *text == '?')) {
+        int value = *text == '$' ? (int)shell_pid :
+            *context->was_terminated ? 128 + *context->signal_number :
+            *context->exit_status;
+        emit(out, length, number, snprintf(number, sizeof(number), "%d", value));
+        return text + 1;
+    }
+
+    if (text < end && *text == '{') {
+        name = text + 1;
+        name_end = memchr(name, '}', end - name);
+        if (name_end == NULL) {
+            emit(out, length, "$", 1); // No closing brace, keep it literal
+            return text;
+        }
+        next = name_end + 1;
+    } else {
+        name_end = name;
+        while (name_end < end && (*name_end == '_' ||
+               isalnum((unsigned char)*name_end))) {
+            name_end++;
+        }
+        if (name_end == name || isdigit((unsigned char)*name)) {
+            emit(out, length, "$", 1); // Not a parameter, keep it literal
+            return text;
+        }
+        next = name_end;
+    }
+
+    const char *value = lookup_variable(name, name_end - name);
+    if (value != NULL) {
+        emit(out, length, value, strlen(value));
+    }
+    return next;
+}
+
+/**
+ * Expands the parameters in a piece of text. Called once with no output
+ * to measure the expansion and once more to write it.
+ *
+ * @param text: The text
+ * @param end: The end of the text
+ * @param context: The shell context
+ * @param out: The output, or NULL when measuring
+ * @return: The length of the expansion
+ */
+static size_t expand_parameters(
+    const char *text,
+    const char *end,
+    struct shell_context *context,
+    char *out
+) {
+    size_t length = 0;
+
+    while (text < end) {
+        const char *dollar = memchr(text, '$', end - text);
+        if (dollar == NULL) {
+            emit(out, &length, text, end - text);
+            break;
+        }
+        emit(out, &length, text, dollar - text);
+        text = expand_parameter(dollar + 1, end, context, out, &length);
+    }
+    return length;
+}
+
+/**
+ * Appends a piece of text with its parameters expanded to the buffer.
+ *
+ * @param buffer: The buffer
+ * @param text: The text
+ * @param end: The end of the text
+ * @param context: The shell context
+ * @return: 0 on success, -1 on failure
+ */
+static int append_parameters(
+    struct expand_buffer *buffer,
+    const char *text,
+    const char *end,
+    struct shell_context *context
+) {
+    size_t length = expand_parameters(text, end, context, NULL);
+    if (reserve(buffer, length) == -1) {
+        return -1;
+    }
+    expand_parameters(text, end, context, buffer->data + buffer->used);
+    buffer->used += length;
+    return 0;
+}
+
+/**
+ * Expands the parameters of a word into a copy of its exact size.
+ *
+ * @param word: The word
+ * @param arena: The arena of the line
+ * @param context: The shell context
+ * @return: The expansion, or NULL on failure
+ */
+static char *expand_word(const char *word, struct arena *arena, struct shell_context *context) {
+    const char *end = word + strlen(word);
+    size_t length = expand_parameters(word, end, context, NULL);
+
+    char *result = arena_alloc(arena, length + 1);
+    if (result == NULL) {
+        return NULL;
+    }
+    expand_parameters(word, end, context, result);
+    result[length] = '\0';
+    return result;
+}
+
+/**
+ * Finds the next $( in a word, skipping $$.
+ *
+ * @param word: The word
+ * @return: The $(, or NULL if there is none
+ */
+static const char *find_substitution(const char *word) {
+    while ((word = strchr(word, '$')) != NULL) {
+        if (word[1] == '(') {
+            return word;
+        }
+        word += word[1] == '$' ? 2 : 1;
+    }
+    return NULL;
+}
+
+/**
+ * Finds the ) that closes a $(.
+ *
+ * @param text: The first character after the $(
+ * @return: The closing parenthesis, or NULL if there is none
+ */
+static const char *closing_paren(const char *text) {
+    int depth = 1;
+
+    for (; *text != '\0'; text++) {
+        if (*text == '(') {
+            depth++;
+        } else if (*text == ')' && --depth == 0) {
+            return text;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Expands a word into the buffer, NUL-terminated.
+ *
+ * @param word: The word
+ * @param context: The shell context
+ * @param buffer: Receives the expansion
+ * @return: 0 on success, -1 on failure
+ */
+static int expand_into(
+    const char *word,
+    struct shell_context *context,
+    struct expand_buffer *buffer
+) {
+    const char *start;
+
+    while ((start = find_substitution(word)) != NULL) {
+        const char *end = closing_paren(start + 2);
+        if (end == NULL) {
+            break; // The tokenizer rejects this, keep it literal
+        }
+        if (append_parameters(buffer, word, start, context) == -1) {
+            return -1;
+        }
+        size_t output_start = buffer->used;
+        if (substitute(start + 2, end - start - 2, context, buffer) == -1) {
+            return -1;
+        }
+
+        // Drop the trailing newlines of the output before the rest of
+        // the word, so they do not split it
+        while (buffer->used > output_start &&
+               buffer->data[buffer->used - 1] == '\n') {
+            buffer->used--;
+        }
+        word = end + 1;
+    }
+    if (append_parameters(buffer, word, word + strlen(word), context) == -1) {
+        return -1;
+    }
+    return append(buffer, "", 1);
+}
+
+/**
+ * Checks whether a word needs expansion.
+ *
+ * @param word: The word
+ * @return: true if the word contains a $
+ */
+static bool needs_expansion(const char *word) {
+    return word != NULL && strchr(word, '$') != NULL;
+}
+
+/**
+ * Expands a redirection target, which stays a single word.
+ *
+ * @param file: A pointer to the target, replaced by its expansion
+ * @param arena: The arena of the line
+ * @param context: The shell context
+ * @return: 0 on success, -1 on failure
+ */
+static int expand_file(char **file, struct arena *arena, struct shell_context *context) {
+    struct expand_buffer buffer = {arena, NULL, 0, 0};
+
+    if (!needs_expansion(*file)) {
+        return 0;
+    }
+    if (find_substitution(*file) == NULL) {
+        *file = expand_word(*file, arena, context);
+        return *file == NULL ? -1 : 0;
+    }
+    if (expand_into(*file, context, &buffer) == -1) {
+        return -1;
+    }
+    *file = buffer.data;
+    return 0;
+}
+
+/**
+ * Argument vector being rebuilt from expanded words
+ */
+struct field_list {
+    struct arena *arena;
+    char **argv;
+    int argc;
+    int capacity;
+};
+
+/**
+ * Appends a field to the argument vector, keeping it NULL-terminated.
+ *
+ * @param fields: The argument vector
+ * @param field: The field
+ * @return: 0 on success, -1 on failure
+ */
+static int add_field(struct field_list *fields, char *field) {
+    if (fields->argc + 1 == fields->capacity) {
+        char **argv = arena_grow(
+            fields->arena,
+            fields->argv,
+            fields->capacity * sizeof(char *),
+            fields->capacity * 2 * sizeof(char *)
+        );
+        if (argv == NULL) {
+            return -1;
+        }
+        fields->argv = argv;
+        fields->capacity *= 2;
+    }
+    fields->argv[fields->argc++] = field;
+    fields->argv[fields->argc] = NULL;
+    return 0;
+}
+
+/**
+ * Appends a field to the argument vector, or the paths it matches if it
+ * is a pattern that matches any.
+ *
+ * @param fields: The argument vector
+ * @param field: The field
+ * @return: 0 on success, -1 on failure
+ */
+static int add_pattern(struct field_list *fields, char *field) {
+    char **matches;
+    int count;
+
+    if (!glob_has_pattern(field)) {
+        return add_field(fields, field);
+    }
+    count = glob_expand(field, fields->arena, &matches);
+    if (count == -1) {
+        return -1;
+    }
+    if (count == 0) {
+        return add_field(fields, field);
+    }
+    for (int i = 0; i < count; i++) {
+        if (add_field(fields, matches[i]) == -1) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Splits an expansion into fields at whitespace, in place.
+ *
+ * @param fields: The argument vector to add the fields to
+ * @param data: The expansion, modified in place
+ * @return: 0 on success, -1 on failure
+ */
+static int split_fields(struct field_list *fields, char *data) {
+    static const char separators[] = " \t\n";
+
+    for (;;) {
+        data += strspn(data, separators);
+        if (*data == '\0') {
+            return 0;
+        }
+        char *field = data;
+        data += strcspn(data, separators);
+        if (*data != '\0') {
+            *data++ = '\0';
+        }
+        if (add_pattern(fields, field) == -1) {
+            return -1;
+        }
+    }
+}
+
+/**
+ * Expands the arguments of one stage. Only words with a $ are copied;
+ * the argument vector is rebuilt only if one of them or a pattern is
+ * found.
+ *
+ * @param stage: The stage
+ * @param context: The shell context
+ * @return: 0 on success, -1 on failure
+ */
+static int expand_stage(struct command_line *stage, struct shell_context *context) {
+    struct field_list fields = {stage->arena, NULL, 0, 0};
+    int first = 0;
+
+    // Words before the first expansion are kept as they are
+    while (first < stage->argc && !needs_expansion(stage->argv[first]) &&
+           !glob_has_pattern(stage->argv[first])) {
+        first++;
+    }
+
+    if (first < stage->argc) {
+        fields.capacity = stage->argc * 2 + 1;
+        fields.argv = arena_alloc(stage->arena, fields.capacity * sizeof(char *));
+        if (fields.argv == NULL) {
+            return -1;
+        }
+        memcpy(fields.argv, stage->argv, first * sizeof(char *));
+        fields.argc = first;
+
+        for (int i = first; i < stage->argc; i++) {
+            if (!needs_expansion(stage->argv[i])) {
+                if (add_pattern(&fields, stage->argv[i]) == -1) {
+                    return -1;
+                }
+                continue;
+            }
+            if (find_substitution(stage->argv[i]) == NULL) {
+                // Parameters alone expand to one word, dropped if empty
+                char *word = expand_word(stage->argv[i], stage->arena, context);
+                if (word == NULL ||
+                    (*word != '\0' && add_pattern(&fields, word) == -1)) {
+                    return -1;
+                }
+                continue;
+            }
+            struct expand_buffer buffer = {stage->arena, NULL, 0, 0};
+            if (expand_into(stage->argv[i], context, &buffer) == -1 ||
+                split_fields(&fields, buffer.data) == -1) {
+                return -1;
+            }
+        }
+        fields.argv[fields.argc] = NULL;
+        stage->argv = fields.argv;
+        stage->argc = fields.argc;
+        stage->argv_capacity = fields.capacity;
+    }
+
+    if (expand_file(&stage->input_file, stage->arena, context) == -1 ||
+        expand_file(&stage->output_file, stage->arena, context) == -1) {
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Expands every stage of a command line before it runs.
+ *
+ * @param command: The first stage of the command line
+ * @param context: The shell context, whose status the substitutions set
+ * @return: 0 on success, -1 on failure
+ */
+int expand_command(struct command_line *command, struct shell_context *context) {
+    for (struct command_line *stage = command; stage != NULL;
+         stage = stage->pipe_next) {
+        if (expand_stage(stage, context) == -1) {
+            return -1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,15 @@
+/**
+ * expand.h - Word expansion at execution time
+ */
+
+#ifndef EXPAND_H
+#define EXPAND_H
+
+#include "parser.h"
+#include "builtins.h"
+
+/* Function declarations */
+void expand_init(void);
+int expand_command(struct command_line *command, struct shell_context *context);
+
+#endif /* EXPAND_H */
@@ -0,0 +1,599 @@
+/**
+ * glob.c - Pathname expansion of *, ? and [...] patterns
+ *
+ * A word holding a pattern is split at '/' and matched one component at
+ * a time. Components without a pattern are taken as they are; the others
+ * are compiled once into a list of literal runs, single characters,
+ * character sets and stars, and matched against every name of their
+ * directory. Matches are sorted in byte order, and a word that matches
+ * nothing is kept as it is.
+ *
+ * Directories are read with getdents64() into a large buffer, so a
+ * directory with hundreds of thousands of entries takes a few system
+ * calls, and the names are kept in a small cache keyed by device and
+ * inode. A cached listing is used again as long as the directory's mtime
+ * has not changed. A directory modified just before it was read may
+ * change again within the same mtime tick, so such a listing is read
+ * again the next time.
+ *
+ * As in other shells, * and ? do not match a leading '.', and "." and
+ * ".." are never matched.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include "glob.h"
+
+#define GLOB_READ_SIZE (256 * 1024)
+#define GLOB_CACHE_SIZE 16
+#define GLOB_RACY_NS 20000000           // Coarsest mtime tick assumed
+#define GLOB_ENTRY_HEADER 2             // Type and name length bytes
+
+/**
+ * Directory entry as returned by getdents64()
+ */
+struct linux_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+/**
+ * Names of one directory. Each entry is its d_type byte, the length of
+ * its name, and the name with a NUL.
+ */
+struct dir_listing {
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime;
+    bool trusted;               // Not modified close to when it was read
+    unsigned long used;         // When it was last used, for eviction
+    char *entries;              // NULL marks an unused slot
+    size_t size;
+};
+
+/* Steps of a compiled pattern component */
+enum glob_op_type {
+    OP_LITERAL,
+    OP_ANY,
+    OP_STAR,
+    OP_SET
+};
+
+/**
+ * One step of a compiled pattern component
+ */
+struct glob_op {
+    enum glob_op_type type;
+    const char *text;           // A literal run, inside the pattern
+    size_t length;
+    const uint8_t *set;         // 256-bit character set of [...]
+};
+
+/**
+ * Compiled pattern component
+ */
+struct glob_matcher {
+    struct glob_op *ops;
+    int count;
+    size_t min_length;          // Length of a name matching no star
+    bool has_star;
+    bool leading_dot;           // The pattern itself starts with '.'
+};
+
+/**
+ * Paths collected in the arena of the line
+ */
+struct glob_list {
+    struct arena *arena;
+    char **paths;
+    int count;
+    int capacity;
+};
+
+static struct dir_listing cache[GLOB_CACHE_SIZE];
+static unsigned long cache_clock = 0;
+static char *read_buffer = NULL;
+
+/**
+ * Parses a [...] set.
+ *
+ * @param text: The first character after the '['
+ * @param end: The end of the pattern component
+ * @param set: Receives the set, or NULL to only find its end
+ * @return: The closing ']', or NULL if there is none
+ */
+static const char *parse_set(const char *text, const char *end, uint8_t *set) {
+    bool negate = false;
+
+    if (text < end && (*text == '!' || *text == '^')) {
+        negate = true;
+        text++;
+    }
+    if (set != NULL) {
+        memset(set, 0, 32);
+    }
+    // A ']' right after the '[' or the negation is a member
+    const char *first = text;
+    while (text < end && (*text != ']' || text == first)) {
+        unsigned int low = (unsigned char)*text;
+        unsigned int high = low;
+        if (text + 2 < end && text[1] == '-' && text[2] != ']') {
+            high = (unsigned char)text[2];
+            text += 2;
+        }
+        text++;
+        for (unsigned int c = low; set != NULL && c <= high; c++) {
+            set[c >> 3] |= 1 << (c & 7);
+        }
+    }
+    if (text == end) {
+        return NULL;
+    }
+    if (set != NULL && negate) {
+        for (int i = 0; i < 32; i++) {
+            set[i] = ~set[i];
+        }
+    }
+    return text;
+}
+
+/**
+ * Checks whether part of a word holds a pattern character.
+ *
+ * @param text: The start of the part
+ * @param end: The end of the part
+ * @return: true if it holds *, ? or a complete [...]
+ */
+static bool has_pattern(const char *text, const char *end) {
+    for (; text < end; text++) {
+        if (*text == '*' || *text == '?') {
+            return true;
+        }
+        if (*text == '[') {
+            const char *component_end = memchr(text, '/', end - text);
+            if (parse_set(text + 1, component_end != NULL ? component_end : end,
+                          NULL) != NULL) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+/**
+ * Checks whether a word is a pattern to expand.
+ *
+ * @param word: The word
+ * @return: true if it holds *, ? or a complete [...]
+ */
+bool glob_has_pattern(const char *word) {
+    return strpbrk(word, "*?[") != NULL && has_pattern(word, word + strlen(word));
+}
+
+/**
+ * Compiles a pattern component.
+ *
+ * @param text: The component
+ * @param end: The end of the component
+ * @param arena: The arena of the line
+ * @param matcher: Receives the compiled component
+ * @return: 0 on success, -1 on failure
+ */
+static int compile(
+    const char *text,
+    const char *end,
+    struct arena *arena,
+    struct glob_matcher *matcher
+) {
+    matcher->ops = arena_alloc(arena, (end - text) * sizeof(struct glob_op));
+    matcher->count = 0;
+    matcher->min_length = 0;
+    matcher->has_star = false;
+    matcher->leading_dot = *text == '.';
+    if (matcher->ops == NULL) {
+        return -1;
+    }
+
+    while (text < end) {
+        struct glob_op *last = matcher->count > 0 ?
+            &matcher->ops[matcher->count - 1] : NULL;
+        const char *close;
+
+        if (*text == '*') {
+            // Consecutive stars are one star
+            if (last == NULL || last->type != OP_STAR) {
+                matcher->ops[matcher->count++] = (struct glob_op){OP_STAR, NULL, 0, NULL};
+            }
+            matcher->has_star = true;
+            text++;
+            continue;
+        }
+        matcher->min_length++;
+        if (*text == '?') {
+            matcher->ops[matcher->count++] = (struct glob_op){OP_ANY, NULL, 0, NULL};
+            text++;
+        } else if (*text == '[' && (close = parse_set(text + 1, end, NULL)) != NULL) {
+            uint8_t *set = arena_alloc(arena, 32);
+            if (set == NULL) {
+                return -1;
+            }
+            parse_set(text + 1, end, set);
+            matcher->ops[matcher->count++] = (struct glob_op){OP_SET, NULL, 0, set};
+            text = close + 1;
+        } else if (last != NULL && last->type == OP_LITERAL &&
+                   last->text + last->length == text) {
+            last->length++;
+            text++;
+        } else {
+            matcher->ops[matcher->count++] = (struct glob_op){OP_LITERAL, text, 1, NULL};
+            text++;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Matches a name against a compiled component. A mismatch goes back to
+ * the last star and lets it take one more character, which is enough
+ * since a later star can absorb whatever an earlier one could.
+ *
+ * @param matcher: The compiled component
+ * @param name: The name
+ * @param length: The length of the name
+ * @return: true if the name matches
+ */
+static bool match(const struct glob_matcher *matcher, const char *name, size_t length) {
+    int op = 0;
+    size_t position = 0;
+    int star = -1;
+    size_t star_position = 0;
+
+    if (length < matcher->min_length ||
+        (!matcher->has_star && length != matcher->min_length) ||
+        (name[0] == '.' && !matcher->leading_dot)) {
+        return false;
+    }
+
+    for (;;) {
+        if (op < matcher->count) {
+            const struct glob_op *step = &matcher->ops[op];
+            if (step->type == OP_STAR) {
+                star = op++;
+                star_position = position;
+                continue;
+            }
+            if (position < length) {
+                unsigned char c = name[position];
+                size_t advance = 1;
+                bool matched;
+                switch (step->type) {
+                    case OP_LITERAL:
+                        matched = step->length <= length - position &&
+                            memcmp(name + position, step->text, step->length) == 0;
+                        advance = step->length;
+                        break;
+                    case OP_SET:
+                        matched = step->set[c >> 3] & (1 << (c & 7));
+                        break;
+                    default:
+                        matched = true;
+                        break;
+                }
+                if (matched) {
+                    position += advance;
+                    op++;
+                    continue;
+                }
+            }
+        } else if (position == length) {
+            return true;
+        }
+        if (star == -1 || star_position == length) {
+            return false;
+        }
+        position = ++star_position;
+        op = star + 1;
+    }
+}
+
+/**
+ * Reads every name of a directory into a listing.
+ *
+ * @param fd: The open directory
+ * @param listing: The listing, whose entries are replaced
+ * @return: 0 on success, -1 on failure
+ */
+static int read_listing(int fd, struct dir_listing *listing) {
+    size_t capacity = 0;
+
+    if (read_buffer == NULL && (read_buffer = malloc(GLOB_READ_SIZE)) == NULL) {
+        perror("Memory allocation for directory buffer failed");
+        return -1;
+    }
+    free(listing->entries);
+    listing->entries = NULL;
+    listing->size = 0;
+
+    for (;;) {
+        long count = syscall(SYS_getdents64, fd, read_buffer, GLOB_READ_SIZE);
+        if (count == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        if (count == 0) {
+            return 0;
+        }
+        for (long offset = 0; offset < count;) {
+            struct linux_dirent64 *entry = (struct linux_dirent64 *)(read_buffer + offset);
+            const char *name = entry->d_name;
+            size_t length = strlen(name);
+            offset += entry->d_reclen;
+
+            if ((name[0] == '.' && (name[1] == '\0' ||
+                                    (name[1] == '.' && name[2] == '\0'))) ||
+                length > UCHAR_MAX) {
+                continue;
+            }
+            if (listing->size + GLOB_ENTRY_HEADER + length + 1 > capacity) {
+                size_t new_capacity = capacity == 0 ? GLOB_READ_SIZE : capacity * 2;
+                char *entries = realloc(listing->entries, new_capacity);
+                if (entries == NULL) {
+                    perror("Memory allocation for directory listing failed");
+                    return -1;
+                }
+                listing->entries = entries;
+                capacity = new_capacity;
+            }
+            char *out = listing->entries + listing->size;
+            out[0] = entry->d_type;
+            out[1] = length;
+            memcpy(out + GLOB_ENTRY_HEADER, name, length + 1);
+            listing->size += GLOB_ENTRY_HEADER + length + 1;
+        }
+    }
+}
+
+/**
+ * Returns the names of a directory, from the cache if it has not changed.
+ *
+ * @param path: The directory, "" for the current one
+ * @return: The listing, or NULL if the directory cannot be read
+ */
+static const struct dir_listing *list_directory(const char *path) {
+    int fd = open(*path != '\0' ? path : ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    struct dir_listing *listing = NULL;
+    struct stat st;
+
+    if (fd == -1) {
+        return NULL;
+    }
+    if (fstat(fd, &st) == -1) {
+        close(fd);
+        return NULL;
+    }
+
+    // Use the slot of the directory, or the one unused the longest
+    for (int i = 0; i < GLOB_CACHE_SIZE; i++) {
+        struct dir_listing *slot = &cache[i];
+        if (slot->entries != NULL && slot->dev == st.st_dev && slot->ino == st.st_ino) {
+            listing = slot;
+            break;
+        }
+        if (listing == NULL || slot->entries == NULL ||
+            (listing->entries != NULL && slot->used < listing->used)) {
+            listing = slot;
+        }
+    }
+    listing->used = ++cache_clock;
+    if (listing->entries != NULL && listing->dev == st.st_dev &&
+        listing->ino == st.st_ino && listing->trusted &&
+        listing->mtime.tv_sec == st.st_mtim.tv_sec &&
+        listing->mtime.tv_nsec == st.st_mtim.tv_nsec) {
+        close(fd);
+        return listing;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    if (read_listing(fd, listing) == -1) {
+        free(listing->entries);
+        listing->entries = NULL;
+        close(fd);
+        return NULL;
+    }
+    close(fd);
+    if (listing->entries == NULL) {
+        // An empty directory still needs a slot to be cached
+        listing->entries = malloc(1);
+        if (listing->entries == NULL) {
+            return NULL;
+        }
+    }
+    listing->dev = st.st_dev;
+    listing->ino = st.st_ino;
+    listing->mtime = st.st_mtim;
+    listing->trusted = (now.tv_sec - st.st_mtim.tv_sec) * 1000000000LL +
+        (now.tv_nsec - st.st_mtim.tv_nsec) >= GLOB_RACY_NS;
+    return listing;
+}
+
+/**
+ * Appends a copy of a path to a list.
+ *
+ * @param list: The list
+ * @param path: The path
+ * @param length: The length of the path
+ * @return: 0 on success, -1 on failure
+ */
+static int add_path(struct glob_list *list, const char *path, size_t length) {
+    char *copy = arena_strndup(list->arena, path, length);
+
+    if (copy == NULL) {
+        return -1;
+    }
+    if (list->count == list->capacity) {
+        int capacity = list->capacity == 0 ? 16 : list->capacity * 2;
+        char **paths = list->paths == NULL ?
+            arena_alloc(list->arena, capacity * sizeof(char *)) :
+            arena_grow(list->arena, list->paths, list->capacity * sizeof(char *),
+                       capacity * sizeof(char *));
+        if (paths == NULL) {
+            return -1;
+        }
+        list->paths = paths;
+        list->capacity = capacity;
+    }
+    list->paths[list->count++] = copy;
+    return 0;
+}
+
+/**
+ * Checks whether a path names a directory, following symbolic links.
+ *
+ * @param path: The path
+ * @param type: Its d_type
+ * @return: true if it is a directory
+ */
+static bool is_directory(const char *path, unsigned char type) {
+    struct stat st;
+
+    if (type != DT_LNK && type != DT_UNKNOWN) {
+        return type == DT_DIR;
+    }
+    return stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+/**
+ * Expands the rest of a pattern below a directory.
+ *
+ * @param results: The list receiving complete matches
+ * @param path: The directory matched so far, with its trailing '/', in
+ *     a buffer of PATH_MAX bytes
+ * @param length: The length of the path
+ * @param rest: The components left to match
+ * @return: 0 on success, -1 on failure
+ */
+static int expand_below(
+    struct glob_list *results,
+    char *path,
+    size_t length,
+    const char *rest
+) {
+    const char *slash = strchr(rest, '/');
+    const char *end = slash != NULL ? slash : rest + strlen(rest);
+    const char *next = slash != NULL ? slash + strspn(slash, "/") : NULL;
+    size_t separator = slash != NULL ? (size_t)(next - slash) : 0;
+    bool last = next == NULL || *next == '\0';
+
+    // A component without a pattern only has to exist
+    if (!has_pattern(rest, end)) {
+        size_t new_length = length + (end - rest) + separator;
+        if (new_length >= PATH_MAX) {
+            return 0;
+        }
+        memcpy(path + length, rest, new_length - length);
+        path[new_length] = '\0';
+        if (!last) {
+            return expand_below(results, path, new_length, next);
+        }
+        struct stat st;
+        if (fstatat(AT_FDCWD, path, &st, AT_SYMLINK_NOFOLLOW) == -1) {
+            return 0;
+        }
+        return add_path(results, path, new_length);
+    }
+
+    struct glob_matcher matcher;
+    if (compile(rest, end, results->arena, &matcher) == -1) {
+        return -1;
+    }
+    path[length] = '\0';
+    const struct dir_listing *listing = list_directory(path);
+    if (listing == NULL) {
+        return 0;
+    }
+
+    // Matches that lead further are collected first, since reading the
+    // directories below may evict this listing from the cache
+    struct glob_list subdirs = {results->arena, NULL, 0, 0};
+    for (const char *entry = listing->entries;
+         entry < listing->entries + listing->size;
+         entry += GLOB_ENTRY_HEADER + (unsigned char)entry[1] + 1) {
+        const char *name = entry + GLOB_ENTRY_HEADER;
+        size_t name_length = (unsigned char)entry[1];
+        size_t new_length = length + name_length + separator;
+
+        if (!match(&matcher, name, name_length) || new_length >= PATH_MAX) {
+            continue;
+        }
+        memcpy(path + length, name, name_length);
+        path[length + name_length] = '\0';
+        if (slash != NULL && !is_directory(path, entry[0])) {
+            continue;
+        }
+        memcpy(path + length + name_length, slash != NULL ? slash : "", separator);
+        if (last ? add_path(results, path, new_length) == -1 :
+            add_path(&subdirs, name, name_length) == -1) {
+            return -1;
+        }
+    }
+
+    for (int i = 0; i < subdirs.count; i++) {
+        size_t name_length = strlen(subdirs.paths[i]);
+        memcpy(path + length, subdirs.paths[i], name_length);
+        memcpy(path + length + name_length, slash, separator);
+        if (expand_below(results, path, length + name_length + separator, next) == -1) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Compares two paths for qsort().
+ */
+static int compare_paths(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/**
+ * Expands a pattern into the paths it matches.
+ *
+ * @param pattern: The pattern
+ * @param arena: The arena of the line, which holds the matches
+ * @param matches: Receives the sorted matches
+ * @return: The number of matches, or -1 on failure
+ */
+int glob_expand(const char *pattern, struct arena *arena, char ***matches) {
+    struct glob_list results = {arena, NULL, 0, 0};
+    char path[PATH_MAX];
+    size_t length = strspn(pattern, "/");
+
+    if (length >= PATH_MAX) {
+        return 0;
+    }
+    memcpy(path, pattern, length);
+    if (expand_below(&results, path, length, pattern + length) == -1) {
+        return -1;
+    }
+    if (results.count > 1) {
+        qsort(results.paths, results.count, sizeof(char *), compare_paths);
+    }
+    *matches = results.paths;
+    return results.count;
+}
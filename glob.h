@@ -0,0 +1,15 @@
+/**
+ * glob.h - Pathname expansion of *, ? and [...] patterns
+ */
+
+#ifndef GLOB_H
+#define GLOB_H
+
+#include <stdbool.h>
+#include "arena.h"
+
+/* Function declarations */
+bool glob_has_pattern(const char *word);
+int glob_expand(const char *pattern, struct arena *arena, char ***matches);
+
+#endif /* GLOB_H */
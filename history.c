@@ -0,0 +1,392 @@
+/**
+ * history.c - Persistent command history
+ *
+ * Interactive lines are appended to $SMALLSH_HISTFILE, or
+ * ~/.smallsh_history, as records of a fixed-size header followed by the
+ * text and padded to 8 bytes. Each record is written with one write() on
+ * a descriptor opened with O_APPEND, so shells sharing the file never
+ * interleave their records and need no lock. A record whose header is
+ * damaged is skipped by looking for the next header at the following
+ * 8-byte boundary.
+ *
+ * Opening the history only opens the file. The file is mapped and
+ * indexed the first time an entry is needed, and later only the records
+ * added since are indexed, so startup does not depend on the size of the
+ * history. The index holds the offset of every record, which makes !n a
+ * single lookup; !prefix and !?text? search it from the newest entry.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "history.h"
+#include "common.h"
+
+#define HISTORY_MAGIC 0x74736968U      // "hist" in a little-endian file
+#define HISTORY_ALIGN 8
+
+/**
+ * Header of a history record, followed by the text of the line
+ */
+struct history_record {
+    uint32_t magic;
+    uint32_t length;
+};
+
+/* History file and its mapping */
+static int history_fd = -1;
+static char *history_map = NULL;
+static size_t map_length = 0;
+
+/* Offsets of the records, the bytes of the file they cover */
+static size_t *offsets = NULL;
+static size_t entry_count = 0;
+static size_t offsets_capacity = 0;
+static size_t indexed = 0;
+
+/**
+ * Returns the size of a record holding a line.
+ *
+ * @param length: The length of the line
+ * @return: The size of the record, padded
+ */
+static size_t record_size(size_t length) {
+    size_t size = sizeof(struct history_record) + length;
+    return (size + HISTORY_ALIGN - 1) & ~(size_t)(HISTORY_ALIGN - 1);
+}
+
+/**
+ * Checks whether a record header starts anywhere after an offset.
+ *
+ * @param offset: The first aligned offset to look at
+ * @return: true if a record magic is found before the end of the mapping
+ */
+static bool record_follows(size_t offset) {
+    for (; offset + sizeof(struct history_record) <= map_length;
+         offset += HISTORY_ALIGN) {
+        uint32_t magic;
+        memcpy(&magic, history_map + offset, sizeof(magic));
+        if (magic == HISTORY_MAGIC) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Opens the history file. Calling it again does nothing.
+ */
+void history_open(void) {
+    char path[4096];
+    const char *value = getenv("SMALLSH_HISTFILE");
+
+    if (history_fd != -1) {
+        return;
+    }
+    if (value != NULL && *value != '\0') {
+        snprintf(path, sizeof(path), "%s", value);
+    } else if ((value = getenv("HOME")) != NULL && *value != '\0') {
+        snprintf(path, sizeof(path), "%s/.smallsh_history", value);
+    } else {
+        return;
+    }
+
+    history_fd = open(path, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+    if (history_fd == -1) {
+        fprintf(stderr, "history: cannot open %s: %s\n", path, strerror(errno));
+        fflush(stderr);
+    }
+}
+
+/**
+ * Maps the records appended to the file since the last call, by this
+ * shell or another one, and adds them to the index.
+ *
+ * @return: 0 on success, -1 on failure
+ */
+static int history_sync(void) {
+    struct stat info;
+
+    history_open();
+    if (history_fd == -1 || fstat(history_fd, &info) == -1) {
+        return -1;
+    }
+    size_t size = info.st_size;
+
+    if (size > map_length) {
+        void *map = history_map == NULL ?
+            mmap(NULL, size, PROT_READ, MAP_SHARED, history_fd, 0) :
+            mremap(history_map, map_length, size, MREMAP_MAYMOVE);
+        if (map == MAP_FAILED) {
+            perror("history: mmap() failed");
+            return -1;
+        }
+        history_map = map;
+        map_length = size;
+    }
+
+    while (map_length - indexed >= sizeof(struct history_record)) {
+        struct history_record header;
+        memcpy(&header, history_map + indexed, sizeof(header));
+        if (header.magic != HISTORY_MAGIC) {
+            indexed += HISTORY_ALIGN; // Damaged, look for the next record
+            continue;
+        }
+        if (record_size(header.length) > map_length - indexed) {
+            if (!record_follows(indexed + HISTORY_ALIGN)) {
+                break; // The last record, still being written
+            }
+            indexed += HISTORY_ALIGN; // Damaged length, as for a bad magic
+            continue;
+        }
+
+        if (entry_count == offsets_capacity) {
+            size_t capacity = offsets_capacity == 0 ? 1024 : offsets_capacity * 2;
+            size_t *grown = realloc(offsets, capacity * sizeof(*offsets));
+            if (grown == NULL) {
+                perror("history: realloc() failed");
+                return -1;
+            }
+            offsets = grown;
+            offsets_capacity = capacity;
+        }
+        offsets[entry_count++] = indexed;
+        indexed += record_size(header.length);
+    }
+    return 0;
+}
+
+/**
+ * Returns the text of an entry, which is not NUL-terminated.
+ *
+ * @param number: The number of the entry, from 1
+ * @param length: Receives the length of the text
+ * @return: The text
+ */
+static const char *entry_text(size_t number, size_t *length) {
+    struct history_record header;
+    const char *record = history_map + offsets[number - 1];
+
+    memcpy(&header, record, sizeof(header));
+    *length = header.length;
+    return record + sizeof(header);
+}
+
+/**
+ * Appends a line to the history file as one record.
+ *
+ * @param line: The line
+ * @param length: The length of the line
+ */
+static void history_append(const char *line, size_t length) {
+    struct history_record header = {HISTORY_MAGIC, length};
+    size_t size = record_size(length);
+
+    if (history_fd == -1) {
+        return;
+    }
+    char *record = calloc(1, size);
+    if (record == NULL) {
+        perror("history: calloc() failed");
+        return;
+    }
+    memcpy(record, &header, sizeof(header));
+    memcpy(record + sizeof(header), line, length);
+
+    // One write, so records from concurrent shells never interleave
+    if (write(history_fd, record, size) != (ssize_t)size) {
+        perror("history: write() failed");
+    }
+    free(record);
+}
+
+/**
+ * Finds the newest entry starting with a prefix, or containing a text.
+ *
+ * @param text: The prefix or text
+ * @param length: Its length
+ * @param anywhere: Search for the text anywhere in the entry
+ * @return: The number of the entry, or 0 if there is none
+ */
+static size_t find_entry(const char *text, size_t length, bool anywhere) {
+    for (size_t number = entry_count; number > 0; number--) {
+        size_t entry_length;
+        const char *entry = entry_text(number, &entry_length);
+        if (anywhere ? memmem(entry, entry_length, text, length) != NULL :
+            entry_length >= length && memcmp(entry, text, length) == 0) {
+            return number;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Resolves the history event after a !.
+ *
+ * @param event: The first character after the !
+ * @param end: Receives the first character after the event
+ * @return: The number of the entry, 0 if there is no such entry, or -1
+ *     if the ! does not start an event
+ */
+static long resolve_event(const char *event, const char **end) {
+    const char *p = event;
+
+    if (*p == '!') {
+        *end = p + 1;
+        return entry_count;
+    }
+    if ((*p >= '0' && *p <= '9') || (*p == '-' && p[1] >= '0' && p[1] <= '9')) {
+        long number = strtol(p, (char **)end, 10);
+        if (number < 0) {
+            number += (long)entry_count + 1;
+        }
+        return number > 0 && (size_t)number <= entry_count ? number : 0;
+    }
+    if (*p == '?') {
+        // !?text? searches anywhere in the entries
+        const char *close = strchr(p + 1, '?');
+        size_t length = close != NULL ? (size_t)(close - p - 1) : strlen(p + 1);
+        *end = p + 1 + length + (close != NULL);
+        return find_entry(p + 1, length, true);
+    }
+    if (*p == '\0' || *p == ' ' || *p == '\t' || *p == '=' || *p == '(') {
+        return -1;
+    }
+    size_t length = strcspn(p, " \t");
+    *end = p + length;
+    return find_entry(p, length, false);
+}
+
+/**
+ * Expands the history events of an interactive line and records it.
+ * Used as the line hook of the reader. The expanded line is echoed.
+ *
+ * @param context: Unused
+ * @param line: The line, stored in the arena
+ * @param arena: The arena of the line
+ * @return: The expanded line, or NULL if an event is not found
+ */
+char *history_expand_line(void *context, char *line, struct arena *arena) {
+    (void)context;
+    const char *bang = strchr(line, '!');
+    char *result = line;
+
+    if (bang != NULL && history_sync() == 0) {
+        const char *text = line;
+        size_t used = 0;
+        bool changed = false;
+
+        result = NULL;
+        do {
+            const char *end;
+            long number = resolve_event(bang + 1, &end);
+            if (number == 0) {
+                fprintf(stderr, "smallsh: %.*s: event not found\n",
+                        (int)(end - bang), bang);
+                fflush(stderr);
+                return NULL;
+            }
+
+            // Copy the text before the event, then the entry itself
+            size_t before = number < 0 ? (size_t)(bang + 1 - text) :
+                (size_t)(bang - text);
+            size_t entry_length = 0;
+            const char *entry = number < 0 ? "" : entry_text(number, &entry_length);
+            char *grown = arena_grow(arena, result, used,
+                                     used + before + entry_length + 1);
+            if (grown == NULL) {
+                return NULL;
+            }
+            result = grown;
+            memcpy(result + used, text, before);
+            memcpy(result + used + before, entry, entry_length);
+            used += before + entry_length;
+            text = number < 0 ? bang + 1 : end;
+            changed |= number > 0;
+        } while ((bang = strchr(text, '!')) != NULL);
+
+        size_t rest = strlen(text);
+        char *grown = arena_grow(arena, result, used, used + rest + 1);
+        if (grown == NULL) {
+            return NULL;
+        }
+        result = grown;
+        memcpy(result + used, text, rest + 1);
+
+        if (changed) {
+            printf("%s\n", result);
+            fflush(stdout);
+        }
+    }
+
+    // Blank lines are not recorded
+    if (result[strspn(result, " \t")] != '\0') {
+        history_append(result, strlen(result));
+    }
+    return result;
+}
+
+/**
+ * Implements the history builtin: no argument lists every entry, a
+ * number lists the most recent ones and -s lists the entries containing
+ * a text.
+ *
+ * @param argc: The number of arguments
+ * @param argv: The arguments
+ * @return: 0 on success, 1 on failure
+ */
+int history_command(int argc, char **argv) {
+    size_t first = 1;
+    const char *search = NULL;
+
+    if (history_sync() == -1) {
+        return 1;
+    }
+    if (argc == 3 && strcmp(argv[1], "-s") == 0) {
+        search = argv[2];
+    } else if (argc == 2 && argv[1][0] >= '0' && argv[1][0] <= '9') {
+        size_t last = strtoul(argv[1], NULL, 10);
+        first = last < entry_count ? entry_count - last + 1 : 1;
+    } else if (argc != 1) {
+        fprintf(stderr, "usage: history [count | -s text]\n");
+        fflush(stderr);
+        return 1;
+    }
+
+    size_t search_length = search != NULL ? strlen(search) : 0;
+    for (size_t number = first; number <= entry_count; number++) {
+        size_t length;
+        const char *entry = entry_text(number, &length);
+        if (search == NULL || memmem(entry, length, search, search_length) != NULL) {
+            printf("%5zu  %.*s\n", number, (int)length, entry);
+        }
+    }
+    fflush(stdout);
+    return 0;
+}
+
+/**
+ * Releases the history file, its mapping and its index.
+ */
+void history_close(void) {
+    if (history_map != NULL) {
+        munmap(history_map, map_length);
+    }
+    if (history_fd != -1) {
+        close(history_fd);
+    }
+    free(offsets);
+    history_fd = -1;
+    history_map = NULL;
+    map_length = 0;
+    offsets = NULL;
+    entry_count = 0;
+    offsets_capacity = 0;
+    indexed = 0;
+}
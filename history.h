@@ -0,0 +1,16 @@
+/**
+ * history.h - Persistent command history
+ */
+
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include "arena.h"
+
+/* Function declarations */
+void history_open(void);
+char *history_expand_line(void *context, char *line, struct arena *arena);
+int history_command(int argc, char **argv);
+void history_close(void);
+
+#endif /* HISTORY_H */
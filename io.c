@@ -2,21 +2,120 @@
  * io.c - Input/output redirection implementation
  */
 
+#include <errno.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <sys/mman.h>
 #include "io.h"
 
+/**
+ * Writes a whole buffer to a descriptor.
+ *
+ * @param fd: The descriptor
+ * @param data: The bytes to write
+ * @param length: The number of bytes
+ * @return: 0 on success, -1 on failure with errno set
+ */
+static int write_all(int fd, const char *data, size_t length) {
+    while (length > 0) {
+        ssize_t count = write(fd, data, length);
+        if (count == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        data += count;
+        length -= count;
+    }
+    return 0;
+}
+
+/**
+ * Creates a descriptor to read a here-document or here-string from. A
+ * body that fits in a pipe without blocking is written to a pipe, a
+ * larger one to a memfd, so nothing ever touches the disk. Only
+ * async-signal-safe calls are used so this is safe in a vfork child.
+ *
+ * @param text: The body
+ * @param length: The length of the body
+ * @return: The descriptor, positioned at the start of the body, or -1
+ *     on failure with errno set
+ */
+int open_here_document(const char *text, size_t length) {
+    int fds[2];
+
+    if (length <= PIPE_BUF) {
+        if (pipe2(fds, O_CLOEXEC) == -1) {
+            return -1;
+        }
+        if (write_all(fds[1], text, length) == -1) {
+            int saved_errno = errno;
+            close(fds[0]);
+            close(fds[1]);
+            errno = saved_errno;
+            return -1;
+        }
+        close(fds[1]);
+        return fds[0];
+    }
+
+    int fd = memfd_create("smallsh-here-document", MFD_CLOEXEC);
+    if (fd == -1) {
+        return -1;
+    }
+    if (write_all(fd, text, length) == -1 ||
+        lseek(fd, 0, SEEK_SET) == -1) {
+        int saved_errno = errno;
+        close(fd);
+        errno = saved_errno;
+        return -1;
+    }
+    return fd;
+}
+
 /**
  * Redirects input and output for the command
  *
  * @param command: A pointer to the command_line structure
  * @param exit_status: A pointer to an integer to store the exit status
- * @param is_bg: A flag indicating if the command is a background process
+ * @param null_input: A flag indicating if standard input should come
+ *     from /dev/null when no input file is given (background processes)
+ * @param null_output: A flag indicating if standard output should go
+ *     to /dev/null when no output file is given (background processes)
  * @return: 0 on success, -1 on failure
  */
-int redirect(struct command_line *command, int *exit_status, bool is_bg) {
+int redirect(
+    struct command_line *command,
+    int *exit_status,
+    bool null_input,
+    bool null_output
+) {
+    // Feed a here-document or here-string from memory
+    if (command->here_text != NULL) {
+        int here_fd = open_here_document(
+            command->here_text,
+            command->here_length
+        );
+        if (here_fd == -1) {
+            perror("cannot create here-document");
+            *exit_status = EXIT_FAILURE;
+            return -1;
+        }
+
+        // Redirect standard input to the here-document
+        if (dup2(here_fd, 0) == -1) {
+            perror("here-document dup2()");
+            close(here_fd);
+            *exit_status = EXIT_FAILURE;
+            return -1;
+        }
+        close(here_fd);
+    }
+
     // Redirect input
     if (command->input_file != NULL) {
         // Open the input file for reading
@@ -38,7 +137,7 @@ int redirect(struct command_line *command, int *exit_status, bool is_bg) {
 
         // Close the input file descriptor
         close(input_fd);
-    } else if (is_bg) {
+    } else if (null_input && command->here_text == NULL) {
         // If it's a background process and no input file is specified,
         // redirect standard input to /dev/null
         int null_fd = open("/dev/null", O_RDONLY);
@@ -85,7 +184,7 @@ int redirect(struct command_line *command, int *exit_status, bool is_bg) {
 
         // Close the output file descriptor
         close(output_fd);
-    } else if (is_bg) {
+    } else if (null_output) {
         // If it's a background process and no output file is specified,
         // redirect standard output to /dev/null
         int null_fd = open("/dev/null", O_WRONLY);
@@ -108,3 +207,64 @@ int redirect(struct command_line *command, int *exit_status, bool is_bg) {
     }
     return 0;
 }
+
+/**
+ * Applies the redirections of a builtin to the shell itself. The
+ * standard descriptors that get replaced are saved first so that
+ * restore_redirect() can put them back afterwards.
+ *
+ * @param command: A pointer to the command_line structure
+ * @param exit_status: A pointer to an integer to store the exit status
+ * @param saved: Receives copies of standard input and output, or -1
+ *     for a descriptor that was not redirected
+ * @return: 0 on success, -1 on failure with nothing left redirected
+ */
+int redirect_saved(struct command_line *command, int *exit_status, int saved[2]) {
+    saved[0] = -1;
+    saved[1] = -1;
+
+    // Save the descriptors above the range the shell uses for pipes
+    if (command->input_file != NULL || command->here_text != NULL) {
+        saved[0] = fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 10);
+        if (saved[0] == -1) {
+            perror("cannot save standard input");
+            *exit_status = EXIT_FAILURE;
+            return -1;
+        }
+    }
+    if (command->output_file != NULL) {
+        saved[1] = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 10);
+        if (saved[1] == -1) {
+            perror("cannot save standard output");
+            restore_redirect(saved);
+            *exit_status = EXIT_FAILURE;
+            return -1;
+        }
+    }
+
+    if (redirect(command, exit_status, false, false) != 0) {
+        restore_redirect(saved);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Puts back the standard descriptors saved by redirect_saved().
+ *
+ * @param saved: The saved descriptors, reset to -1
+ */
+void restore_redirect(int saved[2]) {
+    // Output buffered for the redirected descriptor goes there
+    fflush(stdout);
+
+    for (int fd = 0; fd < 2; fd++) {
+        if (saved[fd] != -1) {
+            if (dup2(saved[fd], fd) == -1) {
+                perror("cannot restore redirected descriptor");
+            }
+            close(saved[fd]);
+            saved[fd] = -1;
+        }
+    }
+}
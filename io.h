@@ -6,9 +6,19 @@
 #define IO_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include "parser.h"
 
 /* Function declarations */
-int redirect(struct command_line *command, int *exit_status, bool is_bg);
+int redirect(
+    struct command_line *command,
+    int *exit_status,
+    bool null_input,
+    bool null_output
+);
+
+int open_here_document(const char *text, size_t length);
+int redirect_saved(struct command_line *command, int *exit_status, int saved[2]);
+void restore_redirect(int saved[2]);
 
 #endif /* IO_H */
@@ -0,0 +1,847 @@
+/**
+ * jobs.c - Background job table and job control builtins
+ *
+ * Jobs live in slabs of JOB_SLAB_SIZE entries that are recycled through
+ * a free list, so starting a job normally does not allocate. Every pid
+ * of a job is entered in an open-addressed pid -> job index, which makes
+ * reaping an exit O(1) no matter how many jobs are running. Active jobs
+ * are also kept in a doubly linked list in start order for listing.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include "jobs.h"
+#include "commands.h"
+#include "telemetry.h"
+
+#define PID_INDEX_INITIAL_SIZE 64
+#define DEFAULT_KILL_GRACE_MS 1000
+
+/**
+ * Initializes an empty job table.
+ *
+ * @param table: A pointer to the job table
+ */
+void jobs_init(struct job_table *table) {
+    memset(table, 0, sizeof(*table));
+}
+
+/**
+ * Hashes a pid for the index.
+ *
+ * @param table: A pointer to the job table
+ * @param pid: The process ID
+ * @return: The home slot of the pid
+ */
+static size_t pid_home(const struct job_table *table, pid_t pid) {
+    return ((size_t)pid * 2654435761u) & (table->index_size - 1);
+}
+
+/**
+ * Finds the index slot of a pid, or the empty slot where it belongs.
+ *
+ * @param table: A pointer to the job table
+ * @param pid: The process ID
+ * @return: Index of the slot
+ */
+static size_t find_pid_slot(const struct job_table *table, pid_t pid) {
+    size_t mask = table->index_size - 1;
+    size_t i = pid_home(table, pid);
+
+    while (table->pid_index[i].pid != 0 && table->pid_index[i].pid != pid) {
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+/**
+ * Adds a pid to the index, growing it to keep the load at most one half.
+ *
+ * @param table: A pointer to the job table
+ * @param pid: The process ID
+ * @param job: The job the process belongs to
+ * @return: 0 on success, -1 on failure
+ */
+static int index_pid(struct job_table *table, pid_t pid, struct job *job) {
+    if ((table->index_count + 1) * 2 > table->index_size) {
+        struct job_pid_slot *old_index = table->pid_index;
+        size_t old_size = table->index_size;
+        size_t new_size = old_size == 0 ? PID_INDEX_INITIAL_SIZE : old_size * 2;
+
+        struct job_pid_slot *new_index = calloc(new_size, sizeof(*new_index));
+        if (new_index == NULL) {
+            perror("Memory allocation for job index failed");
+            return -1;
+        }
+        table->pid_index = new_index;
+        table->index_size = new_size;
+        for (size_t i = 0; i < old_size; i++) {
+            if (old_index[i].pid != 0) {
+                new_index[find_pid_slot(table, old_index[i].pid)] = old_index[i];
+            }
+        }
+        free(old_index);
+    }
+
+    size_t slot = find_pid_slot(table, pid);
+    table->pid_index[slot].pid = pid;
+    table->pid_index[slot].job = job;
+    table->index_count++;
+    return 0;
+}
+
+/**
+ * Looks up the job a pid belongs to.
+ *
+ * @param table: A pointer to the job table
+ * @param pid: The process ID
+ * @return: The job, or NULL if the pid is not part of a job
+ */
+static struct job *lookup_pid(const struct job_table *table, pid_t pid) {
+    if (table->index_size == 0) {
+        return NULL;
+    }
+    return table->pid_index[find_pid_slot(table, pid)].job;
+}
+
+/**
+ * Removes a pid from the index.
+ *
+ * @param table: A pointer to the job table
+ * @param pid: The process ID
+ */
+static void unindex_pid(struct job_table *table, pid_t pid) {
+    size_t mask = table->index_size - 1;
+    size_t slot = find_pid_slot(table, pid);
+
+    if (table->pid_index[slot].pid == 0) {
+        return;
+    }
+    table->pid_index[slot].pid = 0;
+    table->pid_index[slot].job = NULL;
+    table->index_count--;
+
+    // Shift later members of the probe run back into the hole
+    size_t i = (slot + 1) & mask;
+    while (table->pid_index[i].pid != 0) {
+        size_t home = pid_home(table, table->pid_index[i].pid);
+        if (((i - home) & mask) >= ((i - slot) & mask)) {
+            table->pid_index[slot] = table->pid_index[i];
+            table->pid_index[i].pid = 0;
+            table->pid_index[i].job = NULL;
+            slot = i;
+        }
+        i = (i + 1) & mask;
+    }
+}
+
+/**
+ * Takes an entry from the free list, adding a slab if it is empty.
+ *
+ * @param table: A pointer to the job table
+ * @return: An unused job entry, or NULL on failure
+ */
+static struct job *allocate_job(struct job_table *table) {
+    if (table->free_list == NULL) {
+        struct job **new_slabs = realloc(
+            table->slabs,
+            (table->slab_count + 1) * sizeof(struct job *)
+        );
+        if (new_slabs == NULL) {
+            perror("Memory allocation for job table failed");
+            return NULL;
+        }
+        table->slabs = new_slabs;
+
+        struct job *slab = calloc(JOB_SLAB_SIZE, sizeof(struct job));
+        if (slab == NULL) {
+            perror("Memory allocation for job slab failed");
+            return NULL;
+        }
+        table->slabs[table->slab_count] = slab;
+
+        // Thread the new entries so the lowest job number is used first
+        for (int i = JOB_SLAB_SIZE - 1; i >= 0; i--) {
+            slab[i].id = table->slab_count * JOB_SLAB_SIZE + i + 1;
+            slab[i].next = table->free_list;
+            table->free_list = &slab[i];
+        }
+        table->slab_count++;
+    }
+
+    struct job *job = table->free_list;
+    table->free_list = job->next;
+    return job;
+}
+
+/**
+ * Adds a started background job to the table.
+ *
+ * @param table: A pointer to the job table
+ * @param pgid: The process group of the job
+ * @param pids: The processes of the job, the last one decides its status
+ * @param pid_count: The number of processes
+ * @param command_text: The command line, shortened if needed
+ * @return: The new job, or NULL on failure
+ */
+struct job *jobs_add(
+    struct job_table *table,
+    pid_t pgid,
+    const pid_t *pids,
+    int pid_count,
+    const char *command_text
+) {
+    struct job *job = allocate_job(table);
+    if (job == NULL) {
+        return NULL;
+    }
+
+    job->pgid = pgid;
+    job->pid = pids[pid_count - 1];
+    job->process_count = 0;
+    job->status = 0;
+    job->state = JOB_RUNNING;
+    job->is_timed = false;
+    job->telemetry_seq = 0;
+    usage_start(&job->usage);
+    snprintf(job->command_text, sizeof(job->command_text), "%s", command_text);
+
+    for (int i = 0; i < pid_count; i++) {
+        if (index_pid(table, pids[i], job) == -1) {
+            // Undo the pids already added and give the entry back
+            while (--i >= 0) {
+                unindex_pid(table, pids[i]);
+            }
+            job->process_count = 0;
+            job->next = table->free_list;
+            table->free_list = job;
+            return NULL;
+        }
+        job->process_count++;
+    }
+
+    // Append to the list of active jobs
+    job->prev = table->last;
+    job->next = NULL;
+    if (table->last != NULL) {
+        table->last->next = job;
+    } else {
+        table->first = job;
+    }
+    table->last = job;
+    table->job_count++;
+    return job;
+}
+
+/**
+ * Removes a finished job from the table and recycles its entry.
+ *
+ * @param table: A pointer to the job table
+ * @param job: The job to remove
+ */
+static void remove_job(struct job_table *table, struct job *job) {
+    if (job->prev != NULL) {
+        job->prev->next = job->next;
+    } else {
+        table->first = job->next;
+    }
+    if (job->next != NULL) {
+        job->next->prev = job->prev;
+    } else {
+        table->last = job->prev;
+    }
+
+    if (job->state == JOB_STOPPED) {
+        table->stopped_count--;
+    }
+    job->process_count = 0;
+    job->prev = NULL;
+    job->next = table->free_list;
+    table->free_list = job;
+    table->job_count--;
+}
+
+/**
+ * Records a wait status collected for a pid.
+ *
+ * @param table: A pointer to the job table
+ * @param pid: The process the status belongs to
+ * @param child_status: The status returned by wait4()
+ * @param rusage: The rusage returned by wait4(), or NULL
+ * @return: true if the pid belongs to a job, false otherwise
+ */
+bool jobs_record_status(
+    struct job_table *table,
+    pid_t pid,
+    int child_status,
+    const struct rusage *rusage
+) {
+    struct job *job = lookup_pid(table, pid);
+    if (job == NULL) {
+        return false;
+    }
+
+    if (WIFSTOPPED(child_status)) {
+        if (job->state == JOB_RUNNING) {
+            table->stopped_count++;
+        }
+        job->state = JOB_STOPPED;
+    } else if (WIFCONTINUED(child_status)) {
+        if (job->state == JOB_STOPPED) {
+            table->stopped_count--;
+        }
+        job->state = JOB_RUNNING;
+    } else {
+        // The process is gone
+        unindex_pid(table, pid);
+        usage_add(&job->usage, rusage);
+        job->process_count--;
+        if (pid == job->pid) {
+            job->status = child_status;
+        }
+        if (job->process_count == 0) {
+            usage_finish(&job->usage);
+        }
+    }
+    return true;
+}
+
+/**
+ * Prints the completion message of a finished job and removes it.
+ *
+ * @param table: A pointer to the job table
+ * @param job: The finished job
+ */
+static void report_done(struct job_table *table, struct job *job) {
+    // Check if the process was terminated by a signal
+    if (WIFSIGNALED(job->status)) {
+        printf("background pid %d is done: terminated by signal %d\n",
+                job->pid, WTERMSIG(job->status));
+    } else {
+        printf("background pid %d is done: exit value %d\n",
+                job->pid, WEXITSTATUS(job->status));
+    }
+    fflush(stdout);
+    if (job->is_timed) {
+        usage_print(&job->usage);
+    }
+    telemetry_reaped(job->telemetry_seq, WIFSIGNALED(job->status) ?
+                     128 + WTERMSIG(job->status) : WEXITSTATUS(job->status));
+    remove_job(table, job);
+}
+
+/**
+ * Records a status collected by a caller's own wait4() and reports the
+ * job if that was its last process.
+ *
+ * @param table: A pointer to the job table
+ * @param pid: The process that changed state
+ * @param child_status: The wait status of the process
+ * @param rusage: The rusage of the process, or NULL
+ * @return: true if the process belongs to a job, false otherwise
+ */
+bool jobs_report_status(
+    struct job_table *table,
+    pid_t pid,
+    int child_status,
+    const struct rusage *rusage
+) {
+    struct job *job = lookup_pid(table, pid);
+
+    if (!jobs_record_status(table, pid, child_status, rusage)) {
+        return false;
+    }
+    if (job->process_count == 0) {
+        report_done(table, job);
+    }
+    return true;
+}
+
+/**
+ * Check for completed background processes. Every child that has
+ * changed state is collected with wait4(-1) and found through the pid
+ * index, so the cost is one call per event rather than one per job.
+ *
+ * @param table: A pointer to the job table
+ * @return: The number of jobs reported as done
+ */
+int check_bg_processes(struct job_table *table) {
+    int child_status;
+    struct rusage rusage;
+    int reported = 0;
+    pid_t pid;
+
+    while ((pid = wait4(-1, &child_status,
+                        WNOHANG | WUNTRACED | WCONTINUED, &rusage)) > 0) {
+        struct job *job = lookup_pid(table, pid);
+        if (!jobs_record_status(table, pid, child_status, &rusage)) {
+            continue; // Not a background process
+        }
+        if (job->process_count == 0) {
+            report_done(table, job);
+            reported++;
+        }
+    }
+    if (pid == -1 && errno != ECHILD) {
+        perror("wait4() failed");
+    }
+    return reported;
+}
+
+/**
+ * Finds the job named by a job control argument.
+ *
+ * @param table: A pointer to the job table
+ * @param spec: "%n" for job n, "%%" or "%+" or NULL for the most recent
+ *     job, or the pid of any process in the job
+ * @return: The job, or NULL if there is no such job
+ */
+static struct job *find_job(struct job_table *table, const char *spec) {
+    char *end;
+
+    if (spec == NULL || strcmp(spec, "%%") == 0 || strcmp(spec, "%+") == 0) {
+        return table->last;
+    }
+
+    if (spec[0] == '%') {
+        long id = strtol(spec + 1, &end, 10);
+        if (*end != '\0' || id < 1 ||
+            id > (long)table->slab_count * JOB_SLAB_SIZE) {
+            return NULL;
+        }
+        struct job *job = &table->slabs[(id - 1) / JOB_SLAB_SIZE]
+                                       [(id - 1) % JOB_SLAB_SIZE];
+        return job->process_count > 0 ? job : NULL;
+    }
+
+    long pid = strtol(spec, &end, 10);
+    if (*end != '\0' || pid <= 0) {
+        return NULL;
+    }
+    return lookup_pid(table, (pid_t)pid);
+}
+
+/**
+ * Waits until a job finishes or stops.
+ *
+ * @param table: A pointer to the job table
+ * @param job: The job to wait for
+ * @param stop: A flag indicating if a stopped job ends the wait
+ * @return: true if the job finished, false if it stopped or the wait
+ *     failed. A finished job stays in the table for the caller.
+ */
+static bool wait_for_job(struct job_table *table, struct job *job, bool stop) {
+    while (job->process_count > 0) {
+        int child_status;
+        struct rusage rusage;
+        pid_t pid = wait4(-job->pgid, &child_status, stop ? WUNTRACED : 0,
+                          &rusage);
+        if (pid == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("wait4() failed");
+            return false;
+        }
+        // A blocking wait notices the exit at once
+        telemetry_children_checked();
+        jobs_record_status(table, pid, child_status, &rusage);
+        if (job->state == JOB_STOPPED && job->process_count > 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Implements the jobs builtin, listing every background job.
+ *
+ * @param table: A pointer to the job table
+ * @param argc: The number of arguments passed to the command
+ * @param argv: The array of arguments passed to the command
+ * @return: 0 on success
+ */
+int jobs_command(struct job_table *table, int argc, char **argv) {
+    struct timespec now;
+    (void)argc;
+    (void)argv;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    for (struct job *job = table->first; job != NULL; job = job->next) {
+        double elapsed = (now.tv_sec - job->usage.start.tv_sec) +
+            (now.tv_nsec - job->usage.start.tv_nsec) / 1e9;
+        printf("[%d] %-7s %7d %9.1fs  %s\n",
+                job->id,
+                job->state == JOB_STOPPED ? "Stopped" : "Running",
+                job->pid,
+                elapsed,
+                job->command_text);
+    }
+    fflush(stdout);
+    return 0;
+}
+
+/**
+ * Implements the bg builtin, resuming a stopped job in the background.
+ *
+ * @param table: A pointer to the job table
+ * @param argc: The number of arguments passed to the command
+ * @param argv: The array of arguments passed to the command
+ * @return: 0 on success, 1 on failure
+ */
+int bg_command(struct job_table *table, int argc, char **argv) {
+    struct job *job = find_job(table, argc > 1 ? argv[1] : NULL);
+    if (job == NULL) {
+        fprintf(stderr, "bg: no such job\n");
+        fflush(stderr);
+        return 1;
+    }
+
+    if (job->state == JOB_STOPPED) {
+        if (kill(-job->pgid, SIGCONT) == -1) {
+            perror("bg: kill() failed");
+            return 1;
+        }
+        job->state = JOB_RUNNING;
+        table->stopped_count--;
+    }
+    printf("background pid is %d\n", job->pid);
+    fflush(stdout);
+    return 0;
+}
+
+/**
+ * Implements the fg builtin, waiting for a job as if it had been started
+ * in the foreground.
+ *
+ * @param table: A pointer to the job table
+ * @param argc: The number of arguments passed to the command
+ * @param argv: The array of arguments passed to the command
+ * @param exit_status: A pointer to the exit status of the last
+ *     foreground process
+ * @param was_terminated: A pointer to the terminated flag of the last
+ *     foreground process
+ * @param signal_number: A pointer to the terminating signal of the last
+ *     foreground process
+ * @return: 0 on success, 1 on failure
+ */
+int fg_command(
+    struct job_table *table,
+    int argc,
+    char **argv,
+    int *exit_status,
+    bool *was_terminated,
+    int *signal_number
+) {
+    struct job *job = find_job(table, argc > 1 ? argv[1] : NULL);
+    if (job == NULL) {
+        fprintf(stderr, "fg: no such job\n");
+        fflush(stderr);
+        return 1;
+    }
+
+    printf("%s\n", job->command_text);
+    fflush(stdout);
+
+    if (job->state == JOB_STOPPED) {
+        if (kill(-job->pgid, SIGCONT) == -1) {
+            perror("fg: kill() failed");
+            return 1;
+        }
+        job->state = JOB_RUNNING;
+        table->stopped_count--;
+    }
+
+    if (!wait_for_job(table, job, true)) {
+        if (job->state == JOB_STOPPED) {
+            printf("background pid %d is stopped\n", job->pid);
+            fflush(stdout);
+        }
+        return 1;
+    }
+
+    // The job now counts as the last foreground command
+    update_status(job->status, exit_status, was_terminated, signal_number);
+    if (*was_terminated) {
+        printf("terminated by signal %d\n", *signal_number);
+        fflush(stdout);
+    }
+    usage_record(&job->usage);
+    if (job->is_timed) {
+        usage_print(&job->usage);
+    }
+    remove_job(table, job);
+    return 0;
+}
+
+/**
+ * Implements the wait builtin. Without arguments it waits for every
+ * running job; with a pid or %job it waits for that job and takes its
+ * status as the last foreground status.
+ *
+ * @param table: A pointer to the job table
+ * @param argc: The number of arguments passed to the command
+ * @param argv: The array of arguments passed to the command
+ * @param exit_status: A pointer to the exit status of the last
+ *     foreground process
+ * @param was_terminated: A pointer to the terminated flag of the last
+ *     foreground process
+ * @param signal_number: A pointer to the terminating signal of the last
+ *     foreground process
+ * @return: 0 on success, 1 on failure
+ */
+int wait_command(
+    struct job_table *table,
+    int argc,
+    char **argv,
+    int *exit_status,
+    bool *was_terminated,
+    int *signal_number
+) {
+    if (argc == 1) {
+        // Collect exits until only stopped jobs (if any) remain
+        while (table->job_count > table->stopped_count) {
+            int child_status;
+            struct rusage rusage;
+            pid_t pid = wait4(-1, &child_status, WUNTRACED | WCONTINUED,
+                              &rusage);
+            if (pid == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                perror("wait4() failed");
+                return 1;
+            }
+            telemetry_children_checked();
+            jobs_report_status(table, pid, child_status, &rusage);
+        }
+        return 0;
+    }
+
+    int result = 0;
+    for (int i = 1; i < argc; i++) {
+        struct job *job = find_job(table, argv[i]);
+        if (job == NULL) {
+            fprintf(stderr, "wait: %s: no such job\n", argv[i]);
+            fflush(stderr);
+            result = 1;
+            continue;
+        }
+        if (!wait_for_job(table, job, false)) {
+            result = 1;
+            continue;
+        }
+        update_status(job->status, exit_status, was_terminated, signal_number);
+        usage_record(&job->usage);
+        report_done(table, job);
+    }
+    return result;
+}
+
+/**
+ * Returns the shutdown grace period from SMALLSH_KILL_GRACE_MS.
+ *
+ * @return: The number of milliseconds jobs get to exit after SIGTERM
+ */
+static long kill_grace_ms(void) {
+    const char *value = getenv("SMALLSH_KILL_GRACE_MS");
+    char *end;
+
+    if (value != NULL) {
+        long grace = strtol(value, &end, 10);
+        if (*end == '\0' && end != value && grace >= 0) {
+            return grace;
+        }
+    }
+    return DEFAULT_KILL_GRACE_MS;
+}
+
+/**
+ * Returns the milliseconds left until a deadline.
+ *
+ * @param deadline: The deadline on the CLOCK_MONOTONIC clock
+ * @return: The remaining time, 0 once the deadline has passed
+ */
+static long remaining_ms(const struct timespec *deadline) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    long remaining = (deadline->tv_sec - now.tv_sec) * 1000 +
+        (deadline->tv_nsec - now.tv_nsec) / 1000000;
+    return remaining > 0 ? remaining : 0;
+}
+
+/**
+ * Opens a pidfd that becomes readable when the process exits.
+ *
+ * @param pid: The process ID
+ * @return: The pidfd, or -1 if pidfds are not available
+ */
+static int open_pidfd(pid_t pid) {
+#ifdef SYS_pidfd_open
+    return syscall(SYS_pidfd_open, pid, 0);
+#else
+    (void)pid;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+/**
+ * Reaps every child that has already exited.
+ *
+ * @param table: A pointer to the job table
+ */
+static void reap_exited(struct job_table *table) {
+    int child_status;
+    pid_t pid;
+
+    while ((pid = waitpid(-1, &child_status, WNOHANG)) > 0) {
+        jobs_record_status(table, pid, child_status, NULL);
+    }
+}
+
+/**
+ * Clean up all background processes. Jobs get SIGTERM and up to
+ * SMALLSH_KILL_GRACE_MS milliseconds to exit; the wait ends as soon as
+ * the last process is gone, and only the jobs still alive afterwards
+ * get SIGKILL. Exits are watched through pidfds, or by polling when
+ * the kernel has no pidfd support.
+ *
+ * @param table: A pointer to the job table
+ */
+void cleanup_bg_processes(struct job_table *table) {
+    struct job *current;
+    struct timespec deadline;
+    pid_t *pids = NULL;
+    int *pidfds = NULL;
+    int pid_count = 0;
+    int epoll_fd = -1;
+
+    if (table->job_count > 0) {
+        pids = malloc(table->index_count * sizeof(pid_t));
+        pidfds = malloc(table->index_count * sizeof(int));
+        epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    }
+
+    // Watch every process through a pidfd before signalling it
+    if (pids != NULL && pidfds != NULL && epoll_fd != -1) {
+        for (size_t i = 0; i < table->index_size; i++) {
+            if (table->pid_index[i].pid == 0) {
+                continue;
+            }
+            struct epoll_event event = {0};
+            pids[pid_count] = table->pid_index[i].pid;
+            pidfds[pid_count] = open_pidfd(pids[pid_count]);
+            event.events = EPOLLIN;
+            event.data.u32 = pid_count;
+            if (pidfds[pid_count] == -1 ||
+                epoll_ctl(epoll_fd, EPOLL_CTL_ADD, pidfds[pid_count],
+                          &event) == -1) {
+                // Without a pidfd for every process, fall back to polling
+                for (int j = 0; j <= pid_count; j++) {
+                    if (pidfds[j] != -1) {
+                        close(pidfds[j]);
+                    }
+                }
+                close(epoll_fd);
+                epoll_fd = -1;
+                pid_count = 0;
+                break;
+            }
+            pid_count++;
+        }
+    }
+
+    // Terminate all active jobs
+    for (current = table->first; current != NULL; current = current->next) {
+        kill(-current->pgid, SIGTERM);
+        if (current->state == JOB_STOPPED) {
+            kill(-current->pgid, SIGCONT);
+        }
+    }
+
+    // Wait until every process is gone or the grace period runs out
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    long grace = kill_grace_ms();
+    deadline.tv_sec += grace / 1000;
+    deadline.tv_nsec += (grace % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+
+    reap_exited(table);
+    while (table->index_count > 0) {
+        long timeout = remaining_ms(&deadline);
+        if (timeout == 0) {
+            break;
+        }
+
+        if (epoll_fd != -1) {
+            struct epoll_event events[64];
+            int count = epoll_wait(epoll_fd, events, 64, (int)timeout);
+            for (int i = 0; i < count; i++) {
+                int index = events[i].data.u32;
+                int child_status;
+                if (waitpid(pids[index], &child_status, WNOHANG) > 0) {
+                    jobs_record_status(table, pids[index], child_status, NULL);
+                }
+                // Closing the pidfd also removes it from the epoll set
+                close(pidfds[index]);
+                pidfds[index] = -1;
+            }
+        } else {
+            struct timespec pause = {0, (timeout < 10 ? timeout : 10) * 1000000};
+            nanosleep(&pause, NULL);
+            reap_exited(table);
+        }
+    }
+
+    // Force kill the jobs that are still running
+    for (current = table->first; current != NULL; current = current->next) {
+        if (current->process_count > 0) {
+            kill(-current->pgid, SIGKILL);
+        }
+    }
+    while (table->index_count > 0) {
+        int child_status;
+        pid_t pid = waitpid(-1, &child_status, 0);
+        if (pid == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        jobs_record_status(table, pid, child_status, NULL);
+    }
+
+    // Clean up zombie processes
+    while (waitpid(-1, NULL, WNOHANG) > 0);
+
+    for (int i = 0; i < pid_count; i++) {
+        if (pidfds[i] != -1) {
+            close(pidfds[i]);
+        }
+    }
+    if (epoll_fd != -1) {
+        close(epoll_fd);
+    }
+    free(pids);
+    free(pidfds);
+
+    // Free the slabs and the index
+    for (int i = 0; i < table->slab_count; i++) {
+        free(table->slabs[i]);
+    }
+    free(table->slabs);
+    free(table->pid_index);
+    jobs_init(table);
+}
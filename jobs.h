@@ -0,0 +1,112 @@
+/**
+ * jobs.h - Background job table
+ */
+
+#ifndef JOBS_H
+#define JOBS_H
+
+#include <sys/types.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/resource.h>
+#include "usage.h"
+
+#define JOB_SLAB_SIZE 1024
+#define JOB_TEXT_LENGTH 80
+
+/**
+ * Lifecycle of a background job
+ */
+enum job_state {
+    JOB_RUNNING,
+    JOB_STOPPED
+};
+
+/**
+ * Structure for one background job (a command or a whole pipeline)
+ */
+struct job {
+    int id;                     // Job number, used as %id
+    pid_t pgid;                 // Process group shared by the job
+    pid_t pid;                  // Last stage, decides the job's status
+    int process_count;          // Processes not reaped yet, 0 if unused
+    int status;                 // Wait status of the last stage
+    enum job_state state;
+    bool is_timed;              // Report the usage when done
+    uint64_t telemetry_seq;     // Its telemetry record, 0 if none
+    struct command_usage usage; // Started with the job, summed as it is reaped
+    char command_text[JOB_TEXT_LENGTH];
+    struct job *prev;           // Neighbours in start order
+    struct job *next;           // Or the next free entry
+};
+
+/**
+ * Slot of the pid -> job index
+ */
+struct job_pid_slot {
+    pid_t pid;                  // 0 marks an empty slot
+    struct job *job;
+};
+
+/**
+ * Structure holding every background job. Entries come from slabs so
+ * starting a job does not allocate, and each pid is found through an
+ * open-addressed index.
+ */
+struct job_table {
+    struct job **slabs;
+    int slab_count;
+    struct job *free_list;
+    struct job *first;          // Oldest job
+    struct job *last;           // Most recent job
+    int job_count;
+    int stopped_count;
+    struct job_pid_slot *pid_index;
+    size_t index_size;          // Power of two
+    size_t index_count;
+};
+
+/* Function declarations */
+void jobs_init(struct job_table *table);
+struct job *jobs_add(
+    struct job_table *table,
+    pid_t pgid,
+    const pid_t *pids,
+    int pid_count,
+    const char *command_text
+);
+bool jobs_record_status(
+    struct job_table *table,
+    pid_t pid,
+    int child_status,
+    const struct rusage *rusage
+);
+bool jobs_report_status(
+    struct job_table *table,
+    pid_t pid,
+    int child_status,
+    const struct rusage *rusage
+);
+int check_bg_processes(struct job_table *table);
+void cleanup_bg_processes(struct job_table *table);
+
+int jobs_command(struct job_table *table, int argc, char **argv);
+int bg_command(struct job_table *table, int argc, char **argv);
+int fg_command(
+    struct job_table *table,
+    int argc,
+    char **argv,
+    int *exit_status,
+    bool *was_terminated,
+    int *signal_number
+);
+int wait_command(
+    struct job_table *table,
+    int argc,
+    char **argv,
+    int *exit_status,
+    bool *was_terminated,
+    int *signal_number
+);
+
+#endif /* JOBS_H */
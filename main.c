@@ -5,6 +5,14 @@
  * This program provides a simple shell interface that allows users to
  * execute commands, redirect input and output, and run commands in the
  * background.
+ *
+ * Usage: smallsh [-e] [-c commands | script | --serve socket]
+ *
+ * Without arguments commands are read from standard input, with a prompt
+ * when it is a terminal. -c runs the given commands and a script
+ * argument runs the named file; both run without a prompt. -e stops a
+ * non-interactive shell at the first failing foreground command.
+ * --serve runs the lines of every client connecting to a Unix socket.
  */
 
 /* Standard library includes */
@@ -13,43 +21,196 @@
 #include <stdbool.h>
 #include <string.h>
 #include <unistd.h>
+#include <getopt.h>
 
 /* Custom module includes */
 #include "parser.h"
+#include "reader.h"
+#include "arena.h"
 #include "commands.h"
 #include "signals.h"
-#include "bg_process.h"
+#include "jobs.h"
+#include "events.h"
+#include "expand.h"
+#include "history.h"
+#include "editor.h"
+#include "path_index.h"
+#include "script_cache.h"
+#include "zygote.h"
+#include "serve.h"
+#include "telemetry.h"
+
+/**
+ * Prints the command line usage to stderr.
+ *
+ * @param program: The name the shell was started as
+ */
+static void print_usage(const char *program) {
+	fprintf(stderr, "usage: %s [-e] [-c commands | script | --serve socket]\n",
+			program);
+}
 
 /**
  * Main function for the shell program.
  *
- * @return: EXIT_SUCCESS on success, EXIT_FAILURE on failure.
+ * @param argc: The number of command line arguments
+ * @param argv: The command line arguments
+ * @return: EXIT_SUCCESS on success, EXIT_FAILURE on failure. A
+ *     non-interactive shell returns the status of the last foreground
+ *     command instead.
  */
-int main() {
+int main(int argc, char *argv[]) {
 	struct command_line *curr_command;
+	struct reader input; // Source of command lines
+	struct arena line_arena; // Storage for the parsed line
+	struct script_cache cache = {0}; // Parsed lines of a script file
+	const char *command_string = NULL; // Commands given with -c
+	const char *serve_path = NULL; // Socket given with --serve
+	bool stop_on_error = false; // Flag for -e
+	int option;
 	int shell_status = 0; // Shell status code
 	int exit_status = EXIT_SUCCESS; // Last foreground exit status
 	int signal_number = 0; // Signal number for terminated processes
 	bool was_terminated = false; // Flag for terminated processes
 	bool foreground_only = false; // Flag for foreground-only mode
 
-	// Initialize background process list
-	struct bg_process_node *bg_processes_list = NULL;
+	// Parse command line options
+	static const struct option long_options[] = {
+		{"serve", required_argument, NULL, 's'},
+		{NULL, 0, NULL, 0}
+	};
+	while ((option = getopt_long(argc, argv, "ec:", long_options, NULL)) != -1) {
+		switch (option) {
+			case 'e':
+				stop_on_error = true;
+				break;
+			case 'c':
+				command_string = optarg;
+				break;
+			case 's':
+				serve_path = optarg;
+				break;
+			default:
+				print_usage(argv[0]);
+				return 2;
+		}
+	}
+	if (optind < argc - 1 || (command_string != NULL && optind < argc) ||
+		(serve_path != NULL && (command_string != NULL || optind < argc))) {
+		print_usage(argv[0]);
+		return 2;
+	}
+
+	// A server only returns in the worker of each client, with the
+	// descriptor to read the client's lines from
+	int input_fd = STDIN_FILENO;
+	if (serve_path != NULL && (input_fd = serve(serve_path)) == -1) {
+		return EXIT_FAILURE;
+	}
+
+	// Start the spawn helper while the shell is still small
+	zygote_start();
+
+	// Open the input source
+	if (command_string != NULL) {
+		reader_open_string(&input, command_string);
+	} else if (optind < argc) {
+		if (reader_open_file(&input, argv[optind]) == -1) {
+			return 127;
+		}
+	} else if (reader_open_fd(&input, input_fd, isatty(input_fd)) == -1) {
+		return EXIT_FAILURE;
+	}
+
+	// Scripts run from their cache when it is up to date, or fill it
+	if (command_string == NULL && optind < argc && input.is_mapped) {
+		script_cache_open(&cache, argv[optind]);
+	}
+
+	// Parsed lines are allocated from an arena that is reset per line
+	arena_init(&line_arena);
+
+	// Initialize the background job table
+	struct job_table jobs;
+	jobs_init(&jobs);
+
+	// $$ keeps the shell's process ID in subshells
+	expand_init();
 
 	// Set up signal handler for the shell
 	setup_signal_handlers(true, false, &foreground_only);
 
+	// Interactive lines go through history expansion into the history
+	if (input.interactive) {
+		history_open();
+		input.expand_line = history_expand_line;
+	}
+
+	// Report background completions while waiting for input
+	if (events_init(input.fd) == 0) {
+		input.wait_input = events_wait_input;
+		input.wait_context = &jobs;
+	}
+
+	// Terminals get line editing, with PATH indexed for completion
+	if (input.interactive && isatty(STDOUT_FILENO)) {
+		const char *term = getenv("TERM");
+		if (term == NULL || strcmp(term, "dumb") != 0) {
+			input.edit_line = editor_read_line;
+		}
+		int index_fd = path_index_init();
+		if (index_fd != -1) {
+			events_watch(index_fd, path_index_refresh);
+		}
+	}
+
 	while(shell_status == 0) { // Continue running while shell_status is 0
-	    // Check for completed background processes before each prompt
-	    check_bg_processes(&bg_processes_list);
+	    // Report background processes that finished since the last line
+	    events_poll(&jobs);
 
 		// Display prompt and get user input
-		curr_command = parse_input();
+		size_t line_count = input.line_count;
+		if (cache.replaying) {
+			uint64_t parse_start = telemetry_now();
+			curr_command = script_cache_next(&cache, &line_arena);
+			if (curr_command == NULL && cache.replaying) {
+				break;
+			}
+			if (curr_command == NULL) {
+				// A broken cache: parse the script after the last line run
+				input.position = cache.source_position;
+				continue;
+			}
+			telemetry_parsed(telemetry_now() - parse_start);
+		} else {
+			size_t position = input.position;
+			curr_command = parse_input(&input, &line_arena);
+			// Every line read is recorded, NULL if it did not parse
+			if (input.position != position) {
+				script_cache_record(&cache, curr_command, input.position);
+			}
+		}
 
-		// Handle parsing error or empty command
+		// Handle parsing error or empty command, stop at end of input
 		if (curr_command == NULL) {
-            continue;
-        }
+			arena_reset(&line_arena);
+			// End of input only if no line was read, a last line
+			// without a newline can still fail to parse
+			if (input.at_eof && input.line_count == line_count) {
+				if (input.interactive) {
+					printf("\n");
+				}
+				break;
+			}
+			// A line that does not parse fails like a command would
+			exit_status = SYNTAX_ERROR_STATUS;
+			was_terminated = false;
+			serve_line_done(exit_status);
+			if (stop_on_error && !input.interactive) {
+				break;
+			}
+			continue;
+		}
 
 		// Execute the command and get the shell status
 		shell_status = execute_command(
@@ -57,16 +218,40 @@ int main() {
 		    &exit_status,
 			&was_terminated,
 			&signal_number,
-		    &bg_processes_list,
+		    &jobs,
 			foreground_only
 		);
 
-		// Free allocated memory
-		free_command(curr_command);
+		// Release everything parsed from the line
+		arena_reset(&line_arena);
+		if (shell_status == 0) {
+			serve_line_done(was_terminated ? 128 + signal_number : exit_status);
+		}
+
+		// With -e a script stops at the first failing foreground command
+		if (stop_on_error && !input.interactive &&
+			(exit_status != EXIT_SUCCESS || was_terminated)) {
+			break;
+		}
 	}
 
 	// Free all background processes
-	cleanup_bg_processes(&bg_processes_list);
+	zygote_stop();
+	cleanup_bg_processes(&jobs);
+	telemetry_exit();
+	events_close();
+
+	// Scripts report the status of their last foreground command
+	if (!input.interactive) {
+		shell_status = was_terminated ? 128 + signal_number : exit_status;
+	} else {
+		shell_status = EXIT_SUCCESS;
+	}
+	// The cache is written only if the whole script was read
+	script_cache_close(&cache, input.position == input.length);
+	reader_close(&input);
+	arena_free(&line_arena);
+	history_close();
 
-	return EXIT_SUCCESS;
+	return shell_status;
 }
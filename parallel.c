@@ -0,0 +1,388 @@
+/**
+ * parallel.c - Built-in parallel job runner
+ *
+ * parallel [-j N] command [args] [::: items...] runs the command once per
+ * item with every {} replaced by the item, or with the item appended when
+ * the command has no {}. Items come from the arguments after ::: or, when
+ * there are none, one per line from standard input (or from the file
+ * named with <). Exactly N children run at a time and the next item is
+ * started as soon as one of them exits.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "parallel.h"
+#include "commands.h"
+#include "reader.h"
+#include "usage.h"
+
+/**
+ * State of one parallel run
+ */
+struct parallel_run {
+    char **template_argv;       // The command, with {} placeholders
+    int template_argc;
+    bool has_placeholder;
+    char **items;               // Items given after :::, or NULL
+    int item_count;
+    int next_item;
+    struct reader *item_input;  // Line source when items is NULL
+    pid_t *slots;               // Running children, 0 for a free slot
+    int slot_count;
+    int running;
+    int failures;
+    bool interrupted;           // A child was killed by SIGINT
+    struct command_usage usage; // Summed over every item
+};
+
+/**
+ * Returns the number of online processors, the default slot count.
+ *
+ * @return: The processor count, at least 1
+ */
+static int default_slot_count(void) {
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count < 1 ? 1 : (int)count;
+}
+
+/**
+ * Replaces every {} in a word with the item.
+ *
+ * @param word: The template word
+ * @param item: The current item
+ * @return: A newly allocated string, or NULL on failure
+ */
+static char *substitute(const char *word, const char *item) {
+    size_t item_length = strlen(item);
+    size_t length = 0;
+    const char *p;
+
+    for (p = word; *p != '\0'; p++) {
+        if (p[0] == '{' && p[1] == '}') {
+            length += item_length;
+            p++;
+        } else {
+            length++;
+        }
+    }
+
+    char *result = malloc(length + 1);
+    if (result == NULL) {
+        perror("Memory allocation for parallel failed");
+        return NULL;
+    }
+    char *out = result;
+    for (p = word; *p != '\0'; p++) {
+        if (p[0] == '{' && p[1] == '}') {
+            memcpy(out, item, item_length);
+            out += item_length;
+            p++;
+        } else {
+            *out++ = *p;
+        }
+    }
+    *out = '\0';
+    return result;
+}
+
+/**
+ * Takes the next item from the arguments or from the item input.
+ *
+ * @param run: The parallel run
+ * @return: The item, or NULL when there are no more items
+ */
+static const char *next_item(struct parallel_run *run) {
+    if (run->item_input == NULL) {
+        if (run->next_item == run->item_count) {
+            return NULL;
+        }
+        return run->items[run->next_item++];
+    }
+
+    size_t length;
+    char *line;
+    // Skip blank lines
+    while ((line = reader_next_line(run->item_input, &length)) != NULL) {
+        if (length > 0 && line[length - 1] == '\n') {
+            line[--length] = '\0';
+        }
+        if (length > 0) {
+            return line;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Starts the command for one item in a free slot.
+ *
+ * @param run: The parallel run
+ * @param item: The item to run the command for
+ * @param io: The descriptors handed to the child
+ * @param context: The shell context for the child
+ * @return: 0 on success, -1 if the child could not be started
+ */
+static int start_item(
+    struct parallel_run *run,
+    const char *item,
+    const struct spawn_io *io,
+    struct shell_context *context
+) {
+    struct command_line command = {0};
+    char *argv[run->template_argc + 2];
+    int result = -1;
+
+    // Build the command line for this item
+    command.argv = argv;
+    for (int i = 0; i < run->template_argc; i++) {
+        argv[i] = NULL;
+    }
+    for (int i = 0; i < run->template_argc; i++) {
+        argv[i] = substitute(run->template_argv[i], item);
+        if (argv[i] == NULL) {
+            goto out;
+        }
+    }
+    command.argc = run->template_argc;
+    if (!run->has_placeholder) {
+        argv[command.argc++] = (char *)item;
+    }
+    argv[command.argc] = NULL;
+    command.argv_capacity = run->template_argc + 2;
+
+    pid_t child_pid = start_process(&command, io, context);
+    if (child_pid != -1) {
+        for (int i = 0; i < run->slot_count; i++) {
+            if (run->slots[i] == 0) {
+                run->slots[i] = child_pid;
+                break;
+            }
+        }
+        run->running++;
+        result = 0;
+    }
+
+out:
+    // The child has its own copy of the arguments by now
+    for (int i = 0; i < run->template_argc; i++) {
+        free(argv[i]);
+    }
+    return result;
+}
+
+/**
+ * Waits for any child and frees its slot. Children that belong to
+ * background jobs are handed to the job table instead.
+ *
+ * @param run: The parallel run
+ * @param jobs: A pointer to the background job table
+ * @param exit_status: A pointer to the exit status of the last child
+ * @param was_terminated: A pointer to the termination flag of the last
+ *     child
+ * @param signal_number: A pointer to the signal of the last child
+ * @return: 0 on success, -1 if waiting failed
+ */
+static int collect_child(
+    struct parallel_run *run,
+    struct job_table *jobs,
+    int *exit_status,
+    bool *was_terminated,
+    int *signal_number
+) {
+    int child_status;
+    struct rusage rusage;
+    pid_t pid = wait4(-1, &child_status, 0, &rusage);
+
+    if (pid == -1) {
+        if (errno == EINTR) {
+            return 0;
+        }
+        perror("wait4() failed");
+        return -1;
+    }
+
+    int slot;
+    for (slot = 0; slot < run->slot_count; slot++) {
+        if (run->slots[slot] == pid) {
+            break;
+        }
+    }
+    if (slot == run->slot_count) {
+        // A background job finished meanwhile
+        jobs_report_status(jobs, pid, child_status, &rusage);
+        return 0;
+    }
+
+    run->slots[slot] = 0;
+    usage_add(&run->usage, &rusage);
+    run->running--;
+    update_status(child_status, exit_status, was_terminated, signal_number);
+    if (*was_terminated) {
+        printf("terminated by signal %d\n", *signal_number);
+        fflush(stdout);
+        if (*signal_number == SIGINT) {
+            run->interrupted = true;
+        }
+    }
+    if (*was_terminated || *exit_status != 0) {
+        run->failures++;
+    }
+    return 0;
+}
+
+/**
+ * Implements the parallel builtin.
+ *
+ * @param command: The parsed parallel command
+ * @param jobs: A pointer to the background job table
+ * @param exit_status: A pointer to an integer to store the number of
+ *     items that failed, at most 255
+ * @param was_terminated: A pointer to a boolean flag, always cleared
+ * @param signal_number: A pointer to the signal number of the last
+ *     child killed by a signal
+ * @return: 0 on success, 1 on a usage error or failure
+ */
+int parallel_command(
+    struct command_line *command,
+    struct job_table *jobs,
+    int *exit_status,
+    bool *was_terminated,
+    int *signal_number
+) {
+    struct parallel_run run = {0};
+    struct shell_context context = {
+        exit_status, was_terminated, signal_number, jobs, false
+    };
+    struct reader item_input;
+    int first = 1;
+    int result = 0;
+
+    // Parse -j N or -jN
+    run.slot_count = default_slot_count();
+    if (command->argc > 1 && strncmp(command->argv[1], "-j", 2) == 0) {
+        const char *value = command->argv[1][2] != '\0' ?
+            command->argv[1] + 2 : command->argv[2];
+        char *end = NULL;
+        long count = value == NULL ? 0 : strtol(value, &end, 10);
+        if (value == NULL || *end != '\0' || count < 1 || count > 65536) {
+            fprintf(stderr, "parallel: invalid job count\n");
+            fflush(stderr);
+            *exit_status = EXIT_FAILURE;
+            return 1;
+        }
+        run.slot_count = (int)count;
+        first = command->argv[1][2] != '\0' ? 2 : 3;
+    }
+
+    // The command runs up to :::, the items follow it
+    run.template_argv = command->argv + first;
+    while (first + run.template_argc < command->argc &&
+           strcmp(run.template_argv[run.template_argc], PARALLEL_ITEMS) != 0) {
+        run.template_argc++;
+    }
+    if (run.template_argc == 0) {
+        fprintf(stderr,
+                "usage: parallel [-j N] command [args] [::: items...]\n");
+        fflush(stderr);
+        *exit_status = EXIT_FAILURE;
+        return 1;
+    }
+    for (int i = 0; i < run.template_argc; i++) {
+        if (strstr(run.template_argv[i], "{}") != NULL) {
+            run.has_placeholder = true;
+        }
+    }
+
+    // Children read from /dev/null while the items come from input
+    struct spawn_io io = {-1, -1, -1};
+    int separator = first + run.template_argc;
+    if (separator < command->argc) {
+        run.items = command->argv + separator + 1;
+        run.item_count = command->argc - separator - 1;
+    } else {
+        int ret = command->input_file != NULL ?
+            reader_open_file(&item_input, command->input_file) :
+            reader_open_fd(&item_input, STDIN_FILENO, false);
+        if (ret == -1) {
+            *exit_status = EXIT_FAILURE;
+            return 1;
+        }
+        run.item_input = &item_input;
+        io.in_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    }
+
+    // Every child writes to the same output file
+    if (command->output_file != NULL) {
+        io.out_fd = open(command->output_file,
+                         O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (io.out_fd == -1) {
+            fprintf(stderr, "cannot open %s for output\n",
+                    command->output_file);
+            fflush(stderr);
+            result = 1;
+            goto out;
+        }
+    }
+
+    run.slots = calloc(run.slot_count, sizeof(pid_t));
+    if (run.slots == NULL) {
+        perror("Memory allocation for parallel failed");
+        result = 1;
+        goto out;
+    }
+
+    // Keep every slot busy until the items run out
+    usage_start(&run.usage);
+    const char *item = NULL;
+    bool items_left = true;
+    for (;;) {
+        while (items_left && !run.interrupted &&
+               run.running < run.slot_count) {
+            item = next_item(&run);
+            if (item == NULL) {
+                items_left = false;
+                break;
+            }
+            if (start_item(&run, item, &io, &context) == -1) {
+                run.failures++;
+            }
+        }
+        if (run.running == 0) {
+            break;
+        }
+        if (collect_child(&run, jobs, exit_status, was_terminated,
+                          signal_number) == -1) {
+            result = 1;
+            break;
+        }
+    }
+    usage_finish(&run.usage);
+    usage_record(&run.usage);
+    if (command->is_timed) {
+        usage_print(&run.usage);
+    }
+
+out:
+    free(run.slots);
+    if (io.in_fd != -1) {
+        close(io.in_fd);
+    }
+    if (io.out_fd != -1) {
+        close(io.out_fd);
+    }
+    if (run.item_input != NULL) {
+        reader_close(run.item_input);
+    }
+
+    // The status is the number of items that failed
+    *exit_status = result != 0 ? EXIT_FAILURE :
+        (run.failures > 255 ? 255 : run.failures);
+    *was_terminated = false;
+    return result;
+}
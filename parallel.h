@@ -0,0 +1,21 @@
+/**
+ * parallel.h - Built-in parallel job runner
+ */
+
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <stdbool.h>
+#include "parser.h"
+#include "jobs.h"
+
+/* Function declarations */
+int parallel_command(
+    struct command_line *command,
+    struct job_table *jobs,
+    int *exit_status,
+    bool *was_terminated,
+    int *signal_number
+);
+
+#endif /* PARALLEL_H */
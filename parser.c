@@ -6,69 +6,470 @@
 #include <stdlib.h>
 #include <string.h>
 #include "parser.h"
+#include "affinity.h"
+#include "telemetry.h"
+#include "tokenizer.h"
 
 /**
- * Parses the user input and returns a command_line structure.
+ * Allocates an empty pipeline stage from the arena.
  *
+ * @param arena: The arena of the current line
+ * @return: The new stage, or NULL on failure
+ */
+static struct command_line *new_stage(struct arena *arena) {
+    struct command_line *stage = arena_alloc(arena, sizeof(struct command_line));
+    if (stage == NULL) {
+        return NULL;
+    }
+    memset(stage, 0, sizeof(*stage));
+    stage->arena = arena;
+
+    stage->argv = arena_alloc(arena, INITIAL_ARGS * sizeof(char *));
+    if (stage->argv == NULL) {
+        return NULL;
+    }
+    stage->argv[0] = NULL;
+    stage->argv_capacity = INITIAL_ARGS;
+    return stage;
+}
+
+/**
+ * Appends an argument to a stage, doubling argv when it is full.
+ *
+ * @param arena: The arena of the current line
+ * @param stage: The stage to add the argument to
+ * @param argument: The argument, already stored in the arena
+ * @return: 0 on success, -1 on failure
+ */
+static int add_argument(
+    struct arena *arena,
+    struct command_line *stage,
+    char *argument
+) {
+    // Keep room for the terminating NULL
+    if (stage->argc + 1 == stage->argv_capacity) {
+        char **argv = arena_grow(
+            arena,
+            stage->argv,
+            stage->argv_capacity * sizeof(char *),
+            stage->argv_capacity * 2 * sizeof(char *)
+        );
+        if (argv == NULL) {
+            return -1;
+        }
+        stage->argv = argv;
+        stage->argv_capacity *= 2;
+    }
+    stage->argv[stage->argc++] = argument;
+    stage->argv[stage->argc] = NULL;
+    return 0;
+}
+
+/**
+ * Parses a cpus, nice or sched prefix and its argument into a stage.
+ *
+ * @param arena: The arena of the current line
+ * @param tokens: The tokenizer
+ * @param stage: The stage the prefix applies to
+ * @param keyword: The prefix
+ * @return: 0 on success, -1 after a syntax error message
+ */
+static int parse_prefix(
+    struct arena *arena,
+    struct tokenizer *tokens,
+    struct command_line *stage,
+    const char *keyword
+) {
+    char *word = tokenizer_next(tokens);
+    char *end = NULL;
+
+    // nice also takes the -n N form of nice(1)
+    if (word != NULL && !strcmp(keyword, NICE_CMD) && !strcmp(word, "-n")) {
+        word = tokenizer_next(tokens);
+    }
+    if (word == NULL) {
+        fprintf(stderr, "syntax error: missing argument after %s\n", keyword);
+        fflush(stderr);
+        return -1;
+    }
+
+    if (!strcmp(keyword, CPUS_CMD)) {
+        stage->cpus = arena_alloc(arena, sizeof(cpu_set_t));
+        if (stage->cpus == NULL) {
+            return -1;
+        }
+        if (affinity_parse_cpus(word, stage->cpus) == 0) {
+            return 0;
+        }
+    } else if (!strcmp(keyword, NICE_CMD)) {
+        stage->nice = strtol(word, &end, 10);
+        stage->has_nice = true;
+        if (end != word && *end == '\0') {
+            return 0;
+        }
+        // Without a number, nice(1) lowers the priority by 10
+        stage->nice = NICE_DEFAULT;
+        return add_argument(arena, stage, word);
+    } else {
+        stage->sched_policy = affinity_parse_policy(word);
+        stage->has_sched = true;
+        if (stage->sched_policy != -1) {
+            return 0;
+        }
+    }
+    fprintf(stderr, "%s: invalid argument `%s'\n", keyword, word);
+    fflush(stderr);
+    return -1;
+}
+
+/**
+ * Here-document whose body follows the command line
+ */
+struct pending_here {
+    struct command_line *stage;
+    const char *delimiter;
+    bool strip_tabs;                    // <<- removes leading tabs
+    struct pending_here *next;
+};
+
+/**
+ * Returns the word of a << or <<< operator, attached or as the next
+ * token.
+ *
+ * @param tokens: The tokenizer
+ * @param token: The operator token
+ * @param flag_length: The length of the operator
+ * @return: The word, or NULL after a syntax error message
+ */
+static char *operator_word(
+    struct tokenizer *tokens,
+    char *token,
+    size_t flag_length
+) {
+    char *word = token[flag_length] != '\0' ? token + flag_length :
+        tokenizer_next(tokens);
+    if (word == NULL) {
+        fprintf(stderr, "syntax error: missing word after %.*s\n",
+                (int)flag_length, token);
+        fflush(stderr);
+    }
+    return word;
+}
+
+/**
+ * Reads the body of a here-document, up to a line holding only the
+ * delimiter, into one arena allocation that grows in place.
+ *
+ * @param in: The reader the command line came from
+ * @param arena: The arena of the current line
+ * @param here: The here-document to read
+ * @return: 0 on success, -1 on failure
+ */
+static int read_here_document(
+    struct reader *in,
+    struct arena *arena,
+    struct pending_here *here
+) {
+    size_t delimiter_length = strlen(here->delimiter);
+    char *body = NULL;
+    size_t used = 0;
+    char *line;
+    size_t length;
+
+    for (;;) {
+        if (in->interactive) {
+            in->prompt = "> ";
+            printf("%s", in->prompt);
+            fflush(stdout);
+        }
+        line = reader_next_line(in, &length);
+        if (line == NULL) {
+            fprintf(stderr, "warning: here-document delimited by end of input "
+                    "(wanted `%s')\n", here->delimiter);
+            fflush(stderr);
+            break;
+        }
+        if (here->strip_tabs) {
+            while (length > 0 && *line == '\t') {
+                line++;
+                length--;
+            }
+        }
+
+        if (length == delimiter_length &&
+            memcmp(line, here->delimiter, delimiter_length) == 0) {
+            break;
+        }
+
+        // Only the body is allocated here, so it keeps growing in place
+        char *grown = arena_grow(arena, body, used, used + length + 2);
+        if (grown == NULL) {
+            return -1;
+        }
+        body = grown;
+        memcpy(body + used, line, length);
+        used += length;
+        body[used++] = '\n';
+        body[used] = '\0';
+    }
+
+    here->stage->input_file = NULL;
+    here->stage->here_text = body != NULL ? body : "";
+    here->stage->here_length = used;
+    return 0;
+}
+
+/**
+ * Reads the next line of input and returns a command_line structure.
+ * The line is copied into the arena once and tokenized in place, so the
+ * whole result is released by resetting the arena. The bodies of
+ * here-documents are read from the lines that follow. Pipelines joined
+ * by ;, &&, || or & are chained through list_next.
+ *
+ * @param in: The reader to take the line from
+ * @param arena: The arena to allocate the command from
  * @return: A pointer to the command_line structure containing the
- *     parsed input.
+ *     parsed input, or NULL on error or at end of input.
  */
-struct command_line *parse_input() {
-    char input[INPUT_LENGTH];
-    struct command_line *curr_command = (struct command_line *)calloc(
-       1, sizeof(struct command_line)
-    );
+struct command_line *parse_input(struct reader *in, struct arena *arena) {
+    char *input;
+    size_t input_length;
+    struct command_line *curr_command = new_stage(arena);
 
     if (curr_command == NULL) {
-        perror("Memory allocation for current command failed");
         return NULL;
     }
 
+    // Prompt only when a user is typing the commands
+    if (in->interactive) {
+        in->prompt = ": ";
+        printf("%s", in->prompt);
+        fflush(stdout);
+    }
+
     // Get input
-    printf(": ");
-    fflush(stdout);
-    fgets(input, INPUT_LENGTH, stdin);
+    input = reader_next_line(in, &input_length);
+    if (input == NULL) {
+        return NULL;
+    }
+    uint64_t parse_start = telemetry_now();
+    input = arena_strndup(arena, input, input_length);
+    if (input == NULL) {
+        return NULL;
+    }
+
+    // Let the owner of the reader rewrite the line, e.g. for history
+    if (in->expand_line != NULL) {
+        input = in->expand_line(in->expand_context, input, arena);
+        if (input == NULL) {
+            return NULL;
+        }
+        input_length = strlen(input);
+    }
 
-    // Tokenize the input
-    char *token = strtok(input, " \n");
+    // Tokenize the input, each '|' starts a new pipeline stage and each
+    // list operator a new pipeline
+    struct command_line *line = curr_command;
+    struct command_line *previous = NULL;
+    struct command_line *stage = curr_command;
+    struct pending_here *here_first = NULL;
+    struct pending_here **here_last = &here_first;
+    struct tokenizer tokens;
+    tokenizer_init(&tokens, input, input_length);
+    char *token = tokenizer_next(&tokens);
     while(token){
-        if(!strcmp(token,"<")){
-            curr_command->input_file = strdup(strtok(NULL," \n"));
-        } else if(!strcmp(token,">")){
-            curr_command->output_file = strdup(strtok(NULL," \n"));
-        } else if(!strcmp(token,"&")){
-            curr_command->is_bg = true;
-        } else{
-            curr_command->argv[curr_command->argc++] = strdup(token);
-        }
-        token=strtok(NULL," \n");
-    }
-    return curr_command;
+        if(!strncmp(token,HERE_STRING_FLAG,3)){
+            // Here-string: the word and a newline
+            char *word = operator_word(&tokens, token, 3);
+            if(word == NULL){
+                return NULL;
+            }
+            size_t length = strlen(word);
+            stage->here_text = arena_alloc(arena, length + 2);
+            if(stage->here_text == NULL){
+                return NULL;
+            }
+            memcpy(stage->here_text, word, length);
+            memcpy(stage->here_text + length, "\n", 2);
+            stage->here_length = length + 1;
+            stage->input_file = NULL;
+        } else if(!strncmp(token,HERE_DOC_FLAG,2)){
+            // Here-document: the body is read after the whole line
+            bool strip_tabs = token[2] == '-';
+            char *delimiter = operator_word(&tokens, token, strip_tabs ? 3 : 2);
+            struct pending_here *here = arena_alloc(arena, sizeof(*here));
+            if(delimiter == NULL || here == NULL){
+                return NULL;
+            }
+            here->stage = stage;
+            here->delimiter = delimiter;
+            here->strip_tabs = strip_tabs;
+            here->next = NULL;
+            *here_last = here;
+            here_last = &here->next;
+        } else if(!strcmp(token,"<") || !strcmp(token,">")){
+            char *file = tokenizer_next(&tokens);
+            if(file == NULL){
+                fprintf(stderr, "syntax error: missing file after %s\n", token);
+                fflush(stderr);
+                return NULL;
+            }
+            if(token[0] == '<'){
+                stage->input_file = file;
+                stage->here_text = NULL;
+            } else{
+                stage->output_file = file;
+            }
+        } else if(!strcmp(token,TIME_CMD) && stage == curr_command &&
+                  stage->argc == 0 && !curr_command->is_timed){
+            // time is a keyword only in front of the command
+            curr_command->is_timed = true;
+        } else if(stage->argc == 0 && (!strcmp(token,CPUS_CMD) ||
+                  !strcmp(token,NICE_CMD) || !strcmp(token,SCHED_CMD))){
+            // cpus, nice and sched prefix the command of a stage
+            if(parse_prefix(arena, &tokens, stage, token) == -1){
+                return NULL;
+            }
+        } else if(!strcmp(token,SEQUENCE_FLAG) || !strcmp(token,AND_FLAG) ||
+                  !strcmp(token,OR_FLAG) || !strcmp(token,BG_FLAG)){
+            // Each list operator ends a pipeline, & also backgrounds it
+            if(stage->argc == 0){
+                fprintf(stderr, "syntax error near unexpected token `%s'\n", token);
+                fflush(stderr);
+                return NULL;
+            }
+            curr_command->is_bg |= !strcmp(token,BG_FLAG);
+            curr_command->list_op = !strcmp(token,AND_FLAG) ? LIST_AND :
+                !strcmp(token,OR_FLAG) ? LIST_OR : LIST_SEQUENCE;
+            curr_command->list_next = new_stage(arena);
+            if(curr_command->list_next == NULL){
+                return NULL;
+            }
+            previous = curr_command;
+            curr_command = stage = curr_command->list_next;
+        } else if(token[0] == COMMENT_FLAG && stage->argc == 0){
+            // A comment runs to the end of the line
+            break;
+        } else if(!strcmp(token,PIPE_FLAG)){
+            stage->pipe_next = new_stage(arena);
+            if(stage->pipe_next == NULL){
+                return NULL;
+            }
+            stage = stage->pipe_next;
+        } else if(add_argument(arena, stage, token) == -1){
+            return NULL;
+        }
+        token=tokenizer_next(&tokens);
+    }
+
+    if(tokens.unterminated){
+        fprintf(stderr, "syntax error: unterminated %s\n", SUBST_START);
+        fflush(stderr);
+        return NULL;
+    }
+
+    // Here-document bodies follow the line in order, reading them is not
+    // part of the parse time
+    uint64_t here_start = telemetry_now();
+    for(struct pending_here *here = here_first; here != NULL; here = here->next){
+        if(read_here_document(in, arena, here) == -1){
+            return NULL;
+        }
+    }
+    parse_start += telemetry_now() - here_start;
+
+    // A trailing ; or & ends the line, && and || need another pipeline
+    if(previous != NULL && curr_command->argc == 0 &&
+       curr_command->pipe_next == NULL){
+        if(previous->list_op != LIST_SEQUENCE){
+            fprintf(stderr, "syntax error: missing command after %s\n",
+                    previous->list_op == LIST_AND ? AND_FLAG : OR_FLAG);
+            fflush(stderr);
+            return NULL;
+        }
+        previous->list_op = LIST_END;
+        previous->list_next = NULL;
+    }
+
+    // Every stage of a pipeline needs a command
+    for(curr_command = line; curr_command != NULL;
+        curr_command = curr_command->list_next){
+        if(curr_command->pipe_next == NULL){
+            continue;
+        }
+        for(stage = curr_command; stage != NULL; stage = stage->pipe_next){
+            if(stage->argc == 0){
+                fprintf(stderr, "syntax error near unexpected token `|'\n");
+                fflush(stderr);
+                return NULL;
+            }
+        }
+    }
+    telemetry_parsed(telemetry_now() - parse_start);
+    return line;
 }
 
 /**
- * Frees memory allocated for a command_line structure.
+ * Appends a string to a fixed-size buffer, marking truncation with "...".
  *
- * @param command: The command_line structure to free.
+ * @param buffer: The buffer to append to
+ * @param size: The size of the buffer
+ * @param used: A pointer to the number of characters already used
+ * @param text: The text to append
  */
-void free_command(struct command_line *command) {
-    if (command == NULL) {
+static void append_text(char *buffer, size_t size, size_t *used, const char *text) {
+    size_t length = strlen(text);
+
+    if (*used + length + 1 > size) {
+        // Not enough room, end the text with an ellipsis
+        if (size >= 4) {
+            strcpy(buffer + size - 4, "...");
+        }
+        *used = size;
         return;
     }
+    memcpy(buffer + *used, text, length + 1);
+    *used += length;
+}
+
+/**
+ * Rebuilds the text of a command line, e.g. for the job table.
+ *
+ * @param command: The first stage of the command line
+ * @param buffer: The buffer to write the text to
+ * @param size: The size of the buffer, the text is cut short to fit
+ */
+void format_command(struct command_line *command, char *buffer, size_t size) {
+    size_t used = 0;
 
-    // Free argument strings
-    for (int i = 0; i < command->argc; i++) {
-        free(command->argv[i]);
+    if (size == 0) {
+        return;
     }
+    buffer[0] = '\0';
 
-    // Free redirection filenames
-    if (command->input_file != NULL) {
-        free(command->input_file);
+    for (struct command_line *stage = command; stage != NULL && used < size;
+         stage = stage->pipe_next) {
+        if (stage != command) {
+            append_text(buffer, size, &used, " | ");
+        }
+        for (int i = 0; i < stage->argc; i++) {
+            if (i > 0) {
+                append_text(buffer, size, &used, " ");
+            }
+            append_text(buffer, size, &used, stage->argv[i]);
+        }
+        if (stage->input_file != NULL) {
+            append_text(buffer, size, &used, " < ");
+            append_text(buffer, size, &used, stage->input_file);
+        } else if (stage->here_text != NULL) {
+            append_text(buffer, size, &used, " <<...");
+        }
+        if (stage->output_file != NULL) {
+            append_text(buffer, size, &used, " > ");
+            append_text(buffer, size, &used, stage->output_file);
+        }
     }
-    if (command->output_file != NULL) {
-        free(command->output_file);
+    if (command->is_bg) {
+        append_text(buffer, size, &used, " &");
     }
-
-    // Free the command structure itself
-    free(command);
 }
@@ -5,19 +5,49 @@
 #ifndef PARSER_H
 #define PARSER_H
 
+#include <sched.h>
+#include <stddef.h>
 #include "common.h"
+#include "reader.h"
+#include "arena.h"
 
-/* Command line structure */
+#define INITIAL_ARGS 16
+#define HERE_DOC_FLAG "<<"
+#define HERE_STRING_FLAG "<<<"
+
+/* How the pipeline after a list operator runs */
+enum list_operator {
+    LIST_END,                           // Last pipeline of the line
+    LIST_SEQUENCE,                      // ; or &, always runs
+    LIST_AND,                           // &&, runs if this one succeeded
+    LIST_OR                             // ||, runs if this one failed
+};
+
+/* Command line structure, one per pipeline stage, allocated from the
+   arena of the line it was parsed from */
 struct command_line {
-    char *argv[MAX_ARGS + 1];
+    char **argv;                        // NULL-terminated, grown on demand
     int argc;
+    int argv_capacity;
     char *input_file;
+    char *here_text;                    // Here-document or here-string, or NULL
+    size_t here_length;
     char *output_file;
-    bool is_bg;
+    bool is_bg;                         // Set on the first stage only
+    bool is_timed;                      // Prefixed with time, first stage only
+    cpu_set_t *cpus;                    // Set by cpus or automatic affinity, or NULL
+    int nice;                           // Niceness increment of nice
+    bool has_nice;
+    int sched_policy;                   // Scheduling policy of sched
+    bool has_sched;
+    struct command_line *pipe_next;     // Next stage of the pipeline
+    enum list_operator list_op;         // How list_next runs, first stage only
+    struct command_line *list_next;     // Next pipeline of the line, first stage only
+    struct arena *arena;                // Storage of the line, for expansion
 };
 
 /* Function declarations */
-struct command_line *parse_input();
-void free_command(struct command_line *command);
+struct command_line *parse_input(struct reader *in, struct arena *arena);
+void format_command(struct command_line *command, char *buffer, size_t size);
 
 #endif /* PARSER_H */
@@ -0,0 +1,303 @@
+/**
+ * path_cache.c - Hashed lookup of command names in PATH
+ *
+ * execvp() walks every PATH directory and makes one failing execve()
+ * per entry on each launch. This module remembers where each command was
+ * found, so repeated commands resolve with a single hash probe and are
+ * started with execve() directly. The table is dropped whenever PATH
+ * changes. In interactive shells, commands not in the table are resolved
+ * through the PATH index instead of stat() calls, and the table is also
+ * dropped whenever the index sees a PATH directory change.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "path_cache.h"
+#include "path_index.h"
+
+#define PATH_CACHE_INITIAL_SIZE 64
+#define DEFAULT_PATH "/bin:/usr/bin"
+
+/**
+ * Structure for one remembered command
+ */
+struct path_entry {
+    char *name;
+    char *path;
+    unsigned long hits;
+};
+
+/* Open-addressed table with linear probing, size is a power of two */
+static struct path_entry *entries = NULL;
+static size_t table_size = 0;
+static size_t entry_count = 0;
+
+/* Value of PATH and generation of the PATH index the table was built against */
+static char *cached_path_var = NULL;
+static unsigned long cached_generation = 0;
+
+/**
+ * Hashes a command name with 64-bit FNV-1a.
+ *
+ * @param name: The command name
+ * @return: The hash value
+ */
+static size_t hash_name(const char *name) {
+    unsigned long long hash = 1469598103934665603ULL;
+
+    while (*name != '\0') {
+        hash ^= (unsigned char)*name++;
+        hash *= 1099511628211ULL;
+    }
+    return (size_t)hash;
+}
+
+/**
+ * Finds the slot holding a name, or the empty slot where it belongs.
+ *
+ * @param name: The command name
+ * @return: Index of the slot
+ */
+static size_t find_slot(const char *name) {
+    size_t mask = table_size - 1;
+    size_t i = hash_name(name) & mask;
+
+    while (entries[i].name != NULL && strcmp(entries[i].name, name) != 0) {
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+/**
+ * Doubles the table and rehashes every entry.
+ *
+ * @return: 0 on success, -1 on failure
+ */
+static int grow_table(void) {
+    struct path_entry *old_entries = entries;
+    size_t old_size = table_size;
+    size_t new_size = old_size == 0 ? PATH_CACHE_INITIAL_SIZE : old_size * 2;
+
+    struct path_entry *new_entries = calloc(new_size, sizeof(*new_entries));
+    if (new_entries == NULL) {
+        perror("Memory allocation for path cache failed");
+        return -1;
+    }
+
+    entries = new_entries;
+    table_size = new_size;
+    for (size_t i = 0; i < old_size; i++) {
+        if (old_entries[i].name != NULL) {
+            entries[find_slot(old_entries[i].name)] = old_entries[i];
+        }
+    }
+    free(old_entries);
+    return 0;
+}
+
+/**
+ * Drops the table if PATH no longer matches the value it was built from.
+ */
+static void check_path_changed(void) {
+    const char *path_var = getenv("PATH");
+
+    if (path_var == NULL) {
+        path_var = DEFAULT_PATH;
+    }
+    if (cached_path_var != NULL && strcmp(cached_path_var, path_var) == 0 &&
+        cached_generation == path_index_generation()) {
+        return;
+    }
+
+    path_cache_clear();
+    cached_path_var = strdup(path_var);
+    cached_generation = path_index_generation();
+}
+
+/**
+ * Searches the PATH directories for an executable, like execvp() does.
+ *
+ * @param name: The command name
+ * @return: A newly allocated absolute path, or NULL if not found
+ */
+static char *search_path(const char *name) {
+    size_t name_len = strlen(name);
+    const char *dir = cached_path_var;
+    char *indexed;
+
+    // The PATH index answers without touching the file system
+    switch (path_index_lookup(name, cached_path_var, &indexed)) {
+        case 1:
+            return indexed;
+        case 0:
+            return NULL;
+    }
+
+    while (dir != NULL) {
+        const char *end = strchr(dir, ':');
+        size_t dir_len = end == NULL ? strlen(dir) : (size_t)(end - dir);
+
+        // An empty PATH element means the current directory
+        char *candidate = malloc(dir_len + name_len + 3);
+        if (candidate == NULL) {
+            perror("Memory allocation for path lookup failed");
+            return NULL;
+        }
+        if (dir_len == 0) {
+            memcpy(candidate, ".", 1);
+            dir_len = 1;
+        } else {
+            memcpy(candidate, dir, dir_len);
+        }
+        candidate[dir_len] = '/';
+        memcpy(candidate + dir_len + 1, name, name_len + 1);
+
+        struct stat info;
+        if (stat(candidate, &info) == 0 && S_ISREG(info.st_mode) &&
+            access(candidate, X_OK) == 0) {
+            return candidate;
+        }
+        free(candidate);
+
+        dir = end == NULL ? NULL : end + 1;
+    }
+    return NULL;
+}
+
+/**
+ * Resolves a command name to the path it should be executed from.
+ *
+ * @param name: The command name (argv[0])
+ * @return: The path to pass to execve(), or NULL if the command was not
+ *     found. Names containing a slash are returned unchanged. The string
+ *     stays valid until the entry is forgotten or the cache is cleared.
+ */
+const char *path_cache_lookup(const char *name) {
+    if (strchr(name, '/') != NULL) {
+        return name;
+    }
+
+    check_path_changed();
+
+    // Keep the load factor at or below one half
+    if ((entry_count + 1) * 2 > table_size && grow_table() == -1) {
+        return NULL;
+    }
+
+    size_t slot = find_slot(name);
+    if (entries[slot].name != NULL) {
+        entries[slot].hits++;
+        return entries[slot].path;
+    }
+
+    // Not cached yet: search PATH and remember successful lookups only
+    char *path = search_path(name);
+    if (path == NULL) {
+        return NULL;
+    }
+    char *name_copy = strdup(name);
+    if (name_copy == NULL) {
+        perror("Memory allocation for path cache entry failed");
+        free(path);
+        return NULL;
+    }
+    entries[slot].name = name_copy;
+    entries[slot].path = path;
+    entries[slot].hits = 1;
+    entry_count++;
+    return path;
+}
+
+/**
+ * Removes a single command from the cache, e.g. after its cached path
+ * stopped working.
+ *
+ * @param name: The command name
+ */
+void path_cache_forget(const char *name) {
+    if (table_size == 0) {
+        return;
+    }
+
+    size_t mask = table_size - 1;
+    size_t slot = find_slot(name);
+    if (entries[slot].name == NULL) {
+        return;
+    }
+    free(entries[slot].name);
+    free(entries[slot].path);
+    entries[slot].name = NULL;
+    entry_count--;
+
+    // Shift later members of the probe run back into the hole
+    size_t i = (slot + 1) & mask;
+    while (entries[i].name != NULL) {
+        size_t home = hash_name(entries[i].name) & mask;
+        if (((i - home) & mask) >= ((i - slot) & mask)) {
+            entries[slot] = entries[i];
+            entries[i].name = NULL;
+            slot = i;
+        }
+        i = (i + 1) & mask;
+    }
+}
+
+/**
+ * Removes every entry from the cache.
+ */
+void path_cache_clear(void) {
+    for (size_t i = 0; i < table_size; i++) {
+        if (entries[i].name != NULL) {
+            free(entries[i].name);
+            free(entries[i].path);
+            entries[i].name = NULL;
+        }
+    }
+    entry_count = 0;
+    free(cached_path_var);
+    cached_path_var = NULL;
+}
+
+/**
+ * Implements the hash builtin.
+ *
+ *     hash            list remembered commands with their hit counts
+ *     hash -r         forget every remembered command
+ *     hash name...    look up and remember the given commands
+ *
+ * @param argc: The number of arguments passed to the command
+ * @param argv: The array of arguments passed to the command
+ * @return: 0 on success, 1 if any name could not be found
+ */
+int hash_command(int argc, char **argv) {
+    int result = 0;
+
+    if (argc == 1) {
+        if (entry_count == 0) {
+            printf("hash: hash table empty\n");
+        } else {
+            printf("hits\tcommand\n");
+            for (size_t i = 0; i < table_size; i++) {
+                if (entries[i].name != NULL) {
+                    printf("%4lu\t%s\n", entries[i].hits, entries[i].path);
+                }
+            }
+        }
+        fflush(stdout);
+        return 0;
+    }
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-r") == 0) {
+            path_cache_clear();
+        } else if (path_cache_lookup(argv[i]) == NULL) {
+            fprintf(stderr, "hash: %s: not found\n", argv[i]);
+            fflush(stderr);
+            result = 1;
+        }
+    }
+    return result;
+}
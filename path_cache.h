@@ -0,0 +1,14 @@
+/**
+ * path_cache.h - Hashed lookup of command names in PATH
+ */
+
+#ifndef PATH_CACHE_H
+#define PATH_CACHE_H
+
+/* Function declarations */
+const char *path_cache_lookup(const char *name);
+void path_cache_forget(const char *name);
+void path_cache_clear(void);
+int hash_command(int argc, char **argv);
+
+#endif /* PATH_CACHE_H */
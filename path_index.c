@@ -0,0 +1,386 @@
+/**
+ * path_index.c - Trie of the executables in PATH, kept current by inotify
+ *
+ * Interactive shells index every executable in the PATH directories once
+ * and then watch the directories with inotify, so neither completion nor
+ * command lookup has to scan or stat them again. Each trie node records
+ * in which PATH directories its name is an executable, one bit per
+ * directory, so lookups honor the PATH order and a command shadowed in
+ * one directory reappears when it is removed from the other.
+ *
+ * The index is only used when every PATH element is an absolute
+ * directory and there are at most 64 of them; otherwise the callers
+ * search PATH as before.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include "path_index.h"
+
+#define PATH_INDEX_MAX_DIRS 64
+#define PATH_INDEX_WATCH (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | \
+                          IN_ATTRIB | IN_CLOSE_WRITE | IN_DELETE_SELF | IN_MOVE_SELF)
+#define DEFAULT_PATH "/bin:/usr/bin"
+
+/**
+ * Trie node, children are kept in byte order through the sibling links
+ */
+struct trie_node {
+    uint32_t child;             // First child, 0 if none
+    uint32_t sibling;           // Next sibling, 0 if none
+    uint64_t dirs;              // PATH directories holding the name as an executable
+    unsigned char byte;
+};
+
+/* Nodes in one array, node 0 is the root */
+static struct trie_node *nodes = NULL;
+static size_t node_count = 0;
+static size_t node_capacity = 0;
+
+/* The PATH directories, with their inotify watches */
+static char *index_path_var = NULL;
+static char *dirs[PATH_INDEX_MAX_DIRS];
+static int watches[PATH_INDEX_MAX_DIRS];
+static size_t dir_count = 0;
+static int inotify_fd = -1;
+static unsigned long generation = 0;
+
+/**
+ * Allocates a trie node.
+ *
+ * @param byte: The byte of the edge leading to the node
+ * @return: The index of the node, or 0 on failure
+ */
+static uint32_t new_node(unsigned char byte) {
+    if (node_count == node_capacity) {
+        size_t capacity = node_capacity == 0 ? 4096 : node_capacity * 2;
+        struct trie_node *grown = realloc(nodes, capacity * sizeof(*nodes));
+        if (grown == NULL) {
+            perror("Memory allocation for PATH index failed");
+            return 0;
+        }
+        nodes = grown;
+        node_capacity = capacity;
+    }
+    memset(&nodes[node_count], 0, sizeof(nodes[0]));
+    nodes[node_count].byte = byte;
+    return node_count++;
+}
+
+/**
+ * Finds the node of a name.
+ *
+ * @param name: The name
+ * @param length: The length of the name
+ * @param create: Add the missing nodes
+ * @return: The index of the node, or 0 if it does not exist
+ */
+static uint32_t find_node(const char *name, size_t length, bool create) {
+    uint32_t node = 0;
+
+    for (size_t i = 0; i < length; i++) {
+        unsigned char byte = name[i];
+        uint32_t *link = &nodes[node].child;
+
+        // Siblings are sorted, so the search stops at the first larger byte
+        while (*link != 0 && nodes[*link].byte < byte) {
+            link = &nodes[*link].sibling;
+        }
+        if (*link == 0 || nodes[*link].byte != byte) {
+            if (!create) {
+                return 0;
+            }
+            uint32_t added = new_node(byte);
+            if (added == 0) {
+                return 0;
+            }
+            // nodes may have moved, so find the link again
+            link = &nodes[node].child;
+            while (*link != 0 && nodes[*link].byte < byte) {
+                link = &nodes[*link].sibling;
+            }
+            nodes[added].sibling = *link;
+            *link = added;
+        }
+        node = *link;
+    }
+    return node;
+}
+
+/**
+ * Checks a directory entry and records whether it is an executable.
+ *
+ * @param dir: The index of the PATH directory
+ * @param dir_fd: A descriptor of the directory
+ * @param name: The name of the entry
+ */
+static void update_entry(size_t dir, int dir_fd, const char *name) {
+    struct stat info;
+    bool executable = fstatat(dir_fd, name, &info, 0) == 0 &&
+        S_ISREG(info.st_mode) && (info.st_mode & 0111) != 0;
+
+    uint32_t node = find_node(name, strlen(name), executable);
+    if (node == 0) {
+        return;
+    }
+    if (executable) {
+        nodes[node].dirs |= UINT64_C(1) << dir;
+    } else {
+        nodes[node].dirs &= ~(UINT64_C(1) << dir);
+    }
+}
+
+/**
+ * Adds every executable of a PATH directory to the trie.
+ *
+ * @param dir: The index of the PATH directory
+ */
+static void scan_dir(size_t dir) {
+    DIR *stream = opendir(dirs[dir]);
+    struct dirent *entry;
+
+    if (stream == NULL) {
+        return;
+    }
+    while ((entry = readdir(stream)) != NULL) {
+        if (entry->d_name[0] == '.' || entry->d_type == DT_DIR) {
+            continue;
+        }
+        update_entry(dir, dirfd(stream), entry->d_name);
+    }
+    closedir(stream);
+}
+
+/**
+ * Releases the trie, the watches and the directory list.
+ */
+static void release_index(void) {
+    for (size_t i = 0; i < dir_count; i++) {
+        if (watches[i] != -1) {
+            inotify_rm_watch(inotify_fd, watches[i]);
+        }
+        free(dirs[i]);
+    }
+    dir_count = 0;
+    free(nodes);
+    nodes = NULL;
+    node_count = 0;
+    node_capacity = 0;
+    free(index_path_var);
+    index_path_var = NULL;
+}
+
+/**
+ * Indexes the PATH directories and watches them, replacing the index
+ * built before.
+ *
+ * @return: 0 on success, -1 if PATH cannot be indexed
+ */
+static int build_index(void) {
+    const char *path_var = getenv("PATH");
+
+    if (path_var == NULL) {
+        path_var = DEFAULT_PATH;
+    }
+    release_index();
+    generation++;
+
+    // Node 0 is the root, so 0 means "no node" everywhere else
+    new_node(0);
+    if (node_count != 1) {
+        return -1;
+    }
+
+    // Relative elements depend on the working directory and are not indexed
+    for (const char *dir = path_var; dir != NULL; ) {
+        const char *end = strchr(dir, ':');
+        size_t length = end == NULL ? strlen(dir) : (size_t)(end - dir);
+        if (length == 0 || dir[0] != '/' || dir_count == PATH_INDEX_MAX_DIRS) {
+            release_index();
+            return -1;
+        }
+        dirs[dir_count] = strndup(dir, length);
+        if (dirs[dir_count] == NULL) {
+            release_index();
+            return -1;
+        }
+        watches[dir_count] = inotify_add_watch(inotify_fd, dirs[dir_count],
+                                               PATH_INDEX_WATCH | IN_ONLYDIR);
+        dir_count++;
+        dir = end == NULL ? NULL : end + 1;
+    }
+
+    for (size_t i = 0; i < dir_count; i++) {
+        scan_dir(i);
+    }
+    index_path_var = strdup(path_var);
+    return index_path_var == NULL ? -1 : 0;
+}
+
+/**
+ * Builds the index from PATH and starts watching its directories.
+ *
+ * @return: The inotify descriptor to watch for changes, or -1 if PATH
+ *     cannot be indexed
+ */
+int path_index_init(void) {
+    if (inotify_fd == -1) {
+        inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (inotify_fd == -1) {
+            perror("inotify_init1() failed");
+            return -1;
+        }
+    }
+    return build_index() == 0 ? inotify_fd : -1;
+}
+
+/**
+ * Applies the changes inotify reported since the last call. Used as an
+ * event loop handler, and before the index is used.
+ */
+void path_index_refresh(void) {
+    char buffer[8192] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t count;
+    bool rebuild = false;
+
+    if (index_path_var == NULL) {
+        return;
+    }
+    while ((count = read(inotify_fd, buffer, sizeof(buffer))) > 0) {
+        for (char *p = buffer; p < buffer + count; ) {
+            struct inotify_event *event = (struct inotify_event *)p;
+            p += sizeof(*event) + event->len;
+
+            if (event->mask & (IN_Q_OVERFLOW | IN_DELETE_SELF | IN_MOVE_SELF)) {
+                rebuild = true;
+                continue;
+            }
+            for (size_t dir = 0; dir < dir_count; dir++) {
+                if (watches[dir] != event->wd || event->len == 0) {
+                    continue;
+                }
+                int dir_fd = open(dirs[dir], O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+                if (dir_fd != -1) {
+                    update_entry(dir, dir_fd, event->name);
+                    close(dir_fd);
+                }
+            }
+            generation++;
+        }
+    }
+
+    // Events were lost or a directory went away, start over
+    if (rebuild) {
+        build_index();
+    }
+}
+
+/**
+ * Returns a number that changes whenever the index does.
+ */
+unsigned long path_index_generation(void) {
+    return generation;
+}
+
+/**
+ * Looks up a command in the index.
+ *
+ * @param name: The command name
+ * @param path_var: The value of PATH the caller searches
+ * @param path: Receives a newly allocated path of the executable
+ * @return: 1 if found, 0 if the command is not in PATH, -1 if the index
+ *     cannot answer and PATH has to be searched
+ */
+int path_index_lookup(const char *name, const char *path_var, char **path) {
+    if (index_path_var == NULL || strcmp(path_var, index_path_var) != 0) {
+        return -1;
+    }
+    path_index_refresh();
+
+    uint32_t node = find_node(name, strlen(name), false);
+    if (node == 0 || nodes[node].dirs == 0) {
+        return 0;
+    }
+    const char *dir = dirs[__builtin_ctzll(nodes[node].dirs)];
+    size_t size = strlen(dir) + strlen(name) + 2;
+    *path = malloc(size);
+    if (*path == NULL) {
+        perror("Memory allocation for path lookup failed");
+        return -1;
+    }
+    snprintf(*path, size, "%s/%s", dir, name);
+    return 1;
+}
+
+/**
+ * Walks the subtree of a node, calling a function for every executable.
+ *
+ * @param node: The node
+ * @param name: The name of the node, with room to extend it
+ * @param length: The length of the name
+ * @param visit: The function to call with each name
+ * @param context: Passed to visit
+ */
+static void visit_names(
+    uint32_t node,
+    char *name,
+    size_t length,
+    void (*visit)(void *context, const char *name),
+    void *context
+) {
+    if (nodes[node].dirs != 0) {
+        name[length] = '\0';
+        visit(context, name);
+    }
+    if (length + 1 >= NAME_MAX + 1) {
+        return;
+    }
+    for (uint32_t child = nodes[node].child; child != 0;
+         child = nodes[child].sibling) {
+        name[length] = nodes[child].byte;
+        visit_names(child, name, length + 1, visit, context);
+    }
+}
+
+/**
+ * Calls a function for every executable in PATH whose name starts with
+ * a prefix, in byte order.
+ *
+ * @param prefix: The prefix
+ * @param visit: The function to call with each name
+ * @param context: Passed to visit
+ * @return: 0 on success, -1 if there is no index
+ */
+int path_index_complete(
+    const char *prefix,
+    void (*visit)(void *context, const char *name),
+    void *context
+) {
+    char name[NAME_MAX + 2];
+    size_t length = strlen(prefix);
+
+    path_index_refresh();
+    if (index_path_var == NULL) {
+        return -1;
+    }
+    if (length > NAME_MAX) {
+        return 0;
+    }
+
+    uint32_t node = find_node(prefix, length, false);
+    if (node == 0 && length > 0) {
+        return 0;
+    }
+    memcpy(name, prefix, length);
+    visit_names(node, name, length, visit, context);
+    return 0;
+}
@@ -0,0 +1,19 @@
+/**
+ * path_index.h - Trie of the executables in PATH, kept current by inotify
+ */
+
+#ifndef PATH_INDEX_H
+#define PATH_INDEX_H
+
+/* Function declarations */
+int path_index_init(void);
+void path_index_refresh(void);
+unsigned long path_index_generation(void);
+int path_index_lookup(const char *name, const char *path_var, char **path);
+int path_index_complete(
+    const char *prefix,
+    void (*visit)(void *context, const char *name),
+    void *context
+);
+
+#endif /* PATH_INDEX_H */
@@ -0,0 +1,256 @@
+/**
+ * pipeline.c - Multi-stage pipeline execution
+ *
+ * Each stage of a pipeline is started through start_process() with its
+ * standard input and output connected to the neighbouring stages. The
+ * stages of a background pipeline share one process group led by the
+ * first stage, while foreground stages stay in the shell's group so that
+ * Ctrl-C from the terminal still reaches them.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "pipeline.h"
+#include "commands.h"
+#include "usage.h"
+#include "telemetry.h"
+
+#define RELAY_CHUNK_SIZE (1 << 20)
+
+/**
+ * Returns the pipe buffer size requested with SMALLSH_PIPE_SIZE.
+ *
+ * @return: The size in bytes, or 0 to keep the kernel default
+ */
+static int requested_pipe_size(void) {
+    static int pipe_size = -1;
+
+    if (pipe_size == -1) {
+        const char *value = getenv("SMALLSH_PIPE_SIZE");
+        pipe_size = value == NULL ? 0 : atoi(value);
+        if (pipe_size < 0) {
+            pipe_size = 0;
+        }
+    }
+    return pipe_size;
+}
+
+/**
+ * Creates a pipe between two stages, resized if requested.
+ *
+ * @param pipe_fds: Receives the read and write ends
+ * @return: 0 on success, -1 on failure
+ */
+static int create_stage_pipe(int pipe_fds[2]) {
+    static bool resize_warned = false;
+    int pipe_size = requested_pipe_size();
+
+    if (pipe2(pipe_fds, O_CLOEXEC) == -1) {
+        perror("pipe() failed");
+        return -1;
+    }
+    if (pipe_size > 0 && fcntl(pipe_fds[1], F_SETPIPE_SZ, pipe_size) == -1 &&
+        !resize_warned) {
+        perror("cannot resize pipe");
+        resize_warned = true;
+    }
+    return 0;
+}
+
+/**
+ * Copies everything from one descriptor to another. splice() moves the
+ * data inside the kernel when either end is a pipe; otherwise the data
+ * is copied through a buffer.
+ *
+ * @param in_fd: The descriptor to read from
+ * @param out_fd: The descriptor to write to
+ * @return: 0 on success, -1 on failure
+ */
+int relay_data(int in_fd, int out_fd) {
+    ssize_t count;
+
+    for (;;) {
+        count = splice(in_fd, NULL, out_fd, NULL, RELAY_CHUNK_SIZE,
+                       SPLICE_F_MOVE | SPLICE_F_MORE);
+        if (count == 0) {
+            return 0;
+        }
+        if (count == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EINVAL) {
+                break; // Neither end is a pipe
+            }
+            perror("relay: splice() failed");
+            return -1;
+        }
+    }
+
+    char *buffer = malloc(RELAY_CHUNK_SIZE);
+    if (buffer == NULL) {
+        perror("Memory allocation for relay buffer failed");
+        return -1;
+    }
+    while ((count = read(in_fd, buffer, RELAY_CHUNK_SIZE)) != 0) {
+        if (count == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("relay: read() failed");
+            free(buffer);
+            return -1;
+        }
+        for (ssize_t written = 0; written < count; ) {
+            ssize_t result = write(out_fd, buffer + written, count - written);
+            if (result == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                perror("relay: write() failed");
+                free(buffer);
+                return -1;
+            }
+            written += result;
+        }
+    }
+    free(buffer);
+    return 0;
+}
+
+/**
+ * Executes a pipeline of one or more stages.
+ *
+ * @param head: The first stage of the pipeline
+ * @param exit_status: A pointer to an integer to store the
+ *     exit status of the last stage.
+ * @param was_terminated: A pointer to a boolean flag to indicate
+ *     if the last stage was terminated by a signal.
+ * @param signal_number: A pointer to an integer to store the
+ *     signal number that terminated the last stage.
+ * @param jobs: A pointer to the background job table.
+ */
+void execute_pipeline(
+    struct command_line *head,
+    int *exit_status,
+    bool *was_terminated,
+    int *signal_number,
+    struct job_table *jobs
+) {
+    struct command_line *stage;
+    int stage_count = 0;
+    int started = 0;
+    int prev_read = -1;
+    bool failed = false;
+    pid_t pgid = head->is_bg ? 0 : -1;
+
+    // Every stage shares the background flag of the pipeline
+    for (stage = head; stage != NULL; stage = stage->pipe_next) {
+        stage->is_bg = head->is_bg;
+        stage_count++;
+    }
+
+    pid_t *pids = malloc(stage_count * sizeof(pid_t));
+    if (pids == NULL) {
+        perror("Memory allocation for pipeline failed");
+        return;
+    }
+    struct shell_context context = {
+        exit_status, was_terminated, signal_number, jobs, false
+    };
+    struct command_usage usage;
+    usage_start(&usage);
+
+    // Start the stages from left to right
+    for (stage = head; stage != NULL; stage = stage->pipe_next) {
+        int pipe_fds[2] = {-1, -1};
+
+        if (stage->pipe_next != NULL && create_stage_pipe(pipe_fds) == -1) {
+            failed = true;
+            break;
+        }
+
+        struct spawn_io io = {prev_read, pipe_fds[1], pgid};
+        pid_t child_pid = start_process(stage, &io, &context);
+
+        // The parent no longer needs the ends handed to the child
+        if (prev_read != -1) {
+            close(prev_read);
+        }
+        if (pipe_fds[1] != -1) {
+            close(pipe_fds[1]);
+        }
+        prev_read = pipe_fds[0];
+
+        if (child_pid == -1) {
+            failed = true;
+            break;
+        }
+        pids[started++] = child_pid;
+        if (pgid == 0) {
+            pgid = child_pid;
+        }
+    }
+    if (prev_read != -1) {
+        close(prev_read);
+    }
+
+    if (!head->is_bg) {
+        // Wait for every stage, the last one decides the status
+        uint64_t wait_start = telemetry_now();
+        for (int i = 0; i < started; i++) {
+            int child_status;
+            struct rusage rusage;
+            if (wait4(pids[i], &child_status, 0, &rusage) != pids[i]) {
+                continue;
+            }
+            usage_add(&usage, &rusage);
+            if (i == stage_count - 1) {
+                update_status(
+                    child_status,
+                    exit_status,
+                    was_terminated,
+                    signal_number
+                );
+            }
+        }
+        uint64_t wait_ns = telemetry_now() - wait_start;
+        usage_finish(&usage);
+        usage_record(&usage);
+        if (head->is_timed) {
+            usage_print(&usage);
+        }
+        if (failed) {
+            *exit_status = EXIT_FAILURE;
+            *was_terminated = false;
+        } else if (*was_terminated) {
+            printf("terminated by signal %d\n", *signal_number);
+            fflush(stdout);
+        }
+        telemetry_waited(wait_ns,
+                         *was_terminated ? 128 + *signal_number : *exit_status);
+    } else if (started > 0) {
+        char command_text[JOB_TEXT_LENGTH];
+
+        printf("background pid is %d\n", pids[started - 1]);
+        fflush(stdout);
+        // Add the pipeline to the job table as a single job
+        format_command(head, command_text, sizeof(command_text));
+        struct job *job = jobs_add(jobs, pgid, pids, started, command_text);
+        uint64_t telemetry_seq = telemetry_background();
+        if (job == NULL) {
+            fprintf(stderr, "Failed to add background process\n");
+            fflush(stderr);
+        } else {
+            job->is_timed = head->is_timed;
+            job->telemetry_seq = telemetry_seq;
+        }
+    } else {
+        telemetry_abort();
+    }
+    free(pids);
+}
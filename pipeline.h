@@ -0,0 +1,23 @@
+/**
+ * pipeline.h - Multi-stage pipeline execution
+ */
+
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <stdbool.h>
+#include "parser.h"
+#include "jobs.h"
+
+/* Function declarations */
+void execute_pipeline(
+    struct command_line *head,
+    int *exit_status,
+    bool *was_terminated,
+    int *signal_number,
+    struct job_table *jobs
+);
+
+int relay_data(int in_fd, int out_fd);
+
+#endif /* PIPELINE_H */
@@ -0,0 +1,256 @@
+/**
+ * reader.c - Buffered line reader for interactive and batch input
+ *
+ * Scripts given by name are mapped into memory with mmap(). Other
+ * descriptors (terminals, pipes) are read in large chunks into a
+ * buffer. Lines of any length are returned NUL-terminated, and EOF is
+ * reported through the at_eof flag.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "reader.h"
+
+#define READER_BUFFER_SIZE 65536
+
+/**
+ * Initializes a reader that reads from a descriptor through a buffer.
+ *
+ * @param in: A pointer to the reader to initialize
+ * @param fd: The descriptor to read from
+ * @param interactive: A flag indicating if a prompt should be shown
+ * @return: 0 on success, -1 on failure
+ */
+int reader_open_fd(struct reader *in, int fd, bool interactive) {
+    memset(in, 0, sizeof(*in));
+    in->fd = fd;
+    in->interactive = interactive;
+    in->capacity = READER_BUFFER_SIZE;
+    in->data = malloc(in->capacity);
+    if (in->data == NULL) {
+        perror("Memory allocation for input buffer failed");
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Initializes a reader for a script file. Regular files are mapped into
+ * memory, anything else falls back to buffered reads.
+ *
+ * @param in: A pointer to the reader to initialize
+ * @param path: The path of the script
+ * @return: 0 on success, -1 on failure
+ */
+int reader_open_file(struct reader *in, const char *path) {
+    struct stat info;
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        fprintf(stderr, "cannot open %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    if (fstat(fd, &info) == -1 || !S_ISREG(info.st_mode)) {
+        return reader_open_fd(in, fd, false);
+    }
+
+    memset(in, 0, sizeof(*in));
+    in->fd = -1;
+    in->at_eof = info.st_size == 0;
+    if (info.st_size > 0) {
+        void *map = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) {
+            // Not mappable after all, read it instead
+            return reader_open_fd(in, fd, false);
+        }
+        madvise(map, info.st_size, MADV_SEQUENTIAL);
+        in->data = map;
+        in->length = info.st_size;
+        in->is_mapped = true;
+    }
+    close(fd);
+    return 0;
+}
+
+/**
+ * Initializes a reader over a string, as given to -c. The string must
+ * outlive the reader.
+ *
+ * @param in: A pointer to the reader to initialize
+ * @param text: The commands to read
+ */
+void reader_open_string(struct reader *in, const char *text) {
+    memset(in, 0, sizeof(*in));
+    in->fd = -1;
+    in->data = (char *)text;
+    in->length = strlen(text);
+    in->at_eof = in->length == 0;
+}
+
+/**
+ * Appends bytes to the line storage, growing it as needed.
+ *
+ * @param in: A pointer to the reader
+ * @param used: The number of bytes already in the line
+ * @param bytes: The bytes to append
+ * @param count: The number of bytes to append
+ * @return: 0 on success, -1 on failure
+ */
+static int append_to_line(
+    struct reader *in,
+    size_t used,
+    const char *bytes,
+    size_t count
+) {
+    if (used + count + 1 > in->line_capacity) {
+        size_t new_capacity = in->line_capacity == 0 ? 256 : in->line_capacity;
+        while (used + count + 1 > new_capacity) {
+            new_capacity *= 2;
+        }
+        char *new_line = realloc(in->line, new_capacity);
+        if (new_line == NULL) {
+            perror("Memory allocation for input line failed");
+            return -1;
+        }
+        in->line = new_line;
+        in->line_capacity = new_capacity;
+    }
+    memcpy(in->line + used, bytes, count);
+    in->line[used + count] = '\0';
+    return 0;
+}
+
+/**
+ * Refills the buffer of a descriptor reader.
+ *
+ * @param in: A pointer to the reader
+ * @return: The number of bytes read, 0 at EOF, -1 on error
+ */
+static ssize_t refill(struct reader *in) {
+    ssize_t count;
+
+    // Let the event loop run until the descriptor has data
+    if (in->wait_input != NULL) {
+        in->wait_input(in->wait_context);
+    }
+
+    do {
+        count = read(in->fd, in->data, in->capacity);
+    } while (count == -1 && errno == EINTR);
+
+    if (count == -1) {
+        perror("read() failed");
+        return -1;
+    }
+    in->length = count;
+    in->position = 0;
+    return count;
+}
+
+/**
+ * Returns the next line of input without its trailing newline.
+ *
+ * @param in: A pointer to the reader
+ * @param line_length: If not NULL, receives the length of the line
+ * @return: The NUL-terminated line, valid until the next call, or NULL
+ *     at EOF or on error. at_eof is set once the input is exhausted.
+ */
+char *reader_next_line(struct reader *in, size_t *line_length) {
+    size_t used = 0;
+    bool have_line = false;
+
+    // A line editor reads the line itself, byte by byte
+    if (in->edit_line != NULL) {
+        char *line = in->edit_line(in, line_length);
+        if (line != NULL) {
+            in->line_count++;
+        }
+        return line;
+    }
+
+    if (append_to_line(in, 0, "", 0) == -1) {
+        return NULL;
+    }
+
+    while (!in->at_eof) {
+        if (in->position == in->length) {
+            // In-memory input ends when the buffer does
+            if (in->fd == -1) {
+                in->at_eof = true;
+                break;
+            }
+            ssize_t count = refill(in);
+            if (count <= 0) {
+                in->at_eof = true;
+                break;
+            }
+        }
+
+        const char *start = in->data + in->position;
+        size_t available = in->length - in->position;
+        const char *newline = memchr(start, '\n', available);
+        size_t chunk = newline == NULL ? available : (size_t)(newline - start);
+
+        if (append_to_line(in, used, start, chunk) == -1) {
+            return NULL;
+        }
+        used += chunk;
+        have_line = true;
+
+        if (newline != NULL) {
+            in->position += chunk + 1;
+            break;
+        }
+        in->position += chunk;
+    }
+
+    if (!have_line) {
+        return NULL;
+    }
+    if (line_length != NULL) {
+        *line_length = used;
+    }
+    in->line_count++;
+    return in->line;
+}
+
+/**
+ * Returns the next byte of input, for a line editor.
+ *
+ * @param in: A pointer to the reader
+ * @return: The byte, or -1 at EOF or on error
+ */
+int reader_next_byte(struct reader *in) {
+    if (in->position == in->length) {
+        if (in->at_eof || in->fd == -1 || refill(in) <= 0) {
+            in->at_eof = true;
+            return -1;
+        }
+    }
+    return (unsigned char)in->data[in->position++];
+}
+
+/**
+ * Releases the resources held by a reader. Descriptor 0 is left open.
+ *
+ * @param in: A pointer to the reader
+ */
+void reader_close(struct reader *in) {
+    if (in->is_mapped) {
+        munmap(in->data, in->length);
+    } else if (in->fd != -1) {
+        free(in->data);
+        if (in->fd != 0) {
+            close(in->fd);
+        }
+    }
+    free(in->line);
+    memset(in, 0, sizeof(*in));
+    in->fd = -1;
+}
@@ -0,0 +1,44 @@
+/**
+ * reader.h - Buffered line reader for interactive and batch input
+ */
+
+#ifndef READER_H
+#define READER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+struct arena;
+
+/**
+ * Structure describing an input source and its buffered state
+ */
+struct reader {
+    int fd;             // Descriptor to refill from, -1 for in-memory input
+    char *data;         // Buffered, mapped or in-memory input
+    size_t length;      // Number of valid bytes in data
+    size_t position;    // Offset of the first unread byte
+    size_t capacity;    // Allocated size of data for descriptor input
+    bool is_mapped;     // data is an mmap() of the whole script
+    bool interactive;   // Print a prompt before each line
+    bool at_eof;        // No more input is available
+    size_t line_count;  // Number of lines returned so far
+    char *line;         // Storage for the line returned to the caller
+    size_t line_capacity;
+    int (*wait_input)(void *context);   // Called before each blocking read
+    void *wait_context;
+    char *(*expand_line)(void *context, char *line, struct arena *arena);
+    void *expand_context;   // Passed to expand_line for each command line
+    char *(*edit_line)(struct reader *in, size_t *line_length);
+    const char *prompt;     // Last prompt shown, for redrawing the line
+};
+
+/* Function declarations */
+int reader_open_fd(struct reader *in, int fd, bool interactive);
+int reader_open_file(struct reader *in, const char *path);
+void reader_open_string(struct reader *in, const char *text);
+char *reader_next_line(struct reader *in, size_t *line_length);
+int reader_next_byte(struct reader *in);
+void reader_close(struct reader *in);
+
+#endif /* READER_H */
@@ -0,0 +1,590 @@
+/**
+ * script_cache.c - Cache of parsed scripts
+ *
+ * The first run of a script records every parsed line in a compact
+ * binary form, and writes it to a cache file once the whole script has
+ * been read. Later runs map the cache file and rebuild each line from it
+ * directly, without tokenizing, for as long as the device, inode, size
+ * and modification time of the script match the ones in its header.
+ *
+ * The cache files live in $SMALLSH_CACHE_DIR, $XDG_CACHE_HOME/smallsh or
+ * ~/.cache/smallsh, named after a hash of the script's absolute path.
+ * An empty SMALLSH_CACHE_DIR turns the cache off. The cache only saves
+ * work, so failing to write it is not reported.
+ *
+ * Each line is stored as the offset in the script just after it, then
+ * its pipelines, each pipeline as its number of
+ * stages followed by the stages. The flags of a stage hold the list
+ * operator after its pipeline, which tells whether another one follows.
+ * A stage is its argument count and flags, then its arguments,
+ * redirections and cpus, nice and sched prefixes. Every string is a
+ * 32-bit length, the bytes and a NUL, so the rebuilt command points
+ * straight into the mapping.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "script_cache.h"
+
+#define CACHE_MAGIC "smshc004"
+
+/* Stage flags */
+#define STAGE_BG 0x1
+#define STAGE_TIMED 0x2
+#define STAGE_INPUT 0x4
+#define STAGE_HERE 0x8
+#define STAGE_OUTPUT 0x10
+#define STAGE_CPUS 0x20
+#define STAGE_NICE 0x40
+#define STAGE_SCHED 0x80
+#define STAGE_LIST_SHIFT 8              // List operator of the pipeline
+#define STAGE_LIST_MASK (0x3 << STAGE_LIST_SHIFT)
+
+/**
+ * Header of a cache file, followed by the path of the script
+ */
+struct cache_header {
+    char magic[8];
+    uint64_t device;
+    uint64_t inode;
+    uint64_t size;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    uint64_t records_length;            // Filled in when the file is written
+    uint32_t path_length;
+    uint32_t reserved;
+};
+
+/**
+ * Fills a header from the status of a script.
+ *
+ * @param header: The header to fill
+ * @param source: The status of the script
+ * @param path_length: The length of the script's absolute path
+ */
+static void make_header(
+    struct cache_header *header,
+    const struct stat *source,
+    size_t path_length
+) {
+    memset(header, 0, sizeof(*header));
+    memcpy(header->magic, CACHE_MAGIC, sizeof(header->magic));
+    header->device = source->st_dev;
+    header->inode = source->st_ino;
+    header->size = source->st_size;
+    header->mtime_sec = source->st_mtim.tv_sec;
+    header->mtime_nsec = source->st_mtim.tv_nsec;
+    header->path_length = path_length;
+}
+
+/**
+ * Builds the name of the cache file of a script, creating the cache
+ * directory if needed.
+ *
+ * @param script: The absolute path of the script
+ * @return: The allocated path of the cache file, or NULL if caching is off
+ */
+static char *cache_file_name(const char *script) {
+    char directory[PATH_MAX];
+    const char *value = getenv("SMALLSH_CACHE_DIR");
+
+    if (value != NULL) {
+        if (*value == '\0') {
+            return NULL;
+        }
+        snprintf(directory, sizeof(directory), "%s", value);
+    } else if ((value = getenv("XDG_CACHE_HOME")) != NULL && *value != '\0') {
+        snprintf(directory, sizeof(directory), "%s/smallsh", value);
+    } else if ((value = getenv("HOME")) != NULL && *value != '\0') {
+        snprintf(directory, sizeof(directory), "%s/.cache", value);
+        mkdir(directory, 0700);
+        snprintf(directory, sizeof(directory), "%s/.cache/smallsh", value);
+    } else {
+        return NULL;
+    }
+    if (mkdir(directory, 0700) == -1 && errno != EEXIST) {
+        return NULL;
+    }
+
+    // FNV-1a of the path names the file
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (const char *p = script; *p != '\0'; p++) {
+        hash = (hash ^ (unsigned char)*p) * 0x100000001b3ULL;
+    }
+
+    size_t size = strlen(directory) + 24;
+    char *path = malloc(size);
+    if (path != NULL) {
+        snprintf(path, size, "%s/%016llx", directory, (unsigned long long)hash);
+    }
+    return path;
+}
+
+/**
+ * Maps the cache file if it was made from the script as it is now.
+ *
+ * @param cache: The cache
+ * @param script: The absolute path of the script
+ * @return: 0 if the cache file can be replayed, -1 otherwise
+ */
+static int map_cache(struct script_cache *cache, const char *script) {
+    struct cache_header expected;
+    struct stat info;
+    size_t path_length = strlen(script);
+
+    int fd = open(cache->path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return -1;
+    }
+    if (fstat(fd, &info) == -1 ||
+        (size_t)info.st_size < sizeof(expected) + path_length) {
+        close(fd);
+        return -1;
+    }
+
+    // Private and writable, so the commands may be changed like parsed ones
+    char *map = mmap(NULL, info.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+                     fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return -1;
+    }
+
+    // A file cut short is not replayed, so a run never stops halfway
+    make_header(&expected, &cache->source, path_length);
+    expected.records_length = info.st_size - sizeof(expected) - path_length;
+    if (memcmp(map, &expected, sizeof(expected)) != 0 ||
+        memcmp(map + sizeof(expected), script, path_length) != 0) {
+        munmap(map, info.st_size);
+        return -1;
+    }
+    madvise(map, info.st_size, MADV_SEQUENTIAL);
+    cache->map = map;
+    cache->map_length = info.st_size;
+    cache->position = sizeof(expected) + path_length;
+    return 0;
+}
+
+/**
+ * Appends bytes to the records, stopping the recording if memory runs
+ * out.
+ *
+ * @param cache: The cache
+ * @param bytes: The bytes
+ * @param length: The number of bytes
+ */
+static void put(struct script_cache *cache, const void *bytes, size_t length) {
+    if (!cache->recording) {
+        return;
+    }
+    if (cache->used + length > cache->capacity) {
+        size_t capacity = cache->capacity == 0 ? 4096 : cache->capacity;
+        while (capacity < cache->used + length) {
+            capacity *= 2;
+        }
+        char *data = realloc(cache->data, capacity);
+        if (data == NULL) {
+            cache->recording = false;
+            return;
+        }
+        cache->data = data;
+        cache->capacity = capacity;
+    }
+    memcpy(cache->data + cache->used, bytes, length);
+    cache->used += length;
+}
+
+/**
+ * Appends a 32-bit number to the records.
+ */
+static void put_number(struct script_cache *cache, uint32_t value) {
+    put(cache, &value, sizeof(value));
+}
+
+/**
+ * Appends a string to the records: its length, its bytes and a NUL.
+ *
+ * @param cache: The cache
+ * @param text: The string
+ * @param length: The length of the string
+ */
+static void put_string(struct script_cache *cache, const char *text, size_t length) {
+    put_number(cache, length);
+    put(cache, text, length);
+    put(cache, "", 1);
+}
+
+/**
+ * Takes a 32-bit number from the mapping.
+ *
+ * @param cache: The cache
+ * @param value: Receives the number
+ * @return: 0 on success, -1 if the mapping ends first
+ */
+static int take_number(struct script_cache *cache, uint32_t *value) {
+    if (cache->map_length - cache->position < sizeof(*value)) {
+        return -1;
+    }
+    memcpy(value, cache->map + cache->position, sizeof(*value));
+    cache->position += sizeof(*value);
+    return 0;
+}
+
+/**
+ * Takes a string from the mapping, in place.
+ *
+ * @param cache: The cache
+ * @param length: If not NULL, receives the length of the string
+ * @return: The NUL-terminated string, or NULL if the record is broken
+ */
+static char *take_string(struct script_cache *cache, size_t *length) {
+    uint32_t size;
+
+    if (take_number(cache, &size) == -1 ||
+        cache->map_length - cache->position <= size ||
+        cache->map[cache->position + size] != '\0') {
+        return NULL;
+    }
+    char *text = cache->map + cache->position;
+    cache->position += size + 1;
+    if (length != NULL) {
+        *length = size;
+    }
+    return text;
+}
+
+/**
+ * Rebuilds one pipeline stage from the mapping.
+ *
+ * @param cache: The cache
+ * @param arena: The arena of the line
+ * @param flags: Receives the flags of the stage
+ * @return: The stage, or NULL if the record is broken
+ */
+static struct command_line *take_stage(
+    struct script_cache *cache,
+    struct arena *arena,
+    uint32_t *flags
+) {
+    uint32_t argc;
+
+    if (take_number(cache, &argc) == -1 || take_number(cache, flags) == -1 ||
+        argc >= INT_MAX / sizeof(char *)) {
+        return NULL;
+    }
+    struct command_line *stage = arena_alloc(arena, sizeof(*stage));
+    if (stage == NULL) {
+        return NULL;
+    }
+    memset(stage, 0, sizeof(*stage));
+    stage->arena = arena;
+    stage->argv = arena_alloc(arena, (argc + 1) * sizeof(char *));
+    if (stage->argv == NULL) {
+        return NULL;
+    }
+    stage->argv_capacity = argc + 1;
+
+    for (stage->argc = 0; stage->argc < (int)argc; stage->argc++) {
+        stage->argv[stage->argc] = take_string(cache, NULL);
+        if (stage->argv[stage->argc] == NULL) {
+            return NULL;
+        }
+    }
+    stage->argv[argc] = NULL;
+
+    if (((*flags & STAGE_INPUT) &&
+         (stage->input_file = take_string(cache, NULL)) == NULL) ||
+        ((*flags & STAGE_HERE) &&
+         (stage->here_text = take_string(cache, &stage->here_length)) == NULL) ||
+        ((*flags & STAGE_OUTPUT) &&
+         (stage->output_file = take_string(cache, NULL)) == NULL)) {
+        return NULL;
+    }
+
+    // The CPU set is copied out, the mapping does not keep it aligned
+    if (*flags & STAGE_CPUS) {
+        size_t length;
+        const char *cpus = take_string(cache, &length);
+        stage->cpus = arena_alloc(arena, sizeof(cpu_set_t));
+        if (cpus == NULL || length != sizeof(cpu_set_t) || stage->cpus == NULL) {
+            return NULL;
+        }
+        memcpy(stage->cpus, cpus, length);
+    }
+    uint32_t value;
+    if (*flags & STAGE_NICE) {
+        if (take_number(cache, &value) == -1) {
+            return NULL;
+        }
+        stage->nice = (int32_t)value;
+        stage->has_nice = true;
+    }
+    if (*flags & STAGE_SCHED) {
+        if (take_number(cache, &value) == -1) {
+            return NULL;
+        }
+        stage->sched_policy = value;
+        stage->has_sched = true;
+    }
+    return stage;
+}
+
+/**
+ * Looks for an up-to-date cache of a script. If there is one, the
+ * script's lines come from script_cache_next(); otherwise the lines
+ * parsed from the script are to be passed to script_cache_record().
+ *
+ * @param cache: The cache to initialize
+ * @param script: The path of the script
+ */
+void script_cache_open(struct script_cache *cache, const char *script) {
+    struct cache_header header;
+    char resolved[PATH_MAX];
+
+    memset(cache, 0, sizeof(*cache));
+    if (realpath(script, resolved) == NULL ||
+        stat(resolved, &cache->source) == -1 ||
+        !S_ISREG(cache->source.st_mode) || cache->source.st_size == 0 ||
+        cache->source.st_size > UINT32_MAX) {
+        return;
+    }
+    cache->path = cache_file_name(resolved);
+    cache->script = strdup(resolved);
+    if (cache->path == NULL || cache->script == NULL) {
+        return;
+    }
+
+    if (map_cache(cache, resolved) == 0) {
+        cache->replaying = true;
+        return;
+    }
+
+    // Start recording with the header the next run will look for
+    cache->recording = true;
+    make_header(&header, &cache->source, strlen(resolved));
+    put(cache, &header, sizeof(header));
+    put(cache, resolved, header.path_length);
+}
+
+/**
+ * Reports a broken cache file and removes it, so the next run parses the
+ * script again. Replaying stops, and the caller parses the rest of the
+ * script from source_position.
+ *
+ * @param cache: The cache
+ * @return: NULL
+ */
+static struct command_line *cache_broken(struct script_cache *cache) {
+    fprintf(stderr, "smallsh: script cache %s is corrupt\n", cache->path);
+    fflush(stderr);
+    unlink(cache->path);
+    cache->position = cache->map_length;
+    cache->replaying = false;
+    return NULL;
+}
+
+/**
+ * Rebuilds the next line of the script from the cache.
+ *
+ * @param cache: The cache
+ * @param arena: The arena to allocate the command from
+ * @return: The command, or NULL at the end of the script or if the cache
+ *     file is broken, in which case replaying is turned off
+ */
+struct command_line *script_cache_next(struct script_cache *cache, struct arena *arena) {
+    struct command_line *line = NULL;
+    struct command_line **next = &line;
+    uint32_t count;
+    uint32_t flags = 0;
+    uint32_t line_end;
+
+    if (cache->position == cache->map_length) {
+        return NULL;
+    }
+    if (take_number(cache, &line_end) == -1 ||
+        line_end <= cache->source_position ||
+        line_end > (uint64_t)cache->source.st_size) {
+        return cache_broken(cache);
+    }
+    do {
+        struct command_line *command = NULL;
+        struct command_line **last = &command;
+        if (take_number(cache, &count) == -1 || count == 0) {
+            return cache_broken(cache);
+        }
+        for (uint32_t i = 0; i < count; i++) {
+            *last = take_stage(cache, arena, &flags);
+            if (*last == NULL) {
+                return cache_broken(cache);
+            }
+            last = &(*last)->pipe_next;
+        }
+        command->is_bg = (flags & STAGE_BG) != 0;
+        command->is_timed = (flags & STAGE_TIMED) != 0;
+        command->list_op = (flags & STAGE_LIST_MASK) >> STAGE_LIST_SHIFT;
+        *next = command;
+        next = &command->list_next;
+    } while ((flags & STAGE_LIST_MASK) != LIST_END << STAGE_LIST_SHIFT);
+    cache->source_position = line_end;
+    return line;
+}
+
+/**
+ * Records one pipeline of a parsed line.
+ *
+ * @param cache: The cache
+ * @param command: The first stage of the pipeline
+ */
+static void record_pipeline(struct script_cache *cache, const struct command_line *command) {
+    uint32_t count = 0;
+
+    for (const struct command_line *stage = command; stage != NULL;
+         stage = stage->pipe_next) {
+        count++;
+    }
+    put_number(cache, count);
+
+    for (const struct command_line *stage = command; stage != NULL;
+         stage = stage->pipe_next) {
+        uint32_t flags = (command->list_op << STAGE_LIST_SHIFT) |
+            (command->is_bg ? STAGE_BG : 0) |
+            (command->is_timed ? STAGE_TIMED : 0) |
+            (stage->input_file != NULL ? STAGE_INPUT : 0) |
+            (stage->here_text != NULL ? STAGE_HERE : 0) |
+            (stage->output_file != NULL ? STAGE_OUTPUT : 0) |
+            (stage->cpus != NULL ? STAGE_CPUS : 0) |
+            (stage->has_nice ? STAGE_NICE : 0) |
+            (stage->has_sched ? STAGE_SCHED : 0);
+        put_number(cache, stage->argc);
+        put_number(cache, flags);
+        for (int i = 0; i < stage->argc; i++) {
+            put_string(cache, stage->argv[i], strlen(stage->argv[i]));
+        }
+        if (stage->input_file != NULL) {
+            put_string(cache, stage->input_file, strlen(stage->input_file));
+        }
+        if (stage->here_text != NULL) {
+            put_string(cache, stage->here_text, stage->here_length);
+        }
+        if (stage->output_file != NULL) {
+            put_string(cache, stage->output_file, strlen(stage->output_file));
+        }
+        if (stage->cpus != NULL) {
+            put_string(cache, (const char *)stage->cpus, sizeof(cpu_set_t));
+        }
+        if (stage->has_nice) {
+            put_number(cache, (uint32_t)stage->nice);
+        }
+        if (stage->has_sched) {
+            put_number(cache, stage->sched_policy);
+        }
+    }
+}
+
+/**
+ * Records a line parsed from the script. The line must be recorded
+ * before it is expanded and run.
+ *
+ * @param cache: The cache
+ * @param command: The parsed line, or NULL if the line did not parse, in
+ *     which case the script is not cached
+ * @param line_end: The offset in the script just after the line
+ */
+void script_cache_record(
+    struct script_cache *cache,
+    const struct command_line *command,
+    size_t line_end
+) {
+    if (!cache->recording) {
+        return;
+    }
+    if (command == NULL) {
+        cache->recording = false;
+        return;
+    }
+
+    put_number(cache, line_end);
+    for (; command != NULL; command = command->list_next) {
+        record_pipeline(cache, command);
+    }
+}
+
+
+/**
+ * Writes the records to the cache file through a temporary file, so a
+ * concurrent run never maps a partial cache.
+ *
+ * @param cache: The cache
+ */
+static void write_cache(struct script_cache *cache) {
+    struct stat info;
+
+    // A script changed while it ran is not cached
+    if (stat(cache->script, &info) == -1 ||
+        info.st_dev != cache->source.st_dev ||
+        info.st_ino != cache->source.st_ino ||
+        info.st_size != cache->source.st_size ||
+        info.st_mtim.tv_sec != cache->source.st_mtim.tv_sec ||
+        info.st_mtim.tv_nsec != cache->source.st_mtim.tv_nsec) {
+        return;
+    }
+
+    struct cache_header *header = (struct cache_header *)cache->data;
+    header->records_length = cache->used - sizeof(*header) - header->path_length;
+
+    size_t size = strlen(cache->path) + 8;
+    char *temporary = malloc(size);
+    if (temporary == NULL) {
+        return;
+    }
+    snprintf(temporary, size, "%s.XXXXXX", cache->path);
+    int fd = mkostemp(temporary, O_CLOEXEC);
+    if (fd == -1) {
+        free(temporary);
+        return;
+    }
+
+    size_t written = 0;
+    while (written < cache->used) {
+        ssize_t count = write(fd, cache->data + written, cache->used - written);
+        if (count == -1 && errno == EINTR) {
+            continue;
+        }
+        if (count <= 0) {
+            break;
+        }
+        written += count;
+    }
+    if (close(fd) == -1 || written < cache->used ||
+        rename(temporary, cache->path) == -1) {
+        unlink(temporary);
+    }
+    free(temporary);
+}
+
+/**
+ * Releases a cache, first writing the recorded lines to the cache file
+ * if the whole script was read.
+ *
+ * @param cache: The cache
+ * @param complete: Every line of the script was recorded
+ */
+void script_cache_close(struct script_cache *cache, bool complete) {
+    if (cache->recording && complete) {
+        write_cache(cache);
+    }
+    if (cache->map != NULL) {
+        munmap(cache->map, cache->map_length);
+    }
+    free(cache->data);
+    free(cache->path);
+    free(cache->script);
+    memset(cache, 0, sizeof(*cache));
+}
@@ -0,0 +1,41 @@
+/**
+ * script_cache.h - Cache of parsed scripts
+ */
+
+#ifndef SCRIPT_CACHE_H
+#define SCRIPT_CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/stat.h>
+#include "parser.h"
+
+/**
+ * Cache of one script, either replayed from its file or being recorded
+ */
+struct script_cache {
+    char *path;                 // Cache file, NULL if caching is off
+    char *script;               // Absolute path of the script
+    struct stat source;         // The script when it was opened
+    char *map;                  // Mapped cache file while replaying
+    size_t map_length;
+    size_t position;            // Next record in the map
+    size_t source_position;     // Offset in the script after the last line replayed
+    char *data;                 // Records written while recording
+    size_t used;
+    size_t capacity;
+    bool replaying;
+    bool recording;
+};
+
+/* Function declarations */
+void script_cache_open(struct script_cache *cache, const char *script);
+struct command_line *script_cache_next(struct script_cache *cache, struct arena *arena);
+void script_cache_record(
+    struct script_cache *cache,
+    const struct command_line *command,
+    size_t line_end
+);
+void script_cache_close(struct script_cache *cache, bool complete);
+
+#endif /* SCRIPT_CACHE_H */
@@ -0,0 +1,486 @@
+/**
+ * serve.c - Server mode running command lines for local clients
+ *
+ * smallsh --serve PATH listens on a Unix socket. Each client that
+ * connects gets a worker: a fork of the server that goes on to run the
+ * usual read and execute loop with the connection as its input, so its
+ * lines go through parse_input() and execute_command() and it keeps its
+ * own status and job table. Forking the running server costs far less
+ * than starting a new shell.
+ *
+ * The worker reads the connection on a descriptor of its own, closed on
+ * exec, and its standard input is /dev/null. A command that reads its
+ * input, such as cat, gets end of file at once rather than taking the
+ * client's next lines.
+ *
+ * The standard output and error of a worker come back to the server
+ * through pipes, and the status of every line through a socketpair. The
+ * server relays them to the client as frames from a single epoll loop,
+ * so a slow client only holds up its own worker. The status of a line is
+ * only read once both output pipes are empty, and the worker waits for
+ * the server to acknowledge it before reading the next line, so each
+ * status reaches the client after the output of its line and before the
+ * output of the next.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include "serve.h"
+
+#define SERVE_CHUNK 65536
+#define SERVE_BACKLOG 128
+#define SERVE_MAX_EVENTS 64
+
+/* Channels from a worker, in the order they are drained */
+enum serve_pipe {
+    PIPE_STDOUT,
+    PIPE_STDERR,
+    PIPE_STATUS,
+    PIPE_COUNT
+};
+
+/**
+ * A connected client and its worker
+ */
+struct serve_client {
+    int socket_fd;
+    int pipes[PIPE_COUNT];              // Server ends, -1 once at end of file
+    pid_t worker;
+    bool muted;                         // Pipes unwatched until the frame is sent
+    char pending[sizeof(struct serve_frame) + SERVE_CHUNK];
+    size_t pending_length;              // Frame bytes not yet sent
+    size_t pending_offset;
+    struct serve_client *next;
+};
+
+/* Server state */
+static int listen_fd = -1;
+static int epoll_fd = -1;
+static int signal_fd = -1;
+static struct serve_client *clients = NULL;
+static sigset_t saved_mask;
+
+/* Marker for the signalfd in epoll, the listening socket has NULL */
+static struct serve_client signal_marker;
+
+/* In a worker, where the status of each line goes */
+static int status_fd = -1;
+
+/* In a worker, the connection its lines are read from */
+static int command_fd = -1;
+
+/**
+ * Checks whether a server is already listening on a socket path.
+ *
+ * @param address: The address of the socket
+ * @return: true if a connection succeeds
+ */
+static bool socket_in_use(const struct sockaddr_un *address) {
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    bool in_use = fd != -1 &&
+        connect(fd, (const struct sockaddr *)address, sizeof(*address)) == 0;
+
+    if (fd != -1) {
+        close(fd);
+    }
+    return in_use;
+}
+
+/**
+ * Creates the listening socket, replacing a stale socket file left by a
+ * server that is gone.
+ *
+ * @param path: The path of the socket
+ * @return: The socket, or -1 on failure
+ */
+static int open_listener(const char *path) {
+    struct sockaddr_un address = {.sun_family = AF_UNIX};
+    struct stat info;
+
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "smallsh: socket path too long: %s\n", path);
+        return -1;
+    }
+    strcpy(address.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        perror("socket() failed");
+        return -1;
+    }
+    if (bind(fd, (struct sockaddr *)&address, sizeof(address)) == -1 &&
+        (errno != EADDRINUSE || stat(path, &info) == -1 ||
+         !S_ISSOCK(info.st_mode) || socket_in_use(&address) ||
+         unlink(path) == -1 ||
+         bind(fd, (struct sockaddr *)&address, sizeof(address)) == -1)) {
+        fprintf(stderr, "smallsh: cannot listen on %s: %s\n", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    if (listen(fd, SERVE_BACKLOG) == -1) {
+        perror("listen() failed");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * Adds a descriptor to the epoll set, or removes it.
+ *
+ * @param fd: The descriptor
+ * @param events: The events to watch, or 0 to remove it
+ * @param data: The client, or the marker of the descriptor
+ */
+static void watch(int fd, uint32_t events, struct serve_client *data) {
+    struct epoll_event event = {.events = events, .data.ptr = data};
+
+    if (events == 0) {
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+    } else if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1) {
+        perror("epoll_ctl() failed");
+    }
+}
+
+/**
+ * Disconnects a client. Its worker reads end of file and exits.
+ *
+ * @param client: The client
+ */
+static void close_client(struct serve_client *client) {
+    for (struct serve_client **link = &clients; *link != NULL;
+         link = &(*link)->next) {
+        if (*link == client) {
+            *link = client->next;
+            break;
+        }
+    }
+    for (int i = 0; i < PIPE_COUNT; i++) {
+        if (client->pipes[i] != -1) {
+            close(client->pipes[i]);
+        }
+    }
+    close(client->socket_fd);
+    free(client);
+}
+
+/**
+ * Stops or resumes reading a client's pipes while a frame waits for the
+ * socket to drain.
+ *
+ * @param client: The client
+ * @param muted: true to stop reading
+ */
+static void mute(struct serve_client *client, bool muted) {
+    if (client->muted == muted) {
+        return;
+    }
+    client->muted = muted;
+    for (int i = 0; i < PIPE_COUNT; i++) {
+        if (client->pipes[i] != -1) {
+            watch(client->pipes[i], muted ? 0 : EPOLLIN, client);
+        }
+    }
+    watch(client->socket_fd, muted ? EPOLLOUT : 0, client);
+}
+
+/**
+ * Sends as much of the pending frame as the socket takes.
+ *
+ * @param client: The client
+ * @return: 0 on success, even if part of the frame is left, -1 if the
+ *     client is gone
+ */
+static int flush(struct serve_client *client) {
+    while (client->pending_offset < client->pending_length) {
+        ssize_t count = send(client->socket_fd,
+                             client->pending + client->pending_offset,
+                             client->pending_length - client->pending_offset,
+                             MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (count == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno == EAGAIN ? 0 : -1;
+        }
+        client->pending_offset += count;
+    }
+    client->pending_length = 0;
+    client->pending_offset = 0;
+    return 0;
+}
+
+/**
+ * Relays a client's pipes as frames until they are empty or the socket
+ * is full. Closes the client once its worker is done and the output is
+ * delivered.
+ *
+ * @param client: The client
+ */
+static void pump(struct serve_client *client) {
+    static const uint32_t frame_types[PIPE_COUNT] = {
+        SERVE_STDOUT, SERVE_STDERR, SERVE_STATUS
+    };
+
+    for (;;) {
+        if (flush(client) == -1) {
+            close_client(client);
+            return;
+        }
+        if (client->pending_length > 0) {
+            mute(client, true);
+            return;
+        }
+
+        // Output first, so a status always follows the output of its line
+        int kind;
+        ssize_t count = 0;
+        char *payload = client->pending + sizeof(struct serve_frame);
+        for (kind = 0; kind < PIPE_COUNT; kind++) {
+            if (client->pipes[kind] == -1) {
+                continue;
+            }
+            count = read(client->pipes[kind], payload,
+                         kind == PIPE_STATUS ? sizeof(int32_t) : SERVE_CHUNK);
+            if (count > 0) {
+                // The worker waits for this before reading the next line
+                if (kind == PIPE_STATUS) {
+                    send(client->pipes[kind], "", 1, MSG_DONTWAIT | MSG_NOSIGNAL);
+                }
+                break;
+            }
+            if (count == -1 && errno == EINTR) {
+                kind--;
+            } else if (count == 0 || errno != EAGAIN) {
+                close(client->pipes[kind]);
+                client->pipes[kind] = -1;
+            }
+        }
+
+        if (kind == PIPE_COUNT) {
+            if (client->pipes[PIPE_STDOUT] == -1 &&
+                client->pipes[PIPE_STDERR] == -1 &&
+                client->pipes[PIPE_STATUS] == -1) {
+                close_client(client);
+            } else {
+                mute(client, false);
+            }
+            return;
+        }
+        struct serve_frame frame = {frame_types[kind], count};
+        memcpy(client->pending, &frame, sizeof(frame));
+        client->pending_length = sizeof(frame) + count;
+    }
+}
+
+/**
+ * Prepares a worker process after the fork: drops the server's
+ * descriptors, keeps the connection to read lines from and sends
+ * output to the client's pipes.
+ *
+ * @param client: The new client
+ * @param write_ends: The write ends of the client's pipes
+ */
+static void become_worker(struct serve_client *client, int write_ends[PIPE_COUNT]) {
+    // Terminal signals meant for the server must not reach workers
+    setsid();
+    close(listen_fd);
+    close(epoll_fd);
+    close(signal_fd);
+    for (struct serve_client *other = clients; other != NULL; other = other->next) {
+        close(other->socket_fd);
+        for (int i = 0; i < PIPE_COUNT; i++) {
+            if (other->pipes[i] != -1) {
+                close(other->pipes[i]);
+            }
+        }
+    }
+    for (int i = 0; i < PIPE_COUNT; i++) {
+        close(client->pipes[i]);
+    }
+
+    // Commands must not read the client's lines, they get no input
+    int null_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    if (null_fd == -1 ||
+        dup2(null_fd, STDIN_FILENO) == -1 ||
+        dup2(write_ends[PIPE_STDOUT], STDOUT_FILENO) == -1 ||
+        dup2(write_ends[PIPE_STDERR], STDERR_FILENO) == -1) {
+        _exit(EXIT_FAILURE);
+    }
+    close(null_fd);
+    command_fd = client->socket_fd;
+    close(write_ends[PIPE_STDOUT]);
+    close(write_ends[PIPE_STDERR]);
+    status_fd = write_ends[PIPE_STATUS];
+    free(client);
+    sigprocmask(SIG_SETMASK, &saved_mask, NULL);
+}
+
+/**
+ * Accepts a connection and forks its worker.
+ *
+ * @return: 1 in the worker, 0 in the server
+ */
+static int accept_client(void) {
+    int write_ends[PIPE_COUNT];
+    int fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+
+    if (fd == -1) {
+        if (errno != EAGAIN && errno != EINTR && errno != ECONNABORTED) {
+            perror("accept4() failed");
+        }
+        return 0;
+    }
+    struct serve_client *client = calloc(1, sizeof(*client));
+    if (client == NULL) {
+        perror("Memory allocation for client failed");
+        close(fd);
+        return 0;
+    }
+    client->socket_fd = fd;
+    for (int i = 0; i < PIPE_COUNT; i++) {
+        int fds[2];
+        if ((i == PIPE_STATUS ?
+             socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) :
+             pipe2(fds, O_CLOEXEC)) == -1) {
+            perror("cannot create client channel");
+            for (int j = 0; j < i; j++) {
+                close(client->pipes[j]);
+                close(write_ends[j]);
+            }
+            close(fd);
+            free(client);
+            return 0;
+        }
+        client->pipes[i] = fds[0];
+        write_ends[i] = fds[1];
+    }
+
+    fflush(stdout);
+    fflush(stderr);
+    client->worker = fork();
+    if (client->worker == 0) {
+        become_worker(client, write_ends);
+        return 1;
+    }
+    for (int i = 0; i < PIPE_COUNT; i++) {
+        close(write_ends[i]);
+    }
+    if (client->worker == -1) {
+        perror("fork() failed");
+        close_client(client);
+        return 0;
+    }
+
+    // The server only reads the pipes, and writes to the socket
+    for (int i = 0; i < PIPE_COUNT; i++) {
+        fcntl(client->pipes[i], F_SETFL, O_NONBLOCK);
+        watch(client->pipes[i], EPOLLIN, client);
+    }
+    client->next = clients;
+    clients = client;
+    return 0;
+}
+
+/**
+ * Runs the server on a Unix socket. The server itself never returns;
+ * every worker returns to run the lines of its client as its input.
+ *
+ * @param path: The path of the socket
+ * @return: In a worker, the descriptor to read the client's lines from;
+ *     -1 if the server could not run
+ */
+int serve(const char *path) {
+    struct epoll_event events[SERVE_MAX_EVENTS];
+    sigset_t child_signals;
+
+    listen_fd = open_listener(path);
+    if (listen_fd == -1) {
+        return -1;
+    }
+
+    // Workers are reaped as they exit
+    sigemptyset(&child_signals);
+    sigaddset(&child_signals, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &child_signals, &saved_mask);
+    signal_fd = signalfd(-1, &child_signals, SFD_NONBLOCK | SFD_CLOEXEC);
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (signal_fd == -1 || epoll_fd == -1) {
+        perror("smallsh: cannot start the server");
+        return -1;
+    }
+    watch(listen_fd, EPOLLIN, NULL);
+    watch(signal_fd, EPOLLIN, &signal_marker);
+
+    for (;;) {
+        int count = epoll_wait(epoll_fd, events, SERVE_MAX_EVENTS, -1);
+        if (count == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("epoll_wait() failed");
+            return -1;
+        }
+
+        for (int i = 0; i < count; i++) {
+            struct serve_client *client = events[i].data.ptr;
+            if (client == NULL) {
+                if (accept_client() == 1) {
+                    return command_fd;
+                }
+            } else if (client == &signal_marker) {
+                struct signalfd_siginfo info;
+                while (read(signal_fd, &info, sizeof(info)) > 0);
+                while (waitpid(-1, NULL, WNOHANG) > 0);
+            } else {
+                // A closed client may still have events in this batch
+                for (struct serve_client *known = clients; known != NULL;
+                     known = known->next) {
+                    if (known == client) {
+                        pump(client);
+                        break;
+                    }
+                }
+            }
+        }
+    }
+}
+
+/**
+ * Reports the status of a line to the client of a worker, after its
+ * output, and waits until the server has taken it. Does nothing outside
+ * of a worker.
+ *
+ * @param status: The exit value, or 128 plus the signal number
+ */
+void serve_line_done(int status) {
+    int32_t value = status;
+    char ack;
+    ssize_t count;
+
+    if (status_fd == -1) {
+        return;
+    }
+    fflush(stdout);
+    fflush(stderr);
+    if (write(status_fd, &value, sizeof(value)) == sizeof(value)) {
+        while ((count = read(status_fd, &ack, 1)) == -1 && errno == EINTR);
+        if (count == 1) {
+            return;
+        }
+    }
+    close(status_fd);
+    status_fd = -1;
+}
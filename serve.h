@@ -0,0 +1,28 @@
+/**
+ * serve.h - Server mode running command lines for local clients
+ */
+
+#ifndef SERVE_H
+#define SERVE_H
+
+#include <stdint.h>
+
+/* Frame types sent to clients */
+#define SERVE_STDOUT 1
+#define SERVE_STDERR 2
+#define SERVE_STATUS 3
+
+/**
+ * Header of a frame sent to a client, followed by length bytes of
+ * output, or by the status of a line as an int32_t
+ */
+struct serve_frame {
+    uint32_t type;
+    uint32_t length;
+};
+
+/* Function declarations */
+int serve(const char *path);
+void serve_line_done(int status);
+
+#endif /* SERVE_H */
@@ -72,4 +72,12 @@ void setup_signal_handlers(bool is_shell, bool is_background, bool *foreground_o
 
     // Install the SIGTSTP handler
     sigaction(SIGTSTP, &SIGTSTP_action, NULL);
+
+    // The shell reads SIGCHLD from a signalfd, children get it unblocked
+    if (!is_shell) {
+        sigset_t child_signals;
+        sigemptyset(&child_signals);
+        sigaddset(&child_signals, SIGCHLD);
+        sigprocmask(SIG_UNBLOCK, &child_signals, NULL);
+    }
 }
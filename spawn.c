@@ -0,0 +1,211 @@
+/**
+ * spawn.c - vfork() based fast path for launching external commands
+ *
+ * A plain fork() has to duplicate the shell's page tables even though
+ * the child immediately replaces itself with execvp(). vfork() shares
+ * the parent's address space instead and suspends the parent until the
+ * child has either exec'd or exited, so its cost does not grow with the
+ * size of the shell. The command is exec'd from the path resolved by the
+ * PATH cache, so no directory search happens in the child.
+ *
+ * Because the child runs on the parent's memory it must not touch stdio,
+ * malloc or any shell state. All signals are blocked around the vfork()
+ * so that the shell's handlers can never run in the child, and any
+ * failure is reported back through spawn_errno so that the caller can
+ * fall back to the regular fork() path, which prints the usual error
+ * messages.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "spawn.h"
+#include "signals.h"
+#include "io.h"
+#include "affinity.h"
+
+extern char **environ;
+
+/* Error reported by the vfork child, shared through the address space */
+static volatile int spawn_errno;
+static volatile bool spawn_exec_failed; // The error came from execve()
+
+/**
+ * Checks whether the fast path has been disabled with the
+ * SMALLSH_FORK_ONLY environment variable.
+ *
+ * @return: true if every command must go through fork()
+ */
+static bool fast_path_disabled(void) {
+    static int disabled = -1;
+
+    if (disabled == -1) {
+        disabled = getenv("SMALLSH_FORK_ONLY") != NULL;
+    }
+    return disabled;
+}
+
+/**
+ * Opens a file and moves it onto the given descriptor. Only
+ * async-signal-safe calls are used so this is safe in a vfork child.
+ *
+ * @param path: The file to open
+ * @param flags: The open() flags
+ * @param target_fd: The descriptor to install the file on
+ * @return: 0 on success, -1 on failure with errno set
+ */
+static int open_onto(const char *path, int flags, int target_fd) {
+    int fd = open(path, flags, 0644);
+    if (fd == -1) {
+        return -1;
+    }
+    if (fd != target_fd) {
+        if (dup2(fd, target_fd) == -1) {
+            int saved_errno = errno;
+            close(fd);
+            errno = saved_errno;
+            return -1;
+        }
+        close(fd);
+    }
+    return 0;
+}
+
+/**
+ * Connects the pipeline pipes and applies the same redirections as
+ * redirect() without printing or touching shell state.
+ *
+ * @param command: A pointer to the command_line structure
+ * @param io: The pipe ends to connect
+ * @return: 0 on success, -1 on failure with errno set
+ */
+static int spawn_redirect(
+    struct command_line *command,
+    const struct spawn_io *io
+) {
+    // Connect the pipes first so explicit redirections take precedence
+    if (io->in_fd != -1 && dup2(io->in_fd, 0) == -1) {
+        return -1;
+    }
+    if (io->out_fd != -1 && dup2(io->out_fd, 1) == -1) {
+        return -1;
+    }
+
+    // Redirect input, background commands read from /dev/null
+    if (command->here_text != NULL) {
+        int here_fd = open_here_document(
+            command->here_text,
+            command->here_length
+        );
+        if (here_fd == -1) {
+            return -1;
+        }
+        if (dup2(here_fd, 0) == -1) {
+            int saved_errno = errno;
+            close(here_fd);
+            errno = saved_errno;
+            return -1;
+        }
+        close(here_fd);
+    } else if (command->input_file != NULL) {
+        if (open_onto(command->input_file, O_RDONLY, 0) == -1) {
+            return -1;
+        }
+    } else if (command->is_bg && io->in_fd == -1) {
+        if (open_onto("/dev/null", O_RDONLY, 0) == -1) {
+            return -1;
+        }
+    }
+
+    // Redirect output, background commands write to /dev/null
+    if (command->output_file != NULL) {
+        if (open_onto(command->output_file,
+                      O_WRONLY | O_CREAT | O_TRUNC, 1) == -1) {
+            return -1;
+        }
+    } else if (command->is_bg && io->out_fd == -1) {
+        if (open_onto("/dev/null", O_WRONLY, 1) == -1) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Launches an external command with vfork() and execve().
+ *
+ * @param command: A pointer to the parsed command line structure
+ * @param exec_path: The resolved path of the executable, or NULL if the
+ *     command was not found in PATH
+ * @param io: The pipe ends and process group for the child
+ * @param exec_failed: Set to true if execve() itself failed, rather
+ *     than setting up the child
+ * @return: The child's pid, or -1 with errno set if the fast path could
+ *     not start the command and the caller should fall back to fork()
+ */
+pid_t spawn_command(
+    struct command_line *command,
+    const char *exec_path,
+    const struct spawn_io *io,
+    bool *exec_failed
+) {
+    sigset_t all_signals;
+    sigset_t saved_mask;
+    sigset_t child_mask;
+    pid_t child_pid;
+
+    // Unknown commands go through fork() so execvp() reports the error
+    *exec_failed = false;
+    if (fast_path_disabled() || exec_path == NULL) {
+        errno = 0;
+        return -1;
+    }
+
+    // Keep the shell's signal handlers from running in the shared child
+    sigfillset(&all_signals);
+    sigprocmask(SIG_BLOCK, &all_signals, &saved_mask);
+
+    // The shell keeps SIGCHLD blocked for its signalfd, the child must not
+    child_mask = saved_mask;
+    sigdelset(&child_mask, SIGCHLD);
+
+    spawn_errno = 0;
+    spawn_exec_failed = false;
+    child_pid = vfork();
+    if (child_pid == 0) {
+        // Child process: reset dispositions before unblocking signals
+        setup_signal_handlers(false, command->is_bg, NULL);
+        sigprocmask(SIG_SETMASK, &child_mask, NULL);
+
+        // The parent is suspended until exec, so only the child joins
+        if (io->pgid != -1 && setpgid(0, io->pgid) == -1) {
+            spawn_errno = errno;
+            _exit(EXIT_FAILURE);
+        }
+
+        if (spawn_redirect(command, io) == 0 && affinity_apply(command) == 0) {
+            execve(exec_path, command->argv, environ);
+            spawn_exec_failed = true;
+        }
+        spawn_errno = errno;
+        _exit(EXIT_FAILURE);
+    }
+
+    // Parent process: the child has exec'd or exited by now
+    sigprocmask(SIG_SETMASK, &saved_mask, NULL);
+
+    if (child_pid == -1) {
+        return -1;
+    }
+    if (spawn_errno != 0) {
+        // Reap the failed child and let the fork() path report the error
+        waitpid(child_pid, NULL, 0);
+        *exec_failed = spawn_exec_failed;
+        errno = spawn_errno;
+        return -1;
+    }
+    return child_pid;
+}
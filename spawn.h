@@ -0,0 +1,29 @@
+/**
+ * spawn.h - Fast-path process creation for external commands
+ */
+
+#ifndef SPAWN_H
+#define SPAWN_H
+
+#include <stdbool.h>
+#include <sys/types.h>
+#include "parser.h"
+
+/**
+ * Pipe ends and process group for a child process
+ */
+struct spawn_io {
+    int in_fd;      // Pipe to read standard input from, or -1
+    int out_fd;     // Pipe to write standard output to, or -1
+    pid_t pgid;     // Group to join: 0 starts a new one, -1 keeps the shell's
+};
+
+/* Function declarations */
+pid_t spawn_command(
+    struct command_line *command,
+    const char *exec_path,
+    const struct spawn_io *io,
+    bool *exec_failed
+);
+
+#endif /* SPAWN_H */
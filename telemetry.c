@@ -0,0 +1,438 @@
+/**
+ * telemetry.c - Lifecycle timings of commands
+ *
+ * Every pipeline the shell runs gets a record in a fixed-size ring: the
+ * time spent parsing its line, creating its processes, until they had
+ * exec'd, waiting for them, how long a background job's exit went
+ * unnoticed, and its status. The newest TELEMETRY_RING_SIZE records are
+ * kept and older ones are overwritten, so the cost is a few clock reads
+ * per command and no allocation. The shell is single-threaded and is
+ * the only writer, so the ring needs no lock.
+ *
+ * Each timing also goes into a log-linear histogram covering every
+ * command since the start or the last stats -r, with 16 sub-buckets per
+ * power of two, which keeps every value within about 6%. stats prints
+ * their percentiles in the style of HdrHistogram; stats -o writes the
+ * ring as JSON lines, and $SMALLSH_TELEMETRY_FILE receives it at exit.
+ *
+ * Times of the fork() path only cover creating the process, since the
+ * shell does not learn when the child execs; the vfork() and spawn
+ * helper paths return after the exec, so both times are known. The reap
+ * delay is an upper bound: the time since the shell last checked for
+ * exited children, or since the job started if that is later.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "telemetry.h"
+
+#define TELEMETRY_RING_SIZE 4096        // Power of two
+#define TELEMETRY_NAME_LENGTH 32
+#define HISTOGRAM_SUB_BITS 4
+#define HISTOGRAM_SUB (1 << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_BUCKETS ((64 - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB)
+
+/* The measured phases, in the order stats prints them */
+enum telemetry_metric {
+    METRIC_PARSE,
+    METRIC_SPAWN,
+    METRIC_EXEC,
+    METRIC_WAIT,
+    METRIC_REAP,
+    METRIC_COUNT
+};
+
+static const char *metric_names[METRIC_COUNT] = {
+    "parse", "spawn", "exec", "wait", "reap_delay"
+};
+
+/**
+ * Timings of one pipeline, -1 where a phase was not measured
+ */
+struct telemetry_record {
+    uint64_t seq;                       // From 1, 0 marks an unused slot
+    uint64_t start_ns;                  // CLOCK_MONOTONIC when it started
+    int64_t times[METRIC_COUNT];
+    int status;                         // As $?, -1 until known
+    bool background;
+    char command[TELEMETRY_NAME_LENGTH];
+};
+
+/**
+ * Log-linear histogram of one metric, in nanoseconds
+ */
+struct histogram {
+    uint64_t counts[HISTOGRAM_BUCKETS];
+    uint64_t total;
+    uint64_t sum;
+    uint64_t max;
+};
+
+static struct telemetry_record ring[TELEMETRY_RING_SIZE];
+static uint64_t next_seq = 1;
+static struct telemetry_record *current = NULL;
+static struct histogram histograms[METRIC_COUNT];
+static int64_t pending_parse = -1;
+static uint64_t last_child_check = 0;
+
+/**
+ * Reads the monotonic clock.
+ *
+ * @return: The time in nanoseconds
+ */
+uint64_t telemetry_now(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/**
+ * Returns the histogram bucket of a value.
+ */
+static size_t bucket_of(uint64_t value) {
+    if (value < HISTOGRAM_SUB) {
+        return value;
+    }
+    int magnitude = 63 - __builtin_clzll(value);
+    return (magnitude - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB +
+        ((value >> (magnitude - HISTOGRAM_SUB_BITS)) & (HISTOGRAM_SUB - 1));
+}
+
+/**
+ * Returns the highest value that falls into a histogram bucket.
+ */
+static uint64_t bucket_top(size_t bucket) {
+    if (bucket < HISTOGRAM_SUB) {
+        return bucket;
+    }
+    int shift = bucket / HISTOGRAM_SUB - 1;
+    uint64_t low = (uint64_t)(HISTOGRAM_SUB + bucket % HISTOGRAM_SUB) << shift;
+    return low + ((uint64_t)1 << shift) - 1;
+}
+
+/**
+ * Sets a timing of the current record and adds it to its histogram.
+ *
+ * @param record: The record
+ * @param metric: The phase
+ * @param value: The time in nanoseconds
+ */
+static void record_time(struct telemetry_record *record, enum telemetry_metric metric, int64_t value) {
+    struct histogram *histogram = &histograms[metric];
+
+    record->times[metric] = value;
+    if (value < 0) {
+        return;
+    }
+    histogram->counts[bucket_of(value)]++;
+    histogram->total++;
+    histogram->sum += value;
+    if ((uint64_t)value > histogram->max) {
+        histogram->max = value;
+    }
+}
+
+/**
+ * Remembers how long the last line took to parse, for the first
+ * pipeline that runs from it.
+ *
+ * @param parse_ns: The time in nanoseconds
+ */
+void telemetry_parsed(uint64_t parse_ns) {
+    pending_parse = parse_ns;
+}
+
+/**
+ * Starts the record of a pipeline about to run.
+ *
+ * @param command: The first stage of the pipeline
+ */
+void telemetry_begin(const struct command_line *command) {
+    current = &ring[next_seq & (TELEMETRY_RING_SIZE - 1)];
+    current->seq = next_seq++;
+    current->start_ns = telemetry_now();
+    for (int i = 0; i < METRIC_COUNT; i++) {
+        current->times[i] = -1;
+    }
+    current->status = -1;
+    current->background = command->is_bg;
+    snprintf(current->command, sizeof(current->command), "%s", command->argv[0]);
+
+    record_time(current, METRIC_PARSE, pending_parse);
+    pending_parse = -1;
+}
+
+/**
+ * Adds the creation of one process to the current record.
+ *
+ * @param spawn_ns: The time it took to create the process
+ * @param exec_done: Whether the process had exec'd by then
+ */
+void telemetry_spawned(uint64_t spawn_ns, bool exec_done) {
+    if (current == NULL) {
+        return;
+    }
+    // A pipeline sums its stages; one fork() makes the exec time unknown,
+    // which -2 marks until finish_start()
+    current->times[METRIC_SPAWN] = (current->times[METRIC_SPAWN] == -1 ? 0 :
+                                    current->times[METRIC_SPAWN]) + spawn_ns;
+    if (!exec_done) {
+        current->times[METRIC_EXEC] = -2;
+    } else if (current->times[METRIC_EXEC] != -2) {
+        current->times[METRIC_EXEC] = (current->times[METRIC_EXEC] == -1 ? 0 :
+                                       current->times[METRIC_EXEC]) + spawn_ns;
+    }
+}
+
+/**
+ * Adds the spawn and exec times of the current record to their
+ * histograms, once every process of the pipeline is started.
+ */
+static void finish_start(void) {
+    int64_t spawn = current->times[METRIC_SPAWN];
+    int64_t exec = current->times[METRIC_EXEC];
+
+    record_time(current, METRIC_SPAWN, spawn);
+    record_time(current, METRIC_EXEC, exec < 0 ? -1 : exec);
+}
+
+/**
+ * Completes the record of a foreground pipeline.
+ *
+ * @param wait_ns: The time spent waiting for it, or running a builtin
+ * @param status: Its status, as $?
+ */
+void telemetry_waited(uint64_t wait_ns, int status) {
+    if (current == NULL) {
+        return;
+    }
+    finish_start();
+    record_time(current, METRIC_WAIT, wait_ns);
+    current->status = status;
+    current = NULL;
+}
+
+/**
+ * Completes the start of a background pipeline.
+ *
+ * @return: The sequence number to pass to telemetry_reaped(), or 0
+ */
+uint64_t telemetry_background(void) {
+    if (current == NULL) {
+        return 0;
+    }
+    uint64_t seq = current->seq;
+    finish_start();
+    current = NULL;
+    return seq;
+}
+
+/**
+ * Leaves the current record incomplete when its pipeline could not be
+ * started.
+ */
+void telemetry_abort(void) {
+    current = NULL;
+}
+
+/**
+ * Completes the record of a background job once its last process has
+ * been reaped, if the ring still holds it.
+ *
+ * @param seq: The number returned by telemetry_background()
+ * @param status: Its status, as $?
+ */
+void telemetry_reaped(uint64_t seq, int status) {
+    struct telemetry_record *record = &ring[seq & (TELEMETRY_RING_SIZE - 1)];
+    uint64_t now = telemetry_now();
+
+    if (seq == 0 || record->seq != seq) {
+        return;
+    }
+    uint64_t noticeable = last_child_check > record->start_ns ?
+        last_child_check : record->start_ns;
+    record_time(record, METRIC_REAP, now > noticeable ? now - noticeable : 0);
+    record->status = status;
+}
+
+/**
+ * Notes that the shell has just checked for exited children, or is
+ * blocked where it would notice them at once.
+ */
+void telemetry_children_checked(void) {
+    last_child_check = telemetry_now();
+}
+
+/**
+ * Returns the value at a percentile of a histogram.
+ *
+ * @param histogram: The histogram
+ * @param percentile: The percentile, from 0 to 100
+ * @return: The highest value of the bucket holding it, in nanoseconds
+ */
+static uint64_t value_at(const struct histogram *histogram, double percentile) {
+    uint64_t wanted = (uint64_t)(percentile / 100 * histogram->total + 0.5);
+    uint64_t seen = 0;
+
+    if (wanted == 0) {
+        wanted = 1;
+    }
+    for (size_t bucket = 0; bucket < HISTOGRAM_BUCKETS; bucket++) {
+        seen += histogram->counts[bucket];
+        if (seen >= wanted) {
+            uint64_t top = bucket_top(bucket);
+            return top < histogram->max ? top : histogram->max;
+        }
+    }
+    return histogram->max;
+}
+
+/**
+ * Prints the percentiles of every histogram.
+ */
+static void print_histograms(void) {
+    static const double percentiles[] = {50, 75, 90, 95, 99, 99.9, 100};
+
+    for (int metric = 0; metric < METRIC_COUNT; metric++) {
+        const struct histogram *histogram = &histograms[metric];
+        if (histogram->total == 0) {
+            printf("%s: no samples\n", metric_names[metric]);
+            continue;
+        }
+        printf("%s: %llu samples, mean %.3f us, max %.3f us\n",
+               metric_names[metric], (unsigned long long)histogram->total,
+               histogram->sum / 1000.0 / histogram->total, histogram->max / 1000.0);
+        printf("%14s %12s %12s %12s\n", "Value(us)", "Percentile", "TotalCount",
+               "1/(1-P)");
+        for (size_t i = 0; i < sizeof(percentiles) / sizeof(percentiles[0]); i++) {
+            double fraction = percentiles[i] / 100;
+            uint64_t count = (uint64_t)(fraction * histogram->total + 0.5);
+            if (fraction < 1) {
+                printf("%14.3f %12.6f %12llu %12.2f\n",
+                       value_at(histogram, percentiles[i]) / 1000.0, fraction,
+                       (unsigned long long)count, 1 / (1 - fraction));
+            } else {
+                printf("%14.3f %12.6f %12llu %12s\n",
+                       value_at(histogram, percentiles[i]) / 1000.0, fraction,
+                       (unsigned long long)count, "inf");
+            }
+        }
+    }
+    fflush(stdout);
+}
+
+/**
+ * Writes a command name as a JSON string.
+ */
+static void write_json_string(FILE *file, const char *text) {
+    fputc('"', file);
+    for (const unsigned char *p = (const unsigned char *)text; *p != '\0'; p++) {
+        if (*p == '"' || *p == '\\') {
+            fprintf(file, "\\%c", *p);
+        } else if (*p < 0x20) {
+            fprintf(file, "\\u%04x", *p);
+        } else {
+            fputc(*p, file);
+        }
+    }
+    fputc('"', file);
+}
+
+/**
+ * Writes the records in the ring as JSON lines, oldest first.
+ *
+ * @param path: The file
+ * @param flags: O_TRUNC to replace the file or O_APPEND to add to it
+ * @return: 0 on success, -1 on failure
+ */
+static int export_json(const char *path, int flags) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_CLOEXEC | flags, 0644);
+    FILE *file = fd == -1 ? NULL : fdopen(fd, flags & O_APPEND ? "a" : "w");
+
+    if (file == NULL) {
+        fprintf(stderr, "stats: cannot write %s: %s\n", path, strerror(errno));
+        fflush(stderr);
+        if (fd != -1) {
+            close(fd);
+        }
+        return -1;
+    }
+
+    uint64_t first = next_seq > TELEMETRY_RING_SIZE ? next_seq - TELEMETRY_RING_SIZE : 1;
+    for (uint64_t seq = first; seq < next_seq; seq++) {
+        const struct telemetry_record *record = &ring[seq & (TELEMETRY_RING_SIZE - 1)];
+        if (record->seq != seq) {
+            continue;
+        }
+        fprintf(file, "{\"seq\":%llu,\"pid\":%d,\"command\":",
+                (unsigned long long)seq, (int)getpid());
+        write_json_string(file, record->command);
+        fprintf(file, ",\"background\":%s,\"start_ns\":%llu",
+                record->background ? "true" : "false",
+                (unsigned long long)record->start_ns);
+        for (int metric = 0; metric < METRIC_COUNT; metric++) {
+            if (record->times[metric] < 0) {
+                fprintf(file, ",\"%s_ns\":null", metric_names[metric]);
+            } else {
+                fprintf(file, ",\"%s_ns\":%lld", metric_names[metric],
+                        (long long)record->times[metric]);
+            }
+        }
+        if (record->status < 0) {
+            fprintf(file, ",\"status\":null}\n");
+        } else {
+            fprintf(file, ",\"status\":%d}\n", record->status);
+        }
+    }
+    if (fclose(file) == EOF) {
+        fprintf(stderr, "stats: cannot write %s: %s\n", path, strerror(errno));
+        fflush(stderr);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Implements the stats builtin: no argument prints the histograms, -o
+ * writes the ring to a file as JSON lines and -r clears everything.
+ *
+ * @param argc: The number of arguments
+ * @param argv: The arguments
+ * @return: 0 on success, 1 on failure
+ */
+int telemetry_command(int argc, char **argv) {
+    if (argc == 1) {
+        print_histograms();
+        return 0;
+    }
+    if (argc == 3 && strcmp(argv[1], "-o") == 0) {
+        return export_json(argv[2], O_TRUNC) == 0 ? 0 : 1;
+    }
+    if (argc == 2 && strcmp(argv[1], "-r") == 0) {
+        memset(ring, 0, sizeof(ring));
+        memset(histograms, 0, sizeof(histograms));
+        current = NULL;
+        return 0;
+    }
+    fprintf(stderr, "usage: stats [-o file | -r]\n");
+    fflush(stderr);
+    return 1;
+}
+
+/**
+ * Appends the ring to $SMALLSH_TELEMETRY_FILE, if set, as the shell
+ * exits.
+ */
+void telemetry_exit(void) {
+    const char *path = getenv("SMALLSH_TELEMETRY_FILE");
+
+    if (path != NULL && *path != '\0') {
+        export_json(path, O_APPEND);
+    }
+}
@@ -0,0 +1,25 @@
+/**
+ * telemetry.h - Lifecycle timings of commands
+ */
+
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "parser.h"
+
+/* Function declarations */
+uint64_t telemetry_now(void);
+void telemetry_parsed(uint64_t parse_ns);
+void telemetry_begin(const struct command_line *command);
+void telemetry_spawned(uint64_t spawn_ns, bool exec_done);
+void telemetry_waited(uint64_t wait_ns, int status);
+uint64_t telemetry_background(void);
+void telemetry_abort(void);
+void telemetry_reaped(uint64_t seq, int status);
+void telemetry_children_checked(void);
+int telemetry_command(int argc, char **argv);
+void telemetry_exit(void);
+
+#endif /* TELEMETRY_H */
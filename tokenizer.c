@@ -0,0 +1,219 @@
+/**
+ * tokenizer.c - Splitting command lines into words
+ *
+ * Words are separated by spaces and newlines, except inside $( ... ),
+ * which stays one word however many words it holds. They are split in
+ * place: the separator after a word is overwritten with a NUL.
+ *
+ * On x86-64 the line is classified a block at a time with SSE2, or AVX2
+ * when the shell is built with -mavx2: one load and a few compares give
+ * masks of the blanks and of the bytes that can end a word (blanks, NUL
+ * and '$'). The masks are kept between calls, so the short words of a
+ * long line are found by scanning bits rather than bytes. A '$(' and the
+ * last bytes of the line, where a whole block would read past the NUL,
+ * go through the byte loop, which is also used everywhere else.
+ */
+
+#include <string.h>
+#include "tokenizer.h"
+#include "common.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define TOKEN_BLOCK 32
+#define TOKEN_BLOCK_MASK 0xffffffffu
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define TOKEN_BLOCK 16
+#define TOKEN_BLOCK_MASK 0xffffu
+#endif
+
+/**
+ * Starts splitting a line.
+ *
+ * @param tokens: The tokenizer
+ * @param line: The line, NUL-terminated and modified in place
+ * @param length: The length of the line
+ */
+void tokenizer_init(struct tokenizer *tokens, char *line, size_t length) {
+    tokens->cursor = line;
+    tokens->end = line + length;
+    tokens->unterminated = false;
+    tokens->block = NULL;
+    tokens->blanks = 0;
+    tokens->stops = 0;
+}
+
+/**
+ * Finds the end of a word a byte at a time and splits it off.
+ *
+ * @param tokens: The tokenizer
+ * @param token: The start of the word
+ * @param p: The first byte not known to belong to the word
+ * @return: The NUL-terminated word
+ */
+static char *finish_token(struct tokenizer *tokens, char *token, char *p) {
+    int depth = 0;
+
+    while (*p != '\0' && (depth > 0 || (*p != ' ' && *p != '\n'))) {
+        if (p[0] == SUBST_START[0] && p[1] == SUBST_START[1]) {
+            depth++;
+            p++;
+        } else if (depth > 0 && *p == '(') {
+            depth++;
+        } else if (depth > 0 && *p == ')') {
+            depth--;
+        }
+        p++;
+    }
+    if (depth > 0) {
+        tokens->unterminated = true;
+    }
+    if (*p != '\0') {
+        *p++ = '\0';
+    }
+    tokens->cursor = p;
+    return token;
+}
+
+/**
+ * Splits the next word off the line a byte at a time.
+ *
+ * @param tokens: The tokenizer
+ * @return: The NUL-terminated word, or NULL at the end of the line
+ */
+char *tokenizer_next_scalar(struct tokenizer *tokens) {
+    char *p = tokens->cursor;
+
+    while (*p == ' ' || *p == '\n') {
+        p++;
+    }
+    if (*p == '\0') {
+        tokens->cursor = p;
+        return NULL;
+    }
+    return finish_token(tokens, p, p);
+}
+
+#ifdef TOKEN_BLOCK
+/**
+ * Classifies the block starting at p.
+ *
+ * @param tokens: The tokenizer
+ * @param p: The first byte of the block
+ */
+static void load_block(struct tokenizer *tokens, const char *p) {
+#if defined(__AVX2__)
+    __m256i bytes = _mm256_loadu_si256((const __m256i *)p);
+    __m256i blanks = _mm256_or_si256(
+        _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8(' ')),
+        _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('\n')));
+    __m256i others = _mm256_or_si256(
+        _mm256_cmpeq_epi8(bytes, _mm256_setzero_si256()),
+        _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8(SUBST_START[0])));
+    tokens->blanks = (uint32_t)_mm256_movemask_epi8(blanks);
+    tokens->stops = tokens->blanks | (uint32_t)_mm256_movemask_epi8(others);
+#else
+    __m128i bytes = _mm_loadu_si128((const __m128i *)p);
+    __m128i blanks = _mm_or_si128(
+        _mm_cmpeq_epi8(bytes, _mm_set1_epi8(' ')),
+        _mm_cmpeq_epi8(bytes, _mm_set1_epi8('\n')));
+    __m128i others = _mm_or_si128(
+        _mm_cmpeq_epi8(bytes, _mm_setzero_si128()),
+        _mm_cmpeq_epi8(bytes, _mm_set1_epi8(SUBST_START[0])));
+    tokens->blanks = (uint32_t)_mm_movemask_epi8(blanks);
+    tokens->stops = tokens->blanks | (uint32_t)_mm_movemask_epi8(others);
+#endif
+    tokens->block = p;
+}
+
+/**
+ * Makes the masks describe the block holding p, loading a new block at
+ * p if needed.
+ *
+ * @param tokens: The tokenizer
+ * @param p: The byte to classify
+ * @return: true if p is classified, false if a block at p would read
+ *     past the end of the line
+ */
+static bool classify(struct tokenizer *tokens, const char *p) {
+    if (tokens->block != NULL && p >= tokens->block &&
+        p < tokens->block + TOKEN_BLOCK) {
+        return true;
+    }
+    if (tokens->end - p + 1 < TOKEN_BLOCK) {
+        return false;
+    }
+    load_block(tokens, p);
+    return true;
+}
+
+/**
+ * Splits the next word off the line.
+ *
+ * @param tokens: The tokenizer
+ * @return: The NUL-terminated word, or NULL at the end of the line
+ */
+char *tokenizer_next(struct tokenizer *tokens) {
+    char *p = tokens->cursor;
+
+    // Skip to the first byte that is not a blank; words are usually
+    // separated by a single one, already overwritten by the last call
+    while (*p == ' ' || *p == '\n') {
+        if (!classify(tokens, p)) {
+            while (*p == ' ' || *p == '\n') {
+                p++;
+            }
+            break;
+        }
+        unsigned int offset = p - tokens->block;
+        uint32_t words = (~tokens->blanks & TOKEN_BLOCK_MASK) >> offset;
+        if (words != 0) {
+            p += __builtin_ctz(words);
+            break;
+        }
+        p += TOKEN_BLOCK - offset;
+    }
+    if (*p == '\0') {
+        tokens->cursor = p;
+        return NULL;
+    }
+
+    // Find the blank or NUL after the word, stopping at each '$'
+    char *token = p;
+    for (;;) {
+        if (!classify(tokens, p)) {
+            return finish_token(tokens, token, p);
+        }
+        unsigned int offset = p - tokens->block;
+        uint32_t stops = tokens->stops >> offset;
+        if (stops == 0) {
+            p += TOKEN_BLOCK - offset;
+            continue;
+        }
+        p += __builtin_ctz(stops);
+        if (*p != SUBST_START[0]) {
+            break;
+        }
+        if (p[1] == SUBST_START[1]) {
+            return finish_token(tokens, token, p);
+        }
+        p++;
+    }
+    if (*p != '\0') {
+        *p++ = '\0';
+    }
+    tokens->cursor = p;
+    return token;
+}
+#else
+/**
+ * Splits the next word off the line.
+ *
+ * @param tokens: The tokenizer
+ * @return: The NUL-terminated word, or NULL at the end of the line
+ */
+char *tokenizer_next(struct tokenizer *tokens) {
+    return tokenizer_next_scalar(tokens);
+}
+#endif
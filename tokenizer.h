@@ -0,0 +1,29 @@
+/**
+ * tokenizer.h - Splitting command lines into words
+ */
+
+#ifndef TOKENIZER_H
+#define TOKENIZER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Position of the tokenizer in the line being parsed
+ */
+struct tokenizer {
+    char *cursor;                       // First character not yet split
+    char *end;                          // The NUL ending the line
+    bool unterminated;                  // A $( was never closed
+    const char *block;                  // Bytes the masks describe, or NULL
+    uint32_t blanks;                    // Spaces and newlines in the block
+    uint32_t stops;                     // Blanks, NULs and $ in the block
+};
+
+/* Function declarations */
+void tokenizer_init(struct tokenizer *tokens, char *line, size_t length);
+char *tokenizer_next(struct tokenizer *tokens);
+char *tokenizer_next_scalar(struct tokenizer *tokens);
+
+#endif /* TOKENIZER_H */
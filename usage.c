@@ -0,0 +1,109 @@
+/**
+ * usage.c - Resource usage of commands
+ *
+ * Children are collected with wait4(), which returns their rusage along
+ * with the status. The rusage of every process of a command is summed
+ * here, together with the wall clock time from start to the last exit.
+ * The usage of the last foreground command is kept for status -r.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+#include "usage.h"
+
+static struct command_usage last_usage;
+
+/**
+ * Starts measuring a command.
+ *
+ * @param usage: The usage to reset
+ */
+void usage_start(struct command_usage *usage) {
+    memset(usage, 0, sizeof(*usage));
+    clock_gettime(CLOCK_MONOTONIC, &usage->start);
+}
+
+/**
+ * Adds the rusage of one process of the command.
+ *
+ * @param usage: The usage of the command
+ * @param rusage: The rusage returned by wait4(), or NULL
+ */
+void usage_add(struct command_usage *usage, const struct rusage *rusage) {
+    struct rusage *sum = &usage->rusage;
+
+    if (rusage == NULL) {
+        return;
+    }
+    timeradd(&sum->ru_utime, &rusage->ru_utime, &sum->ru_utime);
+    timeradd(&sum->ru_stime, &rusage->ru_stime, &sum->ru_stime);
+    if (rusage->ru_maxrss > sum->ru_maxrss) {
+        sum->ru_maxrss = rusage->ru_maxrss;
+    }
+    sum->ru_majflt += rusage->ru_majflt;
+    sum->ru_minflt += rusage->ru_minflt;
+    sum->ru_nvcsw += rusage->ru_nvcsw;
+    sum->ru_nivcsw += rusage->ru_nivcsw;
+}
+
+/**
+ * Stops the wall clock of a command.
+ *
+ * @param usage: The usage of the command
+ */
+void usage_finish(struct command_usage *usage) {
+    clock_gettime(CLOCK_MONOTONIC, &usage->end);
+    usage->finished = true;
+}
+
+/**
+ * Prints one time value in the "0m0.000s" format.
+ *
+ * @param label: The name of the value
+ * @param seconds: The time in seconds
+ */
+static void print_time(const char *label, double seconds) {
+    long minutes = (long)(seconds / 60);
+    fprintf(stderr, "%s\t%ldm%.3fs\n", label, minutes, seconds - minutes * 60);
+}
+
+/**
+ * Prints a usage report to standard error.
+ *
+ * @param usage: The finished usage of a command
+ */
+void usage_print(const struct command_usage *usage) {
+    const struct rusage *rusage = &usage->rusage;
+
+    print_time("real", (usage->end.tv_sec - usage->start.tv_sec) +
+        (usage->end.tv_nsec - usage->start.tv_nsec) / 1e9);
+    print_time("user", rusage->ru_utime.tv_sec +
+        rusage->ru_utime.tv_usec / 1e6);
+    print_time("sys", rusage->ru_stime.tv_sec +
+        rusage->ru_stime.tv_usec / 1e6);
+    fprintf(stderr, "maxrss\t%ld KiB\n", rusage->ru_maxrss);
+    fprintf(stderr, "faults\t%ld major, %ld minor\n",
+            rusage->ru_majflt, rusage->ru_minflt);
+    fprintf(stderr, "ctxsw\t%ld voluntary, %ld involuntary\n",
+            rusage->ru_nvcsw, rusage->ru_nivcsw);
+    fflush(stderr);
+}
+
+/**
+ * Remembers the usage of the last foreground command.
+ *
+ * @param usage: The finished usage of the command
+ */
+void usage_record(const struct command_usage *usage) {
+    last_usage = *usage;
+}
+
+/**
+ * Returns the usage of the last foreground command.
+ *
+ * @return: The usage, with finished unset if none was recorded
+ */
+const struct command_usage *usage_last(void) {
+    return &last_usage;
+}
@@ -0,0 +1,30 @@
+/**
+ * usage.h - Resource usage of commands
+ */
+
+#ifndef USAGE_H
+#define USAGE_H
+
+#include <stdbool.h>
+#include <time.h>
+#include <sys/resource.h>
+
+/**
+ * Wall clock time and summed rusage of the processes of one command
+ */
+struct command_usage {
+    struct timespec start;      // CLOCK_MONOTONIC
+    struct timespec end;
+    struct rusage rusage;       // Summed over every process, max RSS is the largest
+    bool finished;
+};
+
+/* Function declarations */
+void usage_start(struct command_usage *usage);
+void usage_add(struct command_usage *usage, const struct rusage *rusage);
+void usage_finish(struct command_usage *usage);
+void usage_print(const struct command_usage *usage);
+void usage_record(const struct command_usage *usage);
+const struct command_usage *usage_last(void);
+
+#endif /* USAGE_H */
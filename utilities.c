@@ -0,0 +1,584 @@
+/**
+ * utilities.c - Fork-free versions of common utilities
+ *
+ * echo, true, false, pwd, test ([) and printf make up most of the
+ * commands in typical scripts and each of them would otherwise cost a
+ * fork and an exec. They follow the POSIX behaviour of the standalone
+ * programs closely enough for scripts, and write through stdio, which
+ * run_builtin() flushes before restoring redirected descriptors.
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "builtins.h"
+#include "common.h"
+
+/**
+ * Implements echo. -n leaves out the trailing newline.
+ *
+ * @param command: The parsed command
+ * @param context: The shell context
+ * @return: 0
+ */
+int echo_builtin(struct command_line *command, struct shell_context *context) {
+    bool newline = true;
+    int first = 1;
+    (void)context;
+
+    if (command->argc > 1 && strcmp(command->argv[1], "-n") == 0) {
+        newline = false;
+        first = 2;
+    }
+    for (int i = first; i < command->argc; i++) {
+        if (i > first) {
+            putchar(' ');
+        }
+        fputs(command->argv[i], stdout);
+    }
+    if (newline) {
+        putchar('\n');
+    }
+    return 0;
+}
+
+/**
+ * Implements true.
+ *
+ * @return: 0
+ */
+int true_builtin(struct command_line *command, struct shell_context *context) {
+    (void)command;
+    (void)context;
+    return 0;
+}
+
+/**
+ * Implements false.
+ *
+ * @return: 1
+ */
+int false_builtin(struct command_line *command, struct shell_context *context) {
+    (void)command;
+    (void)context;
+    return 1;
+}
+
+/**
+ * Implements pwd.
+ *
+ * @param command: The parsed command
+ * @param context: The shell context
+ * @return: 0 on success, 1 on failure
+ */
+int pwd_builtin(struct command_line *command, struct shell_context *context) {
+    char path[PATH_MAX];
+    (void)command;
+    (void)context;
+
+    if (getcwd(path, sizeof(path)) == NULL) {
+        perror("pwd");
+        return 1;
+    }
+    puts(path);
+    return 0;
+}
+
+/**
+ * State of a test expression being evaluated
+ */
+struct test_state {
+    char **argv;
+    int argc;
+    int position;
+    bool error;
+};
+
+/**
+ * Parses an integer operand of test.
+ *
+ * @param state: The expression state, flagged on error
+ * @param text: The operand
+ * @return: The value, or 0 on error
+ */
+static long long test_integer(struct test_state *state, const char *text) {
+    char *end;
+    errno = 0;
+    long long value = strtoll(text, &end, 10);
+    if (errno != 0 || end == text || *end != '\0') {
+        fprintf(stderr, "test: %s: integer expression expected\n", text);
+        state->error = true;
+        return 0;
+    }
+    return value;
+}
+
+/**
+ * Checks whether a word is a unary test operator.
+ *
+ * @param word: The word
+ * @return: true if the word is a unary operator
+ */
+static bool is_unary(const char *word) {
+    return word[0] == '-' && word[1] != '\0' && word[2] == '\0' &&
+        strchr("bcdefghLnprsSwxz", word[1]) != NULL;
+}
+
+/**
+ * Checks whether a word is a binary test operator.
+ *
+ * @param word: The word
+ * @return: true if the word is a binary operator
+ */
+static bool is_binary(const char *word) {
+    static const char *const operators[] = {
+        "=", "==", "!=", "<", ">", "-eq", "-ne", "-lt", "-le", "-gt", "-ge",
+        "-nt", "-ot", "-ef"
+    };
+    for (size_t i = 0; i < sizeof(operators) / sizeof(operators[0]); i++) {
+        if (strcmp(word, operators[i]) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Evaluates a unary operator.
+ *
+ * @param state: The expression state
+ * @param operator: The operator, such as "-f"
+ * @param operand: The operand
+ * @return: The result of the test
+ */
+static bool test_unary(struct test_state *state, const char *operator, const char *operand) {
+    struct stat info;
+    (void)state;
+
+    switch (operator[1]) {
+        case 'n':
+            return operand[0] != '\0';
+        case 'z':
+            return operand[0] == '\0';
+        case 'r':
+            return access(operand, R_OK) == 0;
+        case 'w':
+            return access(operand, W_OK) == 0;
+        case 'x':
+            return access(operand, X_OK) == 0;
+        case 'h':
+        case 'L':
+            return lstat(operand, &info) == 0 && S_ISLNK(info.st_mode);
+    }
+
+    if (stat(operand, &info) != 0) {
+        return false;
+    }
+    switch (operator[1]) {
+        case 'b':
+            return S_ISBLK(info.st_mode);
+        case 'c':
+            return S_ISCHR(info.st_mode);
+        case 'd':
+            return S_ISDIR(info.st_mode);
+        case 'f':
+            return S_ISREG(info.st_mode);
+        case 'g':
+            return (info.st_mode & S_ISGID) != 0;
+        case 'p':
+            return S_ISFIFO(info.st_mode);
+        case 's':
+            return info.st_size > 0;
+        case 'S':
+            return S_ISSOCK(info.st_mode);
+        default:
+            return true; // -e
+    }
+}
+
+/**
+ * Evaluates a binary operator.
+ *
+ * @param state: The expression state
+ * @param left: The left operand
+ * @param operator: The operator
+ * @param right: The right operand
+ * @return: The result of the test
+ */
+static bool test_binary(
+    struct test_state *state,
+    const char *left,
+    const char *operator,
+    const char *right
+) {
+    if (operator[0] != '-') {
+        int order = strcmp(left, right);
+        switch (operator[0]) {
+            case '=':
+                return order == 0;
+            case '!':
+                return order != 0;
+            case '<':
+                return order < 0;
+            default:
+                return order > 0;
+        }
+    }
+
+    if (strcmp(operator, "-nt") == 0 || strcmp(operator, "-ot") == 0 ||
+        strcmp(operator, "-ef") == 0) {
+        // File comparisons
+        struct stat left_info;
+        struct stat right_info;
+        bool have_left = stat(left, &left_info) == 0;
+        bool have_right = stat(right, &right_info) == 0;
+        if (strcmp(operator, "-ef") == 0) {
+            return have_left && have_right &&
+                left_info.st_dev == right_info.st_dev &&
+                left_info.st_ino == right_info.st_ino;
+        }
+        if (strcmp(operator, "-nt") == 0) {
+            return have_left &&
+                (!have_right || left_info.st_mtime > right_info.st_mtime);
+        }
+        return have_right &&
+            (!have_left || left_info.st_mtime < right_info.st_mtime);
+    }
+
+    long long a = test_integer(state, left);
+    long long b = test_integer(state, right);
+    if (strcmp(operator, "-eq") == 0) {
+        return a == b;
+    } else if (strcmp(operator, "-ne") == 0) {
+        return a != b;
+    } else if (strcmp(operator, "-lt") == 0) {
+        return a < b;
+    } else if (strcmp(operator, "-le") == 0) {
+        return a <= b;
+    } else if (strcmp(operator, "-gt") == 0) {
+        return a > b;
+    }
+    return a >= b;
+}
+
+static bool test_or(struct test_state *state);
+
+/**
+ * Evaluates a primary: ( expression ), a unary or binary test, or a
+ * single string.
+ *
+ * @param state: The expression state
+ * @return: The result of the primary
+ */
+static bool test_primary(struct test_state *state) {
+    char **argv = state->argv + state->position;
+    int remaining = state->argc - state->position;
+
+    if (remaining <= 0) {
+        fprintf(stderr, "test: argument expected\n");
+        state->error = true;
+        return false;
+    }
+
+    // A binary operator takes precedence, so "-n = -n" compares strings
+    if (remaining >= 3 && is_binary(argv[1])) {
+        state->position += 3;
+        return test_binary(state, argv[0], argv[1], argv[2]);
+    }
+    if (strcmp(argv[0], "(") == 0) {
+        state->position++;
+        bool result = test_or(state);
+        if (state->position >= state->argc ||
+            strcmp(state->argv[state->position], ")") != 0) {
+            fprintf(stderr, "test: ')' expected\n");
+            state->error = true;
+            return false;
+        }
+        state->position++;
+        return result;
+    }
+    if (remaining >= 2 && is_unary(argv[0])) {
+        state->position += 2;
+        return test_unary(state, argv[0], argv[1]);
+    }
+    state->position++;
+    return argv[0][0] != '\0';
+}
+
+/**
+ * Evaluates a negation.
+ *
+ * @param state: The expression state
+ * @return: The result of the negation
+ */
+static bool test_not(struct test_state *state) {
+    if (state->position < state->argc - 1 &&
+        strcmp(state->argv[state->position], "!") == 0) {
+        state->position++;
+        return !test_not(state);
+    }
+    return test_primary(state);
+}
+
+/**
+ * Evaluates a chain of -a operators.
+ *
+ * @param state: The expression state
+ * @return: The result of the chain
+ */
+static bool test_and(struct test_state *state) {
+    bool result = test_not(state);
+    while (state->position < state->argc &&
+           strcmp(state->argv[state->position], "-a") == 0) {
+        state->position++;
+        bool right = test_not(state);
+        result = result && right;
+    }
+    return result;
+}
+
+/**
+ * Evaluates a chain of -o operators.
+ *
+ * @param state: The expression state
+ * @return: The result of the chain
+ */
+static bool test_or(struct test_state *state) {
+    bool result = test_and(state);
+    while (state->position < state->argc &&
+           strcmp(state->argv[state->position], "-o") == 0) {
+        state->position++;
+        bool right = test_and(state);
+        result = result || right;
+    }
+    return result;
+}
+
+/**
+ * Implements test and [. The [ form needs a closing ].
+ *
+ * @param command: The parsed command
+ * @param context: The shell context
+ * @return: 0 if the expression is true, 1 if it is false, 2 on error
+ */
+int test_builtin(struct command_line *command, struct shell_context *context) {
+    struct test_state state = {command->argv + 1, command->argc - 1, 0, false};
+    (void)context;
+
+    if (strcmp(command->argv[0], BRACKET_CMD) == 0) {
+        if (state.argc == 0 || strcmp(state.argv[state.argc - 1], "]") != 0) {
+            fprintf(stderr, "[: missing ']'\n");
+            fflush(stderr);
+            return 2;
+        }
+        state.argc--;
+    }
+    if (state.argc == 0) {
+        return 1;
+    }
+
+    bool result = test_or(&state);
+    if (!state.error && state.position < state.argc) {
+        fprintf(stderr, "test: %s: unexpected argument\n",
+                state.argv[state.position]);
+        state.error = true;
+    }
+    if (state.error) {
+        fflush(stderr);
+        return 2;
+    }
+    return result ? 0 : 1;
+}
+
+/**
+ * Writes the character of a backslash escape.
+ *
+ * @param text: Points just after the backslash, advanced past the escape
+ * @return: false if the escape was \c, which ends all output
+ */
+static bool print_escape(const char **text) {
+    const char *p = *text;
+    int value;
+
+    switch (*p) {
+        case 'a': putchar('\a'); break;
+        case 'b': putchar('\b'); break;
+        case 'c': *text = p + 1; return false;
+        case 'e': putchar('\033'); break;
+        case 'f': putchar('\f'); break;
+        case 'n': putchar('\n'); break;
+        case 'r': putchar('\r'); break;
+        case 't': putchar('\t'); break;
+        case 'v': putchar('\v'); break;
+        case '\\': putchar('\\'); break;
+        case '0': case '1': case '2': case '3':
+        case '4': case '5': case '6': case '7':
+            // Up to three octal digits, after an optional leading 0
+            if (*p == '0') {
+                p++;
+            }
+            value = 0;
+            for (int digits = 0; digits < 3 && *p >= '0' && *p <= '7'; digits++) {
+                value = value * 8 + (*p++ - '0');
+            }
+            putchar(value);
+            *text = p;
+            return true;
+        case '\0':
+            putchar('\\');
+            *text = p;
+            return true;
+        default:
+            putchar('\\');
+            putchar(*p);
+            break;
+    }
+    *text = p + 1;
+    return true;
+}
+
+/**
+ * Writes a string, interpreting backslash escapes (the %b conversion).
+ *
+ * @param text: The string
+ * @return: false if the string contained \c
+ */
+static bool print_escaped(const char *text) {
+    while (*text != '\0') {
+        if (*text == '\\') {
+            text++;
+            if (!print_escape(&text)) {
+                return false;
+            }
+        } else {
+            putchar(*text++);
+        }
+    }
+    return true;
+}
+
+/**
+ * Converts a printf argument to an integer. A leading quote gives the
+ * value of the next character, as in POSIX printf.
+ *
+ * @param text: The argument
+ * @param failed: Set when the argument is not a valid number
+ * @return: The value
+ */
+static long long printf_integer(const char *text, bool *failed) {
+    char *end;
+
+    if (text[0] == '\'' || text[0] == '"') {
+        return (unsigned char)text[1];
+    }
+    errno = 0;
+    long long value = strtoll(text, &end, 0);
+    if (errno != 0 || *end != '\0' || (end == text && *text != '\0')) {
+        fprintf(stderr, "printf: %s: invalid number\n", text);
+        *failed = true;
+    }
+    return value;
+}
+
+/**
+ * Implements printf. The format is reused until the arguments run out,
+ * and missing arguments count as empty strings or zero.
+ *
+ * @param command: The parsed command
+ * @param context: The shell context
+ * @return: 0 on success, 1 if an argument was invalid, 2 on misuse
+ */
+int printf_builtin(struct command_line *command, struct shell_context *context) {
+    char spec[64];
+    bool failed = false;
+    (void)context;
+
+    if (command->argc < 2) {
+        fprintf(stderr, "usage: printf format [arguments...]\n");
+        fflush(stderr);
+        return 2;
+    }
+
+    const char *format = command->argv[1];
+    char **args = command->argv + 2;
+    int arg_count = command->argc - 2;
+    int next_arg = 0;
+
+    do {
+        int used_before = next_arg;
+        for (const char *p = format; *p != '\0'; ) {
+            if (*p == '\\') {
+                p++;
+                if (!print_escape(&p)) {
+                    return failed ? 1 : 0;
+                }
+                continue;
+            }
+            if (*p != '%') {
+                putchar(*p++);
+                continue;
+            }
+            if (p[1] == '%') {
+                putchar('%');
+                p += 2;
+                continue;
+            }
+
+            // Copy flags, width and precision into a conversion spec
+            size_t length = strspn(p + 1, "-+ #0123456789.") + 1;
+            char conversion = p[length];
+            if (conversion == '\0' || length + 4 > sizeof(spec)) {
+                fprintf(stderr, "printf: invalid format\n");
+                fflush(stderr);
+                return 1;
+            }
+            memcpy(spec, p, length);
+            p += length + 1;
+
+            const char *arg = next_arg < arg_count ? args[next_arg++] : NULL;
+            switch (conversion) {
+                case 's':
+                    spec[length] = 's';
+                    spec[length + 1] = '\0';
+                    printf(spec, arg != NULL ? arg : "");
+                    break;
+                case 'b':
+                    if (arg != NULL && !print_escaped(arg)) {
+                        return failed ? 1 : 0;
+                    }
+                    break;
+                case 'c':
+                    if (arg != NULL && arg[0] != '\0') {
+                        putchar(arg[0]);
+                    }
+                    break;
+                case 'd':
+                case 'i':
+                case 'o':
+                case 'u':
+                case 'x':
+                case 'X':
+                    spec[length] = 'l';
+                    spec[length + 1] = 'l';
+                    spec[length + 2] = conversion;
+                    spec[length + 3] = '\0';
+                    printf(spec, arg != NULL ? printf_integer(arg, &failed) : 0LL);
+                    break;
+                default:
+                    fprintf(stderr, "printf: %%%c: invalid conversion\n", conversion);
+                    fflush(stderr);
+                    return 1;
+            }
+        }
+        // Stop when a pass of the format took no arguments
+        if (next_arg == used_before) {
+            break;
+        }
+    } while (next_arg < arg_count);
+
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,513 @@
+/**
+ * zygote.c - Pre-forked helper process that spawns commands
+ *
+ * With SMALLSH_ZYGOTE set, the shell forks a helper right at startup,
+ * while its address space is still tiny, and hands it every external
+ * command it would otherwise start itself. The helper never allocates
+ * after that, so the cost of creating a process stays the same however
+ * large the interactive shell grows.
+ *
+ * A request carries the resolved path, the arguments, the process group
+ * and the cpus, nice and sched prefixes over a SOCK_SEQPACKET socketpair.
+ * Standard input, output and error and the shell's working directory
+ * travel with it as descriptors (SCM_RIGHTS), so the shell opens the
+ * redirections itself and the helper never needs to know about cd. The
+ * shell never changes its environment, so the helper's copy stays
+ * current.
+ *
+ * The helper creates each child with clone(CLONE_PARENT), which makes
+ * the child a child of the shell rather than of the helper. Exit
+ * statuses, rusage and stops therefore reach the shell through the usual
+ * SIGCHLD and wait4() path; the helper only reports the pid, or the
+ * error if the exec failed, in which case the caller falls back to the
+ * regular paths, which print the usual messages.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include "zygote.h"
+#include "affinity.h"
+#include "io.h"
+#include "signals.h"
+
+#define ZYGOTE_MAX_REQUEST 65536
+#define ZYGOTE_MAX_ARGS 4096
+#define ZYGOTE_FD_COUNT 4               // Standard input, output, error and cwd
+#define ZYGOTE_FD_CWD 3
+
+extern char **environ;
+
+/**
+ * Fixed part of a spawn request, followed by the path of the executable
+ * and the arguments, each NUL-terminated
+ */
+struct zygote_request {
+    uint32_t argc;
+    int32_t pgid;                       // As in struct spawn_io
+    int32_t nice;
+    int32_t sched_policy;
+    uint8_t is_bg;
+    uint8_t has_cpus;
+    uint8_t has_nice;
+    uint8_t has_sched;
+    cpu_set_t cpus;
+};
+
+/**
+ * Answer to a spawn request
+ */
+struct zygote_reply {
+    int32_t pid;                        // The child, or -1
+    int32_t error;                      // errno of a failed spawn or exec, or 0
+    int32_t exec_failed;                // The error came from execve() itself
+};
+
+/* Request buffer, the helper's only storage besides its stack */
+static union {
+    struct zygote_request request;
+    char bytes[ZYGOTE_MAX_REQUEST];
+} message;
+
+/* The shell's end of the socket, -1 when the helper is not running */
+static int zygote_fd = -1;
+static pid_t zygote_pid = -1;
+static pid_t zygote_owner = -1;
+
+/**
+ * Sets up the new child and execs the command. Never returns; a failure
+ * is written to the report pipe.
+ *
+ * @param request: The request
+ * @param path: The executable
+ * @param argv: The arguments
+ * @param fds: Standard input, output, error and the working directory
+ * @param report_fd: The pipe to write errno to if the setup or the exec
+ *     fails, followed by whether execve() itself failed
+ */
+static void start_child(
+    const struct zygote_request *request,
+    const char *path,
+    char **argv,
+    const int fds[ZYGOTE_FD_COUNT],
+    int report_fd
+) {
+    struct command_line settings;
+    sigset_t no_signals;
+
+    memset(&settings, 0, sizeof(settings));
+    settings.cpus = request->has_cpus ? (cpu_set_t *)&request->cpus : NULL;
+    settings.nice = request->nice;
+    settings.has_nice = request->has_nice;
+    settings.sched_policy = request->sched_policy;
+    settings.has_sched = request->has_sched;
+
+    setup_signal_handlers(false, request->is_bg, NULL);
+    sigemptyset(&no_signals);
+    sigprocmask(SIG_SETMASK, &no_signals, NULL);
+
+    if ((request->pgid == -1 || setpgid(0, request->pgid) == 0) &&
+        fchdir(fds[ZYGOTE_FD_CWD]) == 0 &&
+        dup2(fds[0], STDIN_FILENO) != -1 &&
+        dup2(fds[1], STDOUT_FILENO) != -1 &&
+        dup2(fds[2], STDERR_FILENO) != -1 &&
+        affinity_apply(&settings) == 0) {
+        execve(path, argv, environ);
+        int report[2] = {errno, 1};
+        write(report_fd, report, sizeof(report));
+        _exit(127);
+    }
+    int report[2] = {errno, 0};
+    write(report_fd, report, sizeof(report));
+    _exit(127);
+}
+
+/**
+ * Carries out one spawn request in the helper.
+ *
+ * @param length: The length of the request in the message buffer
+ * @param fds: The descriptors that came with it
+ * @return: The reply to send
+ */
+static struct zygote_reply run_request(size_t length, const int fds[ZYGOTE_FD_COUNT]) {
+    static char *argv[ZYGOTE_MAX_ARGS + 1];
+    struct zygote_reply reply = {-1, EINVAL, 0};
+    const struct zygote_request *request = &message.request;
+    const char *end = message.bytes + length;
+    int report[2];
+
+    // The path and the arguments must all be inside the message
+    if (length < sizeof(*request) || request->argc == 0 ||
+        request->argc > ZYGOTE_MAX_ARGS) {
+        return reply;
+    }
+    char *path = message.bytes + sizeof(*request);
+    char *p = path;
+    for (uint32_t i = 0; i <= request->argc; i++) {
+        char *nul = memchr(p, '\0', end - p);
+        if (nul == NULL) {
+            return reply;
+        }
+        if (i > 0) {
+            argv[i - 1] = p;
+        }
+        p = nul + 1;
+    }
+    argv[request->argc] = NULL;
+
+    if (pipe2(report, O_CLOEXEC) == -1) {
+        reply.error = errno;
+        return reply;
+    }
+
+    // The child's parent is the shell, which reaps it like any other
+    pid_t pid = syscall(SYS_clone, CLONE_PARENT | SIGCHLD, 0, 0, 0, 0);
+    if (pid == 0) {
+        close(report[0]);
+        start_child(request, path, argv, fds, report[1]);
+    }
+    reply.error = pid == -1 ? errno : 0;
+    close(report[1]);
+
+    // The pipe closes on exec, or delivers the errno of a failed one
+    if (pid != -1) {
+        int error[2];
+        ssize_t count;
+        while ((count = read(report[0], error, sizeof(error))) == -1 &&
+               errno == EINTR);
+        if (count == sizeof(error)) {
+            reply.error = error[0];
+            reply.exec_failed = error[1];
+        }
+    }
+    close(report[0]);
+    reply.pid = pid;
+    return reply;
+}
+
+/**
+ * Main loop of the helper: serves requests until the shell closes its
+ * end of the socket.
+ *
+ * @param fd: The helper's end of the socket
+ */
+static void zygote_main(int fd) {
+    char control[CMSG_SPACE(sizeof(int) * ZYGOTE_FD_COUNT)];
+    sigset_t no_signals;
+
+    // Leave with the shell, and stay out of the way of the terminal
+    prctl(PR_SET_PDEATHSIG, SIGKILL);
+    if (getppid() != zygote_owner) {
+        _exit(EXIT_SUCCESS);
+    }
+    prctl(PR_SET_NAME, "smallsh-spawn");
+    signal(SIGINT, SIG_IGN);
+    signal(SIGTSTP, SIG_IGN);
+    signal(SIGQUIT, SIG_IGN);
+    sigemptyset(&no_signals);
+    sigprocmask(SIG_SETMASK, &no_signals, NULL);
+
+    for (;;) {
+        struct iovec iov = {message.bytes, sizeof(message.bytes)};
+        struct msghdr header = {
+            .msg_iov = &iov,
+            .msg_iovlen = 1,
+            .msg_control = control,
+            .msg_controllen = sizeof(control),
+        };
+        ssize_t length = recvmsg(fd, &header, MSG_CMSG_CLOEXEC);
+        if (length == -1 && errno == EINTR) {
+            continue;
+        }
+        if (length <= 0) {
+            _exit(EXIT_SUCCESS);
+        }
+
+        // Take the descriptors, whatever else is wrong with the request
+        int fds[ZYGOTE_FD_COUNT];
+        int fd_count = 0;
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&header);
+        if (cmsg != NULL && cmsg->cmsg_level == SOL_SOCKET &&
+            cmsg->cmsg_type == SCM_RIGHTS) {
+            fd_count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            memcpy(fds, CMSG_DATA(cmsg), fd_count * sizeof(int));
+        }
+
+        struct zygote_reply reply = {-1, EINVAL, 0};
+        if (fd_count == ZYGOTE_FD_COUNT &&
+            !(header.msg_flags & (MSG_TRUNC | MSG_CTRUNC))) {
+            reply = run_request(length, fds);
+        }
+        for (int i = 0; i < fd_count; i++) {
+            close(fds[i]);
+        }
+        send(fd, &reply, sizeof(reply), MSG_NOSIGNAL);
+    }
+}
+
+/**
+ * Starts the helper if SMALLSH_ZYGOTE is set. Called early, while the
+ * shell is still small, since the helper keeps a copy of it.
+ */
+void zygote_start(void) {
+    int fds[2];
+
+    if (getenv("SMALLSH_ZYGOTE") == NULL || zygote_fd != -1) {
+        return;
+    }
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds) == -1) {
+        perror("spawn helper: socketpair() failed");
+        return;
+    }
+
+    zygote_owner = getpid();
+    fflush(stdout);
+    fflush(stderr);
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(fds[0]);
+        zygote_main(fds[1]);
+    }
+    close(fds[1]);
+    if (pid == -1) {
+        perror("spawn helper: fork() failed");
+        close(fds[0]);
+        return;
+    }
+    zygote_fd = fds[0];
+    zygote_pid = pid;
+}
+
+/**
+ * Stops using the helper after the socket failed.
+ */
+static void zygote_lost(void) {
+    fprintf(stderr, "smallsh: spawn helper exited, starting commands directly\n");
+    fflush(stderr);
+    close(zygote_fd);
+    zygote_fd = -1;
+}
+
+/**
+ * Appends a string and its NUL to the request.
+ *
+ * @param used: The length of the request so far, advanced
+ * @param text: The string
+ * @return: 0 on success, -1 if the request would not fit
+ */
+static int append_string(size_t *used, const char *text) {
+    size_t length = strlen(text) + 1;
+
+    if (length > sizeof(message.bytes) - *used) {
+        return -1;
+    }
+    memcpy(message.bytes + *used, text, length);
+    *used += length;
+    return 0;
+}
+
+/**
+ * Opens the standard input and output of a command in the shell, in the
+ * order spawn_redirect() applies them.
+ *
+ * @param command: The command
+ * @param io: The pipe ends of the command
+ * @param fds: Receives the descriptors for standard input and output
+ * @param opened: Receives whether each one has to be closed afterwards
+ * @return: 0 on success, -1 on failure with nothing left open
+ */
+static int open_standard_fds(
+    struct command_line *command,
+    const struct spawn_io *io,
+    int fds[2],
+    bool opened[2]
+) {
+    opened[0] = true;
+    if (command->here_text != NULL) {
+        fds[0] = open_here_document(command->here_text, command->here_length);
+    } else if (command->input_file != NULL) {
+        fds[0] = open(command->input_file, O_RDONLY | O_CLOEXEC);
+    } else if (io->in_fd != -1) {
+        fds[0] = io->in_fd;
+        opened[0] = false;
+    } else if (command->is_bg) {
+        fds[0] = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    } else {
+        fds[0] = STDIN_FILENO;
+        opened[0] = false;
+    }
+    if (fds[0] == -1) {
+        return -1;
+    }
+
+    opened[1] = true;
+    if (command->output_file != NULL) {
+        fds[1] = open(command->output_file,
+                      O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    } else if (io->out_fd != -1) {
+        fds[1] = io->out_fd;
+        opened[1] = false;
+    } else if (command->is_bg) {
+        fds[1] = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    } else {
+        fds[1] = STDOUT_FILENO;
+        opened[1] = false;
+    }
+    if (fds[1] == -1) {
+        if (opened[0]) {
+            close(fds[0]);
+        }
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Sends a request and its descriptors to the helper and waits for the
+ * reply.
+ *
+ * @param used: The length of the request
+ * @param fds: The descriptors to pass
+ * @param reply: Receives the reply
+ * @return: 0 on success, -1 if the helper is gone
+ */
+static int exchange(size_t used, const int fds[ZYGOTE_FD_COUNT], struct zygote_reply *reply) {
+    char control[CMSG_SPACE(sizeof(int) * ZYGOTE_FD_COUNT)];
+    struct iovec iov = {message.bytes, used};
+    struct msghdr header = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control,
+        .msg_controllen = sizeof(control),
+    };
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&header);
+    ssize_t count;
+
+    memset(control, 0, sizeof(control));
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * ZYGOTE_FD_COUNT);
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * ZYGOTE_FD_COUNT);
+
+    while ((count = sendmsg(zygote_fd, &header, MSG_NOSIGNAL)) == -1 &&
+           errno == EINTR);
+    if (count == -1) {
+        return -1;
+    }
+    while ((count = recv(zygote_fd, reply, sizeof(*reply), 0)) == -1 &&
+           errno == EINTR);
+    return count == sizeof(*reply) ? 0 : -1;
+}
+
+/**
+ * Starts an external command through the helper.
+ *
+ * @param command: A pointer to the parsed command line structure
+ * @param exec_path: The resolved path of the executable, or NULL if the
+ *     command was not found in PATH
+ * @param io: The pipe ends and process group for the child
+ * @param exec_failed: Set to true if execve() itself failed, rather
+ *     than setting up the child
+ * @return: The child's pid, or -1 if the helper could not start the
+ *     command: errno is the exec error, or 0 if the command should take
+ *     the other paths without that
+ */
+pid_t zygote_spawn(
+    struct command_line *command,
+    const char *exec_path,
+    const struct spawn_io *io,
+    bool *exec_failed
+) {
+    struct zygote_request *request = &message.request;
+    struct zygote_reply reply;
+    size_t used = sizeof(*request);
+    int fds[ZYGOTE_FD_COUNT];
+    bool opened[2];
+
+    // Subshells are not the helper's parent, so they cannot use it
+    errno = 0;
+    *exec_failed = false;
+    if (zygote_fd == -1 || exec_path == NULL || getpid() != zygote_owner) {
+        return -1;
+    }
+
+    memset(request, 0, sizeof(*request));
+    request->argc = command->argc;
+    request->pgid = io->pgid;
+    request->is_bg = command->is_bg;
+    request->has_cpus = command->cpus != NULL;
+    if (command->cpus != NULL) {
+        request->cpus = *command->cpus;
+    }
+    request->has_nice = command->has_nice;
+    request->nice = command->nice;
+    request->has_sched = command->has_sched;
+    request->sched_policy = command->sched_policy;
+    if (append_string(&used, exec_path) == -1) {
+        return -1;
+    }
+    for (int i = 0; i < command->argc; i++) {
+        if (append_string(&used, command->argv[i]) == -1) {
+            return -1;
+        }
+    }
+
+    // Failed redirections are reported by the fork() path
+    if (open_standard_fds(command, io, fds, opened) == -1) {
+        errno = 0;
+        return -1;
+    }
+    fds[2] = STDERR_FILENO;
+    fds[ZYGOTE_FD_CWD] = open(".", O_PATH | O_DIRECTORY | O_CLOEXEC);
+
+    int result = fds[ZYGOTE_FD_CWD] == -1 ? 1 : exchange(used, fds, &reply);
+    for (int i = 0; i < 2; i++) {
+        if (opened[i]) {
+            close(fds[i]);
+        }
+    }
+    if (fds[ZYGOTE_FD_CWD] != -1) {
+        close(fds[ZYGOTE_FD_CWD]);
+    }
+    if (result != 0) {
+        if (result == -1) {
+            zygote_lost();
+        }
+        errno = 0;
+        return -1;
+    }
+
+    if (reply.pid != -1 && reply.error != 0) {
+        // Reap the failed child and let the fork() path report the error
+        waitpid(reply.pid, NULL, 0);
+    }
+    if (reply.pid == -1 || reply.error != 0) {
+        *exec_failed = reply.pid != -1 && reply.exec_failed != 0;
+        errno = reply.pid == -1 ? 0 : reply.error;
+        return -1;
+    }
+    return reply.pid;
+}
+
+/**
+ * Stops the helper and waits for it to exit.
+ */
+void zygote_stop(void) {
+    if (zygote_fd == -1) {
+        return;
+    }
+    close(zygote_fd);
+    zygote_fd = -1;
+    if (getpid() == zygote_owner) {
+        waitpid(zygote_pid, NULL, 0);
+    }
+}
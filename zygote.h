@@ -0,0 +1,23 @@
+/**
+ * zygote.h - Pre-forked helper process that spawns commands
+ */
+
+#ifndef ZYGOTE_H
+#define ZYGOTE_H
+
+#include <stdbool.h>
+#include <sys/types.h>
+#include "parser.h"
+#include "spawn.h"
+
+/* Function declarations */
+void zygote_start(void);
+pid_t zygote_spawn(
+    struct command_line *command,
+    const char *exec_path,
+    const struct spawn_io *io,
+    bool *exec_failed
+);
+void zygote_stop(void);
+
+#endif /* ZYGOTE_H */